@@ -0,0 +1,164 @@
+#pragma once
+#include "ModelHD.hh"
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+/**
+ * @brief Bipolar hypervector packed as one bit per dimension
+ * Bit i set means +1, cleared means -1, the convention of HV and of the
+ * sketch projections. A 1024-dim vector takes 128 bytes instead of 2KB of
+ * int16. Similarity is computed with popcount; the unused high bits of the
+ * last word are kept cleared.
+ * @param D number of dimensions
+ */
+template <size_t D>
+class BinaryHV
+{
+    public:
+    static constexpr size_t WORDS = (D + 63) / 64;
+
+    /**
+     * @brief The all -1 vector
+     */
+    BinaryHV() : words() {}
+
+    /**
+     * @brief Constructs the vector from bits
+     * @param bits WORDS words; bits beyond D are ignored
+     */
+    BinaryHV(const uint64_t* bits)
+    {
+        std::memcpy(words, bits, sizeof(words));
+        clear_tail();
+    }
+
+    /**
+     * @brief Uniformly random vector
+     */
+    BinaryHV(std::mt19937_64& gen)
+    {
+        for (auto& it : words)
+        {
+            it = gen();
+        }
+        clear_tail();
+    }
+
+    /**
+     * @brief Majority vote of a bundle accumulated in a ModelHD; ties go to +1
+     */
+    template <typename T>
+    BinaryHV(const ModelHD<T, D>& acc)
+    {
+        hd::sign_bits(words, acc.data(), D);
+    }
+
+    /**
+     * @return +1 or -1
+     */
+    int operator[](size_t i) const { return (words[i / 64] >> (i % 64)) & 1U ? 1 : -1; }
+
+    const uint64_t* data() const { return words; }
+
+    /**
+     * @brief bind operation; XOR of the sign bits, inverted so that it
+     * equals the elementwise bipolar product
+     */
+    BinaryHV& operator*=(const BinaryHV& other)
+    {
+        for (size_t i = 0; i < WORDS; ++i)
+        {
+            words[i] = ~(words[i] ^ other.words[i]);
+        }
+        clear_tail();
+        return *this;
+    }
+
+    BinaryHV operator*(const BinaryHV& other) const
+    {
+        BinaryHV result(*this);
+        result *= other;
+        return result;
+    }
+
+    /**
+     * @brief permute operation, a cyclic shift by k dimensions
+     */
+    BinaryHV permute(size_t k) const
+    {
+        BinaryHV result;
+        k %= D;
+        if constexpr (D % 64 == 0)
+        {
+            // word j of the result is the 64 bits starting at source bit j * 64 - k
+            for (size_t j = 0; j < WORDS; ++j)
+            {
+                size_t s = (j * 64 + D - k) % D;
+                size_t w = s / 64, b = s % 64;
+                result.words[j] = b == 0 ? words[w] : (words[w] >> b) | (words[(w + 1) % WORDS] << (64 - b));
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < D; ++i)
+            {
+                size_t j = (i + k) % D;
+                result.words[j / 64] |= ((words[i / 64] >> (i % 64)) & 1U) << (j % 64);
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Majority bundle of n vectors; ties go to +1
+     */
+    static BinaryHV majority(const BinaryHV* hvs, size_t n)
+    {
+        ModelHD<int32_t, D> acc;
+        for (size_t i = 0; i < n; ++i)
+        {
+            acc += hvs[i];
+        }
+        return BinaryHV(acc);
+    }
+
+    /**
+     * @brief Number of dimensions where the vectors differ
+     */
+    size_t hamming(const BinaryHV& other) const
+    {
+        return hd::hamming(words, other.words, WORDS);
+    }
+
+    /**
+     * @brief dot product, D - 2 * hamming distance
+     */
+    int64_t dot(const BinaryHV& other) const
+    {
+        return (int64_t)D - 2 * (int64_t)hamming(other);
+    }
+
+    /**
+     * @brief Dot products of this query against n vectors
+     */
+    void dot_batch(const BinaryHV* others, size_t n, int64_t* out) const
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            __builtin_prefetch(others + i + 1);
+            out[i] = dot(others[i]);
+        }
+    }
+
+    protected:
+    alignas(WORDS >= 8 ? 64 : 8) uint64_t words[WORDS];
+
+    void clear_tail()
+    {
+        if constexpr (D % 64 != 0)
+        {
+            words[WORDS - 1] &= (1ULL << (D % 64)) - 1;
+        }
+    }
+};
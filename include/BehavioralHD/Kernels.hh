@@ -0,0 +1,760 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <immintrin.h>
+
+/**
+ * @brief SIMD kernels behind ModelHD
+ * Elementwise kernels run on whole registers and finish with a scalar tail.
+ * Integer dot products accumulate exactly in 64 bits. AVX-512 is used when
+ * the target has it, AVX2 otherwise, and plain loops for other element types.
+ */
+namespace hd
+{
+    /**
+     * @brief Accumulator of dot products: exact 64-bit for integers, double otherwise
+     */
+    template<typename T>
+    using acc_t = typename std::conditional<std::is_integral<T>::value, int64_t, double>::type;
+
+    /**
+     * @brief Register-wide operations on lanes of T; N = 0 means no SIMD support
+     */
+    template<typename T>
+    struct Lanes
+    {
+        static constexpr size_t N = 0;
+    };
+
+#if defined(__AVX512BW__)
+    template<>
+    struct Lanes<int16_t>
+    {
+        using reg = __m512i;
+        static constexpr size_t N = 32;
+        static reg load(const int16_t* p) { return _mm512_loadu_si512(p); }
+        static void store(int16_t* p, reg v) { _mm512_storeu_si512(p, v); }
+        static reg set1(int16_t x) { return _mm512_set1_epi16(x); }
+        static reg add(reg a, reg b) { return _mm512_add_epi16(a, b); }
+        static reg sub(reg a, reg b) { return _mm512_sub_epi16(a, b); }
+        static reg mul(reg a, reg b) { return _mm512_mullo_epi16(a, b); }
+    };
+
+    template<>
+    struct Lanes<int32_t>
+    {
+        using reg = __m512i;
+        static constexpr size_t N = 16;
+        static reg load(const int32_t* p) { return _mm512_loadu_si512(p); }
+        static void store(int32_t* p, reg v) { _mm512_storeu_si512(p, v); }
+        static reg set1(int32_t x) { return _mm512_set1_epi32(x); }
+        static reg add(reg a, reg b) { return _mm512_add_epi32(a, b); }
+        static reg sub(reg a, reg b) { return _mm512_sub_epi32(a, b); }
+        static reg mul(reg a, reg b) { return _mm512_mullo_epi32(a, b); }
+    };
+
+    template<>
+    struct Lanes<float>
+    {
+        using reg = __m512;
+        static constexpr size_t N = 16;
+        static reg load(const float* p) { return _mm512_loadu_ps(p); }
+        static void store(float* p, reg v) { _mm512_storeu_ps(p, v); }
+        static reg set1(float x) { return _mm512_set1_ps(x); }
+        static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+        static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+        static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+    };
+#elif defined(__AVX2__)
+    template<>
+    struct Lanes<int16_t>
+    {
+        using reg = __m256i;
+        static constexpr size_t N = 16;
+        static reg load(const int16_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+        static void store(int16_t* p, reg v) { _mm256_storeu_si256((__m256i*)p, v); }
+        static reg set1(int16_t x) { return _mm256_set1_epi16(x); }
+        static reg add(reg a, reg b) { return _mm256_add_epi16(a, b); }
+        static reg sub(reg a, reg b) { return _mm256_sub_epi16(a, b); }
+        static reg mul(reg a, reg b) { return _mm256_mullo_epi16(a, b); }
+    };
+
+    template<>
+    struct Lanes<int32_t>
+    {
+        using reg = __m256i;
+        static constexpr size_t N = 8;
+        static reg load(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+        static void store(int32_t* p, reg v) { _mm256_storeu_si256((__m256i*)p, v); }
+        static reg set1(int32_t x) { return _mm256_set1_epi32(x); }
+        static reg add(reg a, reg b) { return _mm256_add_epi32(a, b); }
+        static reg sub(reg a, reg b) { return _mm256_sub_epi32(a, b); }
+        static reg mul(reg a, reg b) { return _mm256_mullo_epi32(a, b); }
+    };
+
+    template<>
+    struct Lanes<float>
+    {
+        using reg = __m256;
+        static constexpr size_t N = 8;
+        static reg load(const float* p) { return _mm256_loadu_ps(p); }
+        static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+        static reg set1(float x) { return _mm256_set1_ps(x); }
+        static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+        static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+        static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    };
+#endif
+
+    struct Add
+    {
+        template<typename L, typename R> static R vec(R a, R b) { return L::add(a, b); }
+        template<typename T> static T scalar(T a, T b) { return (T)(a + b); }
+    };
+
+    struct Sub
+    {
+        template<typename L, typename R> static R vec(R a, R b) { return L::sub(a, b); }
+        template<typename T> static T scalar(T a, T b) { return (T)(a - b); }
+    };
+
+    struct Mul
+    {
+        template<typename L, typename R> static R vec(R a, R b) { return L::mul(a, b); }
+        template<typename T> static T scalar(T a, T b) { return (T)(a * b); }
+    };
+
+    /**
+     * @brief dst[i] = Op(a[i], b[i]); dst may alias a or b
+     * @param Op Add, Sub or Mul
+     */
+    template<typename Op, typename T>
+    inline void apply(T* dst, const T* a, const T* b, size_t n)
+    {
+        using L = Lanes<T>;
+        size_t i = 0;
+        if constexpr (L::N != 0)
+        {
+            for (size_t full = n - n % L::N; i < full; i += L::N)
+            {
+                L::store(dst + i, Op::template vec<L>(L::load(a + i), L::load(b + i)));
+            }
+        }
+        for (; i < n; ++i)
+        {
+            dst[i] = Op::scalar(a[i], b[i]);
+        }
+    }
+
+    template<typename T>
+    inline void add(T* dst, const T* a, const T* b, size_t n) { apply<Add>(dst, a, b, n); }
+
+    template<typename T>
+    inline void sub(T* dst, const T* a, const T* b, size_t n) { apply<Sub>(dst, a, b, n); }
+
+    template<typename T>
+    inline void mul(T* dst, const T* a, const T* b, size_t n) { apply<Mul>(dst, a, b, n); }
+
+    /**
+     * @brief dst[i] = a[i] * s
+     */
+    template<typename T>
+    inline void scale(T* dst, const T* a, T s, size_t n)
+    {
+        using L = Lanes<T>;
+        size_t i = 0;
+        if constexpr (L::N != 0)
+        {
+            auto sv = L::set1(s);
+            for (size_t full = n - n % L::N; i < full; i += L::N)
+            {
+                L::store(dst + i, L::mul(L::load(a + i), sv));
+            }
+        }
+        for (; i < n; ++i)
+        {
+            dst[i] = (T)(a[i] * s);
+        }
+    }
+
+    /**
+     * @brief Cyclic shift: dst[(i + k) % n] = src[i]; dst must not alias src
+     */
+    template<typename T>
+    inline void rotate(T* dst, const T* src, size_t k, size_t n)
+    {
+        k %= n;
+        // two contiguous block copies, which the library moves with full vectors
+        __builtin_memcpy(dst + k, src, (n - k) * sizeof(T));
+        __builtin_memcpy(dst, src + n - k, k * sizeof(T));
+    }
+
+    /**
+     * @brief Bipolar vector from bits: dst[i] = bit i of bits ? 1 : -1
+     */
+    template<typename T>
+    inline void from_bits(T* dst, const uint64_t* bits, size_t n)
+    {
+        size_t i = 0;
+#if defined(__AVX512BW__)
+        if constexpr (std::is_same<T, int16_t>::value)
+        {
+            __m512i pos = _mm512_set1_epi16(1);
+            __m512i neg = _mm512_set1_epi16(-1);
+            for (size_t full = n - n % 32; i < full; i += 32)
+            {
+                __mmask32 m = (__mmask32)(bits[i / 64] >> (i % 64));
+                _mm512_storeu_si512(dst + i, _mm512_mask_blend_epi16(m, neg, pos));
+            }
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            dst[i] = (bits[i / 64] >> (i % 64)) & 1U ? 1 : -1;
+        }
+    }
+
+    /**
+     * @brief Sum of a[i] * b[i], scalar reference
+     */
+    template<typename T>
+    inline acc_t<T> dot_scalar(const T* a, const T* b, size_t n)
+    {
+        acc_t<T> result = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            result += (acc_t<T>)a[i] * b[i];
+        }
+        return result;
+    }
+
+#if defined(__AVX512BW__)
+    /**
+     * @brief Adds the int32 lanes of v to the int64 lanes of acc, pairwise
+     */
+    inline __m512i widen_add(__m512i acc, __m512i v)
+    {
+        __m512i hi = _mm512_srai_epi64(v, 32);
+        __m512i lo = _mm512_srai_epi64(_mm512_slli_epi64(v, 32), 32);
+        return _mm512_add_epi64(acc, _mm512_add_epi64(hi, lo));
+    }
+
+    /**
+     * @brief int16 products of 32 lanes, summed pairwise into int32; only
+     * overflows when both products of a pair are (-32768)^2
+     */
+    inline __m512i madd_tail(const int16_t* a, const int16_t* b, size_t i, size_t n)
+    {
+        __mmask32 m = (__mmask32)((1ULL << (n - i)) - 1);
+        return _mm512_madd_epi16(_mm512_maskz_loadu_epi16(m, a + i), _mm512_maskz_loadu_epi16(m, b + i));
+    }
+#elif defined(__AVX2__)
+    inline __m256i widen_add(__m256i acc, __m256i v)
+    {
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        return _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+#endif
+
+#if defined(__AVX2__)
+    inline int64_t reduce_add(__m256i v)
+    {
+        __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+    }
+#endif
+
+    template<typename T>
+    inline acc_t<T> dot(const T* a, const T* b, size_t n)
+    {
+        return dot_scalar(a, b, n);
+    }
+
+    template<>
+    inline int64_t dot<int16_t>(const int16_t* a, const int16_t* b, size_t n)
+    {
+#if defined(__AVX512BW__)
+        __m512i acc = _mm512_setzero_si512();
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            acc = widen_add(acc, _mm512_madd_epi16(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+        }
+        if (i < n)
+        {
+            acc = widen_add(acc, madd_tail(a, b, i, n));
+        }
+        return _mm512_reduce_add_epi64(acc);
+#elif defined(__AVX2__)
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256i p = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                          _mm256_loadu_si256((const __m256i*)(b + i)));
+            acc = widen_add(acc, p);
+        }
+        return reduce_add(acc) + dot_scalar(a + i, b + i, n - i);
+#else
+        return dot_scalar(a, b, n);
+#endif
+    }
+
+    template<>
+    inline int64_t dot<int32_t>(const int32_t* a, const int32_t* b, size_t n)
+    {
+#if defined(__AVX512BW__)
+        __m512i acc = _mm512_setzero_si512();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512i x = _mm512_loadu_si512(a + i);
+            __m512i y = _mm512_loadu_si512(b + i);
+            // mul_epi32 multiplies the even lanes into 64-bit products
+            acc = _mm512_add_epi64(acc, _mm512_mul_epi32(x, y));
+            acc = _mm512_add_epi64(acc, _mm512_mul_epi32(_mm512_srli_epi64(x, 32), _mm512_srli_epi64(y, 32)));
+        }
+        return _mm512_reduce_add_epi64(acc) + dot_scalar(a + i, b + i, n - i);
+#elif defined(__AVX2__)
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+            __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+            acc = _mm256_add_epi64(acc, _mm256_mul_epi32(x, y));
+            acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32)));
+        }
+        return reduce_add(acc) + dot_scalar(a + i, b + i, n - i);
+#else
+        return dot_scalar(a, b, n);
+#endif
+    }
+
+    /**
+     * @brief Dot products of one query against m models
+     * @param q the query, n elements
+     * @param models first model; model j starts at models + j * stride
+     * @param stride distance between models in elements
+     * @param n elements per vector
+     * @param m number of models
+     * @param out m results
+     */
+    template<typename T>
+    inline void dot_batch(const T* q, const T* models, size_t stride, size_t n, size_t m, acc_t<T>* out)
+    {
+        size_t j = 0;
+#if defined(__AVX512BW__)
+        if constexpr (std::is_same<T, int16_t>::value)
+        {
+            // four models per pass, so each query register is loaded once per four dots
+            for (; j + 4 <= m; j += 4)
+            {
+                const T* p = models + j * stride;
+                __builtin_prefetch(p + 4 * stride);
+                __m512i acc[4] = {};
+                size_t i = 0;
+                for (; i + 32 <= n; i += 32)
+                {
+                    __m512i qv = _mm512_loadu_si512(q + i);
+                    for (size_t k = 0; k < 4; ++k)
+                    {
+                        acc[k] = widen_add(acc[k], _mm512_madd_epi16(qv, _mm512_loadu_si512(p + k * stride + i)));
+                    }
+                }
+                for (size_t k = 0; k < 4; ++k)
+                {
+                    if (i < n)
+                    {
+                        acc[k] = widen_add(acc[k], madd_tail(q, p + k * stride, i, n));
+                    }
+                    out[j + k] = _mm512_reduce_add_epi64(acc[k]);
+                }
+            }
+        }
+#endif
+        for (; j < m; ++j)
+        {
+            __builtin_prefetch(models + (j + 1) * stride);
+            out[j] = dot(q, models + j * stride, n);
+        }
+    }
+
+    /**
+     * @brief Number of positions where the bit vectors a and b differ
+     * @param words length of a and b in 64-bit words
+     */
+    inline uint64_t hamming(const uint64_t* a, const uint64_t* b, size_t words)
+    {
+        size_t i = 0;
+        uint64_t result = 0;
+#if defined(__AVX512VPOPCNTDQ__)
+        __m512i acc = _mm512_setzero_si512();
+        for (; i + 8 <= words; i += 8)
+        {
+            __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+            acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+        }
+        if (i < words)
+        {
+            __mmask8 m = (__mmask8)((1U << (words - i)) - 1);
+            __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi64(m, a + i), _mm512_maskz_loadu_epi64(m, b + i));
+            acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+            i = words;
+        }
+        result = _mm512_reduce_add_epi64(acc);
+#elif defined(__AVX2__)
+        // nibble lookup table popcount (Mula), summed per 64-bit lane with sad
+        const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                               0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low = _mm256_set1_epi8(0x0F);
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 4 <= words; i += 4)
+        {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                         _mm256_loadu_si256((const __m256i*)(b + i)));
+            __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(x, low)),
+                                          _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+        }
+        result = reduce_add(acc);
+#endif
+        for (; i < words; ++i)
+        {
+            result += __builtin_popcountll(a[i] ^ b[i]);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Hamming distances of every row of a against every row of b
+     * b is walked in tiles that fit in L2, and four rows of a are compared
+     * against each row of the tile, so every load of b feeds four popcounts.
+     * @param a na bit vectors, one every `words` words
+     * @param b nb bit vectors, one every `words` words
+     * @param words length of a vector in 64-bit words
+     * @param out out[i * ldo + j] = hamming(row i of a, row j of b)
+     * @param ldo distance between rows of out
+     */
+    inline void hamming_matrix(const uint64_t* a, size_t na, const uint64_t* b, size_t nb, size_t words,
+        uint32_t* out, size_t ldo)
+    {
+        // rows of b per tile, 256KB of them
+        size_t tile = words ? ((size_t)1 << 15U) / words : nb;
+        tile = tile ? tile : 1;
+        for (size_t j0 = 0; j0 < nb; j0 += tile)
+        {
+            size_t j1 = j0 + tile < nb ? j0 + tile : nb;
+            size_t i = 0;
+#if defined(__AVX512VPOPCNTDQ__)
+            for (; i + 4 <= na; i += 4)
+            {
+                const uint64_t* p = a + i * words;
+                for (size_t j = j0; j < j1; ++j)
+                {
+                    const uint64_t* q = b + j * words;
+                    __builtin_prefetch(q + words);
+                    __m512i acc[4] = {};
+                    for (size_t k = 0; k < words; k += 8)
+                    {
+                        __mmask8 m = words - k >= 8 ? 0xFF : (__mmask8)((1U << (words - k)) - 1);
+                        __m512i y = _mm512_maskz_loadu_epi64(m, q + k);
+                        for (size_t r = 0; r < 4; ++r)
+                        {
+                            __m512i x = _mm512_maskz_loadu_epi64(m, p + r * words + k);
+                            acc[r] = _mm512_add_epi64(acc[r], _mm512_popcnt_epi64(_mm512_xor_si512(x, y)));
+                        }
+                    }
+                    for (size_t r = 0; r < 4; ++r)
+                    {
+                        out[(i + r) * ldo + j] = _mm512_reduce_add_epi64(acc[r]);
+                    }
+                }
+            }
+#endif
+            for (; i < na; ++i)
+            {
+                for (size_t j = j0; j < j1; ++j)
+                {
+                    out[i * ldo + j] = hamming(a + i * words, b + j * words, words);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Bundles a bipolar vector given as bits: acc[i] += bit i ? 1 : -1
+     */
+    template<typename T>
+    inline void add_bits(T* acc, const uint64_t* bits, size_t n)
+    {
+        size_t i = 0;
+#if defined(__AVX512BW__)
+        if constexpr (std::is_same<T, int16_t>::value)
+        {
+            __m512i one = _mm512_set1_epi16(1);
+            for (size_t full = n - n % 32; i < full; i += 32)
+            {
+                __mmask32 m = (__mmask32)(bits[i / 64] >> (i % 64));
+                __m512i v = _mm512_loadu_si512(acc + i);
+                _mm512_storeu_si512(acc + i, _mm512_mask_blend_epi16(m, _mm512_sub_epi16(v, one), _mm512_add_epi16(v, one)));
+            }
+        }
+        else if constexpr (std::is_same<T, int32_t>::value)
+        {
+            __m512i one = _mm512_set1_epi32(1);
+            for (size_t full = n - n % 16; i < full; i += 16)
+            {
+                __mmask16 m = (__mmask16)(bits[i / 64] >> (i % 64));
+                __m512i v = _mm512_loadu_si512(acc + i);
+                _mm512_storeu_si512(acc + i, _mm512_mask_blend_epi32(m, _mm512_sub_epi32(v, one), _mm512_add_epi32(v, one)));
+            }
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            acc[i] += (bits[i / 64] >> (i % 64)) & 1U ? 1 : -1;
+        }
+    }
+
+    /**
+     * @brief Counts a bit vector into bit-sliced counters: count[i] += bit i
+     * Bit p of count[i] is bit i of plane p, planes[p * words ...]. A vector
+     * costs one half adder per plane and word, instead of one add per
+     * dimension; the caller flushes before 2^depth vectors wrap a counter.
+     * @param planes depth planes of `words` words
+     * @param bits the vector, `words` words
+     */
+    inline void slice_add(uint64_t* planes, size_t depth, const uint64_t* bits, size_t words)
+    {
+        size_t i = 0;
+#if defined(__AVX512F__)
+        for (size_t full = words - words % 8; i < full; i += 8)
+        {
+            __m512i carry = _mm512_loadu_si512(bits + i);
+            for (size_t p = 0; p < depth; ++p)
+            {
+                uint64_t* w = planes + p * words + i;
+                __m512i x = _mm512_loadu_si512(w);
+                _mm512_storeu_si512(w, _mm512_xor_si512(x, carry));
+                carry = _mm512_and_si512(x, carry);
+            }
+        }
+#endif
+        for (; i < words; ++i)
+        {
+            uint64_t carry = bits[i];
+            for (size_t p = 0; p < depth && carry; ++p)
+            {
+                uint64_t x = planes[p * words + i];
+                planes[p * words + i] = x ^ carry;
+                carry &= x;
+            }
+        }
+    }
+
+    /**
+     * @brief Bundles m vectors counted by slice_add and clears the counters:
+     * acc[i] += 2 * count[i] - m
+     * @param n dimensions; planes are (n + 63) / 64 words each
+     */
+    inline void slice_flush(int32_t* acc, uint64_t* planes, size_t depth, size_t n, int32_t m)
+    {
+        size_t words = (n + 63) / 64;
+        size_t i = 0;
+#if defined(__AVX512F__)
+        __m512i bias = _mm512_set1_epi32(m);
+        for (size_t full = n - n % 16; i < full; i += 16)
+        {
+            __m512i v = _mm512_sub_epi32(_mm512_loadu_si512(acc + i), bias);
+            for (size_t p = 0; p < depth; ++p)
+            {
+                __mmask16 k = (__mmask16)(planes[p * words + i / 64] >> (i % 64));
+                v = _mm512_mask_add_epi32(v, k, v, _mm512_set1_epi32(2 << p));
+            }
+            _mm512_storeu_si512(acc + i, v);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            int32_t count = 0;
+            for (size_t p = 0; p < depth; ++p)
+            {
+                count |= (int32_t)((planes[p * words + i / 64] >> (i % 64)) & 1U) << p;
+            }
+            acc[i] += 2 * count - m;
+        }
+        __builtin_memset(planes, 0, depth * words * 8);
+    }
+
+    /**
+     * @brief Dot product of a with a bipolar vector given as bits
+     */
+    template<typename T>
+    inline acc_t<T> dot_bits(const T* a, const uint64_t* bits, size_t n)
+    {
+        size_t i = 0;
+        acc_t<T> result = 0;
+#if defined(__AVX512BW__)
+        if constexpr (std::is_same<T, int16_t>::value)
+        {
+            __m512i pos = _mm512_set1_epi16(1);
+            __m512i neg = _mm512_set1_epi16(-1);
+            __m512i acc = _mm512_setzero_si512();
+            for (size_t full = n - n % 32; i < full; i += 32)
+            {
+                __mmask32 m = (__mmask32)(bits[i / 64] >> (i % 64));
+                acc = widen_add(acc, _mm512_madd_epi16(_mm512_loadu_si512(a + i), _mm512_mask_blend_epi16(m, neg, pos)));
+            }
+            result = _mm512_reduce_add_epi64(acc);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            result += (bits[i / 64] >> (i % 64)) & 1U ? (acc_t<T>)a[i] : -(acc_t<T>)a[i];
+        }
+        return result;
+    }
+
+    /**
+     * @brief Bundles a sparse ternary vector: acc[lane[j]] += bit j ? c : -c for j < s
+     * Lanes must be distinct. int32 lanes are gathered and scattered 16 at a
+     * time; int16 lanes as the aligned 32-bit pairs holding them, with a
+     * 16-bit add, and a second round for the lanes whose pair partner is in
+     * the same group of 16. Pairs need an even n, so an odd one is scalar.
+     * @param n lanes of acc
+     * @param bits s signs
+     */
+    template<typename T>
+    inline void add_sparse(T* acc, size_t n, const uint16_t* lane, const uint64_t* bits, size_t s, T c)
+    {
+        size_t j = 0;
+#if defined(__AVX512BW__)
+        if constexpr (std::is_same<T, int32_t>::value)
+        {
+            __m512i pos = _mm512_set1_epi32(c);
+            __m512i neg = _mm512_set1_epi32(-c);
+            for (; j < s; j += 16)
+            {
+                __mmask16 m = s - j >= 16 ? 0xFFFF : (__mmask16)((1U << (s - j)) - 1);
+                __m512i idx = _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(m, lane + j));
+                __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, idx, acc, 4);
+                __mmask16 sign = (__mmask16)(bits[j / 64] >> (j % 64));
+                v = _mm512_add_epi32(v, _mm512_mask_blend_epi32(sign, neg, pos));
+                _mm512_mask_i32scatter_epi32(acc, m, idx, v, 4);
+            }
+        }
+#if defined(__AVX512CD__)
+        else if constexpr (std::is_same<T, int16_t>::value)
+        {
+            __m512i pos = _mm512_set1_epi32((uint16_t)c);
+            __m512i neg = _mm512_set1_epi32((uint16_t)-c);
+            for (; j < s && n % 2 == 0; j += 16)
+            {
+                __mmask16 m = s - j >= 16 ? 0xFFFF : (__mmask16)((1U << (s - j)) - 1);
+                __m512i l = _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(m, lane + j));
+                __m512i idx = _mm512_srli_epi32(l, 1);
+                __mmask16 sign = (__mmask16)(bits[j / 64] >> (j % 64));
+                __m512i w = _mm512_sllv_epi32(_mm512_mask_blend_epi32(sign, neg, pos),
+                    _mm512_slli_epi32(_mm512_and_si512(l, _mm512_set1_epi32(1)), 4));
+                // a pair holds two lanes at most, so the lanes after their partner make one more round
+                __m512i conflict = _mm512_conflict_epi32(idx);
+                __mmask16 second = _mm512_mask_test_epi32_mask(m, conflict, conflict);
+                for (__mmask16 k = m & ~second; k; k = second, second = 0)
+                {
+                    __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), k, idx, acc, 4);
+                    _mm512_mask_i32scatter_epi32(acc, k, idx, _mm512_add_epi16(v, w), 4);
+                }
+            }
+        }
+#endif
+#endif
+        for (; j < s; ++j)
+        {
+            acc[lane[j]] += (bits[j / 64] >> (j % 64)) & 1U ? c : (T)-c;
+        }
+    }
+
+    /**
+     * @brief Dot product of a with a sparse ternary vector: sum of bit j ? a[lane[j]] : -a[lane[j]]
+     * int16 lanes are gathered as their aligned 32-bit pairs, see add_sparse.
+     * @param n lanes of a
+     * @param bits s signs
+     */
+    template<typename T>
+    inline acc_t<T> dot_sparse(const T* a, size_t n, const uint16_t* lane, const uint64_t* bits, size_t s)
+    {
+        size_t j = 0;
+        acc_t<T> result = 0;
+#if defined(__AVX512BW__)
+        if constexpr (std::is_same<T, int32_t>::value)
+        {
+            __m512i acc = _mm512_setzero_si512();
+            for (; j < s; j += 16)
+            {
+                __mmask16 m = s - j >= 16 ? 0xFFFF : (__mmask16)((1U << (s - j)) - 1);
+                __m512i idx = _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(m, lane + j));
+                __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, idx, a, 4);
+                __mmask16 sign = (__mmask16)(bits[j / 64] >> (j % 64));
+                acc = widen_add(acc, _mm512_mask_sub_epi32(v, ~sign, _mm512_setzero_si512(), v));
+            }
+            result = _mm512_reduce_add_epi64(acc);
+        }
+        else if constexpr (std::is_same<T, int16_t>::value)
+        {
+            __m512i acc = _mm512_setzero_si512();
+            for (; j < s && n % 2 == 0; j += 16)
+            {
+                __mmask16 m = s - j >= 16 ? 0xFFFF : (__mmask16)((1U << (s - j)) - 1);
+                __m512i l = _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(m, lane + j));
+                __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, _mm512_srli_epi32(l, 1), a, 4);
+                // move the lane to the high half, then sign-extend it down
+                __m512i low = _mm512_andnot_si512(l, _mm512_set1_epi32(1));
+                v = _mm512_srai_epi32(_mm512_sllv_epi32(v, _mm512_slli_epi32(low, 4)), 16);
+                __mmask16 sign = (__mmask16)(bits[j / 64] >> (j % 64));
+                acc = widen_add(acc, _mm512_mask_sub_epi32(v, ~sign, _mm512_setzero_si512(), v));
+            }
+            result = _mm512_reduce_add_epi64(acc);
+        }
+#endif
+        for (; j < s; ++j)
+        {
+            result += (bits[j / 64] >> (j % 64)) & 1U ? (acc_t<T>)a[lane[j]] : -(acc_t<T>)a[lane[j]];
+        }
+        return result;
+    }
+
+    /**
+     * @brief Majority of a bundle: bit i = a[i] >= 0; ties go to +1
+     * @param bits output, (n + 63) / 64 words with the unused high bits cleared
+     */
+    template<typename T>
+    inline void sign_bits(uint64_t* bits, const T* a, size_t n)
+    {
+        size_t i = 0;
+        __builtin_memset(bits, 0, (n + 63) / 64 * 8);
+#if defined(__AVX512BW__)
+        if constexpr (std::is_same<T, int16_t>::value)
+        {
+            for (size_t full = n - n % 32; i < full; i += 32)
+            {
+                __mmask32 m = _mm512_cmpge_epi16_mask(_mm512_loadu_si512(a + i), _mm512_setzero_si512());
+                bits[i / 64] |= (uint64_t)m << (i % 64);
+            }
+        }
+        else if constexpr (std::is_same<T, int32_t>::value)
+        {
+            for (size_t full = n - n % 16; i < full; i += 16)
+            {
+                __mmask16 m = _mm512_cmpge_epi32_mask(_mm512_loadu_si512(a + i), _mm512_setzero_si512());
+                bits[i / 64] |= (uint64_t)m << (i % 64);
+            }
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            bits[i / 64] |= (uint64_t)(a[i] >= 0) << (i % 64);
+        }
+    }
+}
@@ -1,10 +1,16 @@
-#pragma once 
+#pragma once
+#include "Kernels.hh"
 #include <cstddef>
 #include <array>
 #include <algorithm>
 
+template <size_t D>
+class BinaryHV;
+
 /**
  * @brief A behavioral model for HD
+ * Storage is cache-line aligned and every operation runs on the SIMD
+ * kernels of Kernels.hh.
  * @param T the underlying type for each element
  * @param D number of dimensions
  */
@@ -12,6 +18,11 @@ template <typename T, size_t D>
 class ModelHD
 {
     public:
+    /**
+     * @brief Type of dot products; exact 64-bit for integer elements
+     */
+    using acc_type = hd::acc_t<T>;
+
     ModelHD() : buf() {}
     ModelHD(const std::array<T, D>& b) : buf(b) {}
 
@@ -21,44 +32,55 @@ class ModelHD
         return *this;
     }
 
+    T& operator[](size_t i) { return buf[i]; }
+
+    const T& operator[](size_t i) const { return buf[i]; }
+
+    T* data() { return buf.data(); }
+
+    const T* data() const { return buf.data(); }
+
+    /**
+     * @brief bundle operation
+     */
     ModelHD& operator+=(const ModelHD& other)
     {
-        for (size_t i = 0; i < D; ++i)
-        {
-            buf[i] += other.buf[i];
-        }
+        hd::add(buf.data(), buf.data(), other.buf.data(), D);
         return *this;
-    }   
+    }
+
+    /**
+     * @brief bundles a bit-packed bipolar vector
+     */
+    ModelHD& operator+=(const BinaryHV<D>& hv)
+    {
+        hd::add_bits(buf.data(), hv.data(), D);
+        return *this;
+    }
 
     ModelHD& operator-=(const ModelHD& other)
     {
-        for (size_t i = 0; i < D; ++i)
-        {
-            buf[i] -= other.buf[i];
-        }
+        hd::sub(buf.data(), buf.data(), other.buf.data(), D);
         return *this;
     }
 
     ModelHD& operator*=(const T& scalar)
     {
-        for (size_t i = 0; i < D; ++i)
-        {
-            buf[i] *= scalar;
-        }
+        hd::scale(buf.data(), buf.data(), scalar, D);
         return *this;
     }
 
     ModelHD operator+(const ModelHD& other) const
     {
         ModelHD result;
-        std::transform(buf.cbegin(), buf.cend(), other.buf.cbegin(), result.buf.begin(), T::operator+);
+        hd::add(result.buf.data(), buf.data(), other.buf.data(), D);
         return result;
     }
 
     ModelHD operator-(const ModelHD& other) const
     {
         ModelHD result;
-        std::transform(buf.cbegin(), buf.cend(), other.buf.cbegin(), result.buf.begin(), T::operator-);
+        hd::sub(result.buf.data(), buf.data(), other.buf.data(), D);
         return result;
     }
 
@@ -68,7 +90,17 @@ class ModelHD
     ModelHD operator*(const ModelHD& other) const
     {
         ModelHD result;
-        std::transform(buf.cbegin(), buf.cend(), other.buf.cbegin(), result.buf.begin(), T::operator*);
+        hd::mul(result.buf.data(), buf.data(), other.buf.data(), D);
+        return result;
+    }
+
+    /**
+     * @brief permute operation, a cyclic shift by k dimensions
+     */
+    ModelHD permute(size_t k) const
+    {
+        ModelHD result;
+        hd::rotate(result.buf.data(), buf.data(), k, D);
         return result;
     }
 
@@ -77,34 +109,47 @@ class ModelHD
         double norm = 0;
         for (const auto& it : buf)
         {
-            norm += it;
+            norm += it < 0 ? -(double)it : (double)it;
         }
         return norm;
     }
 
+    /**
+     * @brief squared l2 norm
+     */
     double l2norm() const
     {
-        double norm = 0;
-        for (const auto& it : buf)
-        {
-            norm += (double)it * it;
-        }
-        return norm;
+        return (double)dot(*this);
     }
 
     /**
      * @brief dot product
      */
-    double dot(const ModelHD& other) const
+    acc_type dot(const ModelHD& other) const
     {
-        double result = 0;
-        for (size_t i = 0; i < D; ++i)
-        {
-            result += (double)buf[i] * other.buf[i];
-        }
-        return result;
+        return hd::dot(buf.data(), other.buf.data(), D);
+    }
+
+    /**
+     * @brief dot product with a bit-packed bipolar vector
+     */
+    acc_type dot(const BinaryHV<D>& hv) const
+    {
+        return hd::dot_bits(buf.data(), hv.data(), D);
+    }
+
+    /**
+     * @brief Dot products of this query against n models
+     * @param models n contiguous models
+     * @param n number of models
+     * @param out n dot products
+     */
+    void dot_batch(const ModelHD* models, size_t n, acc_type* out) const
+    {
+        static_assert(sizeof(ModelHD) % sizeof(T) == 0, "models must be contiguous arrays of T");
+        hd::dot_batch(buf.data(), models->buf.data(), sizeof(ModelHD) / sizeof(T), D, n, out);
     }
 
     protected:
-    std::array<T, D> buf;
-};
\ No newline at end of file
+    alignas(64) std::array<T, D> buf;
+};
@@ -1,17 +1,29 @@
 #pragma once
+#include "CounterPolicy.hh"
+#include "utils/Instrumentation.hh"
+#include "utils/SketchFile.hh"
 #include <cstdint>
 #include <cstddef>
 #include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 /**
  * @brief Abstract base class for Count-min Sketches
  * @param K key type
- * @param T underlying type for counters
+ * @param T type of the estimates
+ * @param P counter policy, see CounterPolicy.hh
+ * @param I instrumentation policy, see utils/Instrumentation.hh
  */
-template<typename K, typename T>
+template<typename K, typename T, typename P = LinearCounter<T>, typename I = utils::NoInstrumentation>
 class CountMinSketch
 {
     public:
+    using cell_type = typename P::cell_type;
+    using raw_type = typename P::raw_type;
+
     /**
      * @brief Estimates the number of occurence of given key
      * @param key the query key
@@ -31,24 +43,58 @@ class CountMinSketch
      */
     void conservative_insert(const K& key);
 
+    /**
+     * @brief Memory used by the counters in bytes
+     */
+    size_t bytes() const
+    {
+        return height * P::cells(width) * sizeof(cell_type);
+    }
+
+    const I& instrumentation() const { return instr; }
+
     protected:
+    static constexpr size_t BATCH = 16;
+
+    std::unique_ptr<utils::MappedSketch> file;  // set if the rows are mapped
     size_t width;
     size_t height;
-    T** array;
+    cell_type** array;
+    P policy;
+    mutable I instr;
 
-    CountMinSketch(size_t w, size_t h)
-        : width(w), height(h)
+    CountMinSketch(size_t w, size_t h, const P& p = P())
+        : width(w), height(h), policy(p)
     {
-        array = new T*[height]();
+        array = new cell_type*[height]();
         for (size_t i = 0; i < height; ++i)
         {
-            array[i] = new T[width]();
+            array[i] = new cell_type[P::cells(width)]();
+        }
+    }
+
+    /**
+     * @brief Uses the rows of a mapped sketch file in place
+     */
+    CountMinSketch(utils::MappedSketch* f, const P& p)
+        : file(f), width(f->header().width), height(f->header().height), policy(p)
+    {
+        const utils::SketchHeader& h = file->header();
+        if (width == 0 || width > h.row_bytes)
+            throw std::runtime_error("sketch file has an invalid width");
+        // cells(width) <= width <= row_bytes, so the product cannot wrap around
+        if (h.cell_bits != P::BITS || h.row_bytes < P::cells(width) * sizeof(cell_type))
+            throw std::runtime_error("sketch file counters do not match the counter policy");
+        array = new cell_type*[height];
+        for (size_t i = 0; i < height; ++i)
+        {
+            array[i] = (cell_type*)file->row(i);
         }
     }
 
     ~CountMinSketch()
     {
-        for(size_t i = 0; i < height; ++i)
+        for(size_t i = 0; !file && i < height; ++i)
         {
             delete[] array[i];
             array[i] = nullptr;
@@ -56,4 +102,85 @@ class CountMinSketch
         delete[] array;
         array = nullptr;
     }
-};
\ No newline at end of file
+
+    /**
+     * @brief Writes the rows and hash seeds to a sketch file
+     */
+    void save_rows(const std::string& path, utils::SketchKind kind, const std::vector<uint32_t>& seeds,
+        bool compressed) const
+    {
+        std::vector<const void*> rows(array, array + height);
+        utils::write_sketch(path, kind, width, P::BITS, seeds, rows, P::cells(width) * sizeof(cell_type), compressed);
+    }
+
+    void prefetch(size_t i, size_t idx) const
+    {
+        __builtin_prefetch(array[i] + idx * P::BITS / (8 * sizeof(cell_type)));
+    }
+
+    /**
+     * @brief Reports an overflow or saturation event if c sits at the counter limit
+     */
+    void count_limit(raw_type c)
+    {
+        if (c == P::limit())
+        {
+            if (P::SATURATES)
+                instr.saturation(1);
+            else
+                instr.overflow(1);
+        }
+    }
+
+    /**
+     * @brief Increments counter idx of row i, subject to the counter policy
+     */
+    void increment(size_t i, size_t idx)
+    {
+        raw_type c = P::get(array[i], idx);
+        if constexpr (I::ENABLED)
+        {
+            count_limit(c);
+        }
+        if (policy.should_increment(c))
+        {
+            P::set(array[i], idx, c + 1);
+        }
+    }
+
+    /**
+     * @brief Adds count to counter idx of row i, subject to the counter policy
+     * Linear counters add it at once; saturating counters make count
+     * probabilistic increments, so the counter distribution is unchanged.
+     */
+    void increment(size_t i, size_t idx, uint32_t count)
+    {
+        raw_type c = P::get(array[i], idx);
+        if constexpr (P::SATURATES)
+        {
+            for (uint32_t k = 0; k < count; ++k)
+            {
+                if constexpr (I::ENABLED)
+                {
+                    count_limit(c);
+                }
+                if (policy.should_increment(c))
+                {
+                    ++c;
+                }
+            }
+        }
+        else
+        {
+            if constexpr (I::ENABLED)
+            {
+                if ((double)c + count > (double)P::limit())
+                {
+                    instr.overflow(1);
+                }
+            }
+            c = (raw_type)(c + count);
+        }
+        P::set(array[i], idx, c);
+    }
+};
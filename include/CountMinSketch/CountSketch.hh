@@ -0,0 +1,332 @@
+#pragma once
+#include "utils/MurmurHash.hh"
+#include "utils/Instrumentation.hh"
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <immintrin.h>
+
+/**
+ * @brief Count Sketch (Charikar et al.) with AVX-512 row hashing
+ * Every row adds a random +-1 to one counter; the estimate is the median of
+ * the signed counters, which is unbiased unlike Count-min. All row indices
+ * and signs of a key are derived in one pass over 16 SIMD lanes, and the
+ * median is computed by a vectorized rank count.
+ * @param K key type
+ * @param T counter type, int16_t or int32_t
+ * @param I instrumentation policy, see utils/Instrumentation.hh
+ */
+template<typename K, typename T = int16_t, typename I = utils::NoInstrumentation>
+class CountSketch
+{
+    static_assert(std::is_same<T, int16_t>::value || std::is_same<T, int32_t>::value,
+        "CountSketch counters must be int16_t or int32_t");
+
+    public:
+    static constexpr size_t MAX_ROWS = 16;
+
+    CountSketch(size_t w, size_t h, std::mt19937_64& gen)
+        : width(w), height(h)
+    {
+        if (height == 0 || height > MAX_ROWS)
+            throw std::invalid_argument("CountSketch supports 1 to 16 rows");
+        if (width == 0 || width > std::numeric_limits<uint32_t>::max())
+            throw std::invalid_argument("CountSketch width must fit in 32 bits");
+
+        // pad rows to whole cache lines; one extra line so the 32-bit gathers
+        // used for int16 counters never read past the allocation
+        stride = (width * sizeof(T) + 63) / 64 * 64 / sizeof(T);
+        size_t bytes = (stride * height * sizeof(T) + 64) / 64 * 64;
+        array = (T*)std::aligned_alloc(64, bytes);
+        std::memset(array, 0, bytes);
+
+        std::uniform_int_distribution<uint32_t> dist(0, std::numeric_limits<uint32_t>::max());
+        seed = dist(gen);
+        for (size_t i = 0; i < MAX_ROWS; ++i)
+        {
+            mul_idx[i] = dist(gen) | 1U;
+            add_idx[i] = dist(gen);
+            mul_sign[i] = dist(gen) | 1U;
+            add_sign[i] = dist(gen);
+            row_base[i] = (int64_t)(i * stride);
+        }
+    }
+
+    ~CountSketch()
+    {
+        std::free(array);
+        array = nullptr;
+    }
+
+    /**
+     * @brief Estimates the number of occurence of given key
+     * @param key the query key
+     * @return the median of the signed row counters
+     */
+    double estimate(const K& key) const
+    {
+        auto t = instr.start(utils::Op::Estimate);
+        __m512i idx;
+        __mmask16 sign;
+        hash(key, idx, sign);
+
+        __m512i vals = gather(idx);
+        vals = _mm512_mask_sub_epi32(vals, ~sign, _mm512_setzero_si512(), vals);
+        double result = median(vals);
+        instr.finish(utils::Op::Estimate, t);
+        return result;
+    }
+
+    /**
+     * @brief Inserts the key to the data structure
+     * @param key the query key
+     */
+    void insert(const K& key)
+    {
+        auto t = instr.start(utils::Op::Insert);
+        __m512i idx_vec;
+        __mmask16 sign;
+        hash(key, idx_vec, sign);
+
+        alignas(64) uint32_t idx[MAX_ROWS];
+        _mm512_store_epi32(idx, idx_vec);
+        for (size_t i = 0; i < height; ++i)
+        {
+            update(i, idx[i], (sign >> i) & 1U);
+        }
+        instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Inserts count occurrences of the key with one update per row
+     * @param key the key
+     * @param count number of occurrences
+     */
+    void insert(const K& key, uint32_t count)
+    {
+        auto t = instr.start(utils::Op::Insert);
+        __m512i idx_vec;
+        __mmask16 sign;
+        hash(key, idx_vec, sign);
+
+        alignas(64) uint32_t idx[MAX_ROWS];
+        _mm512_store_epi32(idx, idx_vec);
+        for (size_t i = 0; i < height; ++i)
+        {
+            update(i, idx[i], (sign >> i) & 1U, count);
+        }
+        instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Estimates a batch of keys, prefetching all counters first
+     * @param keys the query keys
+     * @param n number of keys
+     * @param out n estimates
+     */
+    void estimate_batch(const K* keys, size_t n, double* out) const
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Estimate, m);
+            __m512i idx[BATCH];
+            __mmask16 sign[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                hash(keys[base + j], idx[j], sign[j]);
+                prefetch(idx[j]);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                __m512i vals = gather(idx[j]);
+                vals = _mm512_mask_sub_epi32(vals, ~sign[j], _mm512_setzero_si512(), vals);
+                out[base + j] = median(vals);
+            }
+            instr.finish(utils::Op::Estimate, t, m);
+        }
+    }
+
+    /**
+     * @brief Inserts a batch of keys, prefetching all counters first
+     * @param keys the keys
+     * @param n number of keys
+     * @param counts occurrences of each key, nullptr for one each
+     */
+    void insert_batch(const K* keys, size_t n, const uint32_t* counts = nullptr)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Insert, m);
+            alignas(64) uint32_t idx[BATCH][MAX_ROWS];
+            __mmask16 sign[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                __m512i idx_vec;
+                hash(keys[base + j], idx_vec, sign[j]);
+                _mm512_store_epi32(idx[j], idx_vec);
+                prefetch(idx_vec);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                for (size_t i = 0; i < height; ++i)
+                {
+                    update(i, idx[j][i], (sign[j] >> i) & 1U, counts ? counts[base + j] : 1);
+                }
+            }
+            instr.finish(utils::Op::Insert, t, m);
+        }
+    }
+
+    /**
+     * @brief Memory used by the counters in bytes
+     */
+    size_t bytes() const
+    {
+        return stride * height * sizeof(T);
+    }
+
+    const I& instrumentation() const { return instr; }
+
+    protected:
+    static constexpr size_t BATCH = 16;
+
+    size_t width;
+    size_t height;
+    size_t stride;
+    T* array;
+    uint32_t seed;
+    mutable I instr;
+
+    alignas(64) uint32_t mul_idx[MAX_ROWS];
+    alignas(64) uint32_t add_idx[MAX_ROWS];
+    alignas(64) uint32_t mul_sign[MAX_ROWS];
+    alignas(64) uint32_t add_sign[MAX_ROWS];
+    alignas(64) int64_t row_base[MAX_ROWS];
+
+    /**
+     * @brief Per-row 32-bit hash family: multiply-add followed by a xorshift-multiply finalizer
+     */
+    static __m512i mix(uint32_t x, const uint32_t* mul, const uint32_t* add)
+    {
+        __m512i v = _mm512_mullo_epi32(_mm512_set1_epi32(x), _mm512_load_epi32(mul));
+        v = _mm512_add_epi32(v, _mm512_load_epi32(add));
+        v = _mm512_xor_si512(v, _mm512_srli_epi32(v, 16));
+        v = _mm512_mullo_epi32(v, _mm512_set1_epi32(0x7FEB352D));
+        v = _mm512_xor_si512(v, _mm512_srli_epi32(v, 15));
+        return v;
+    }
+
+    /**
+     * @brief Computes the column index and sign of every row at once
+     * @param key the query key
+     * @param idx output, lane i is the column of row i
+     * @param sign output, bit i set if row i adds +1
+     */
+    void hash(const K& key, __m512i& idx, __mmask16& sign) const
+    {
+        uint64_t h[2];
+        MurmurHash3_x64_128(&key, sizeof(K), seed, h);
+
+        // map to [0, width) with a multiply-high instead of a modulo
+        __m512i v = mix((uint32_t)h[0], mul_idx, add_idx);
+        __m512i w = _mm512_set1_epi64(width);
+        __m512i even = _mm512_srli_epi64(_mm512_mul_epu32(v, w), 32);
+        __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(v, 32), w);
+        idx = _mm512_mask_blend_epi32(0xAAAAU, even, odd);
+
+        sign = _mm512_movepi32_mask(mix((uint32_t)h[1], mul_sign, add_sign));
+    }
+
+    /**
+     * @brief Adds +count or -count to counter idx of row i
+     */
+    void update(size_t i, uint32_t idx, bool positive, uint32_t count = 1)
+    {
+        T& c = array[i * stride + idx];
+        int64_t next = positive ? (int64_t)c + count : (int64_t)c - count;
+        if constexpr (I::ENABLED)
+        {
+            if (next > std::numeric_limits<T>::max() || next < std::numeric_limits<T>::min())
+            {
+                instr.overflow(1);
+            }
+        }
+        c = (T)next;
+    }
+
+    void prefetch(__m512i idx_vec) const
+    {
+        alignas(64) uint32_t idx[MAX_ROWS];
+        _mm512_store_epi32(idx, idx_vec);
+        for (size_t i = 0; i < height; ++i)
+        {
+            __builtin_prefetch(array + i * stride + idx[i]);
+        }
+    }
+
+    /**
+     * @brief Loads the counter of every row, sign-extended to 32 bits
+     */
+    __m512i gather(__m512i idx) const
+    {
+        __mmask16 active = (__mmask16)((1U << height) - 1);
+        __m512i off_lo = _mm512_add_epi64(_mm512_load_epi64(row_base),
+            _mm512_cvtepu32_epi64(_mm512_castsi512_si256(idx)));
+        __m512i off_hi = _mm512_add_epi64(_mm512_load_epi64(row_base + 8),
+            _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(idx, 1)));
+
+        __m256i lo = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), active & 0xFFU, off_lo, array, sizeof(T));
+        __m256i hi = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), active >> 8U, off_hi, array, sizeof(T));
+        __m512i vals = _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+
+        if constexpr (sizeof(T) == 2)
+        {
+            vals = _mm512_srai_epi32(_mm512_slli_epi32(vals, 16), 16);
+        }
+        return vals;
+    }
+
+    /**
+     * @brief Median of the first height lanes
+     * The k-th smallest value sits in any lane i with lt_i <= k < le_i,
+     * where lt_i / le_i count lanes smaller / not greater than lane i.
+     */
+    double median(__m512i vals) const
+    {
+        __mmask16 active = (__mmask16)((1U << height) - 1);
+        alignas(64) int32_t v[MAX_ROWS];
+        _mm512_store_epi32(v, vals);
+
+        __m512i one = _mm512_set1_epi32(1);
+        __m512i lt = _mm512_setzero_si512();
+        __m512i le = _mm512_setzero_si512();
+        for (size_t j = 0; j < height; ++j)
+        {
+            __m512i b = _mm512_set1_epi32(v[j]);
+            lt = _mm512_mask_add_epi32(lt, _mm512_cmpgt_epi32_mask(vals, b), lt, one);
+            le = _mm512_mask_add_epi32(le, _mm512_cmpge_epi32_mask(vals, b), le, one);
+        }
+
+        auto kth = [&](int32_t k)
+        {
+            __m512i kv = _mm512_set1_epi32(k);
+            __mmask16 m = active & _mm512_cmple_epi32_mask(lt, kv) & _mm512_cmpgt_epi32_mask(le, kv);
+            return _mm512_mask_reduce_max_epi32(m, vals);
+        };
+
+        int32_t mid = height / 2;
+        if (height & 1U)
+        {
+            return kth(mid);
+        }
+        return ((double)kth(mid - 1) + kth(mid)) / 2;
+    }
+};
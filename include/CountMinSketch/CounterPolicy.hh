@@ -0,0 +1,154 @@
+#pragma once
+#include "utils/random.hh"
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+/**
+ * @brief Exact counters stored as full-width T; the classic Count-min layout
+ * @param T counter type
+ */
+template<typename T>
+class LinearCounter
+{
+    public:
+    using cell_type = T;
+    using raw_type = T;
+    static constexpr size_t BITS = sizeof(T) * 8;
+    // reaching the limit wraps around
+    static constexpr bool SATURATES = false;
+
+    static raw_type limit() { return std::numeric_limits<T>::max(); }
+
+    /**
+     * @brief Number of cells needed to store a row of counters
+     */
+    static size_t cells(size_t width) { return width; }
+
+    static raw_type get(const cell_type* row, size_t idx) { return row[idx]; }
+
+    static void set(cell_type* row, size_t idx, raw_type val) { row[idx] = val; }
+
+    void seed(uint64_t) {}
+
+    /**
+     * @brief Decides whether a counter holding raw value c is incremented
+     */
+    bool should_increment(raw_type) { return true; }
+
+    /**
+     * @brief Converts a raw counter to the count it represents
+     */
+    template<typename U>
+    U decode(raw_type c) const { return (U)c; }
+};
+
+/**
+ * @brief Approximate logarithmic counters (count-min-log)
+ * A counter holding c represents (b^c - 1) / (b - 1) events and is incremented
+ * with probability b^-c, so Bits bits cover a range far beyond 2^Bits.
+ * 4-bit counters are packed two per byte.
+ * @param Bits counter width, 4 or 8
+ */
+template<size_t Bits>
+class LogCounter
+{
+    static_assert(Bits == 4 || Bits == 8, "LogCounter supports 4 or 8 bit counters");
+
+    public:
+    using cell_type = uint8_t;
+    using raw_type = uint8_t;
+    static constexpr size_t BITS = Bits;
+    static constexpr raw_type MAX = (1U << Bits) - 1;
+    // counters stop at the limit
+    static constexpr bool SATURATES = true;
+
+    static raw_type limit() { return MAX; }
+
+    /**
+     * @param b logarithm base; larger bases trade precision for range
+     */
+    LogCounter(double b = Bits == 8 ? 1.04 : 2.0) : base(b), rng()
+    {
+        for (size_t c = 0; c <= MAX; ++c)
+        {
+            double p = std::pow(base, -(double)c);
+            threshold[c] = p >= 1.0 ? std::numeric_limits<uint64_t>::max()
+                                    : (uint64_t)std::ldexp(p, 64);
+            value[c] = (std::pow(base, (double)c) - 1.0) / (base - 1.0);
+        }
+    }
+
+    static size_t cells(size_t width) { return (width * Bits + 7) / 8; }
+
+    static raw_type get(const cell_type* row, size_t idx)
+    {
+        if constexpr (Bits == 8)
+        {
+            return row[idx];
+        }
+        else
+        {
+            return (row[idx >> 1U] >> ((idx & 1U) * 4U)) & 0xFU;
+        }
+    }
+
+    static void set(cell_type* row, size_t idx, raw_type val)
+    {
+        if constexpr (Bits == 8)
+        {
+            row[idx] = val;
+        }
+        else
+        {
+            uint8_t shift = (idx & 1U) * 4U;
+            row[idx >> 1U] = (row[idx >> 1U] & ~(0xFU << shift)) | (val << shift);
+        }
+    }
+
+    void seed(uint64_t s) { rng.seed(s); }
+
+    bool should_increment(raw_type c)
+    {
+        return c < MAX && rng() <= threshold[c];
+    }
+
+    template<typename U>
+    U decode(raw_type c) const
+    {
+        double v = value[c];
+        if (v >= (double)std::numeric_limits<U>::max())
+        {
+            return std::numeric_limits<U>::max();
+        }
+        if constexpr (std::is_integral<U>::value)
+        {
+            return (U)std::lround(v);
+        }
+        else
+        {
+            return (U)v;
+        }
+    }
+
+    double get_base() const { return base; }
+
+    protected:
+    double base;
+    utils::WyRand rng;
+    uint64_t threshold[MAX + 1];
+    double value[MAX + 1];
+};
+
+/**
+ * @brief Morris counters, i.e. logarithmic counters with base 2
+ * @param Bits counter width, 4 or 8
+ */
+template<size_t Bits>
+class MorrisCounter : public LogCounter<Bits>
+{
+    public:
+    MorrisCounter() : LogCounter<Bits>(2.0) {}
+};
@@ -1,17 +1,22 @@
 #pragma once
 #include "CountMinSketch.hh"
+#include <algorithm>
 #include <random>
 #include <array>
 
 /**
  * @brief Count-min sketch using modulo of LONG_PRIME as hash
  * @param K key type
- * @param T counter type
+ * @param T type of the estimates
+ * @param P counter policy
+ * @param I instrumentation policy
  */
-template<typename K, typename T>
-class ModuloCountMinSketch : public CountMinSketch<K, T>
+template<typename K, typename T, typename P = LinearCounter<T>, typename I = utils::NoInstrumentation>
+class ModuloCountMinSketch : public CountMinSketch<K, T, P, I>
 {
     protected:
+    using CountMinSketch<K, T, P, I>::BATCH;
+
     const int64_t LONG_PRIME = 4294967311L;
     std::array<uint32_t, 2>* hashes;
 
@@ -37,10 +42,28 @@ class ModuloCountMinSketch : public CountMinSketch<K, T>
         return (size_t)hashes[hash_idx][0] * sig + hashes[hash_idx][1] % LONG_PRIME;
     }
 
+    /**
+     * @brief Minimum raw counter over all rows
+     */
+    typename P::raw_type raw_estimate(uint32_t sig) const
+    {
+        auto min = std::numeric_limits<typename P::raw_type>::max();
+        for (size_t i = 0; i < this->height; ++i)
+        {
+            size_t idx = hash(sig, i) % this->width;
+            auto c = P::get(this->array[i], idx);
+            if (min > c)
+            {
+                min = c;
+            }
+        }
+        return min;
+    }
+
 
     public:
-    ModuloCountMinSketch(size_t w, size_t h, std::mt19937_64& gen)
-        : CountMinSketch<K, T>(w, h), hashes()
+    ModuloCountMinSketch(size_t w, size_t h, std::mt19937_64& gen, const P& policy = P())
+        : CountMinSketch<K, T, P, I>(w, h, policy), hashes()
     {
         hashes = new std::array<uint32_t, 2>[h];
 
@@ -52,6 +75,7 @@ class ModuloCountMinSketch : public CountMinSketch<K, T>
             hashes[i][0] = uint32_t(double(dist(gen)) * LONG_PRIME / rand_max + 1);
             hashes[i][1] = uint32_t(double(dist(gen)) * LONG_PRIME / rand_max + 1);
         }
+        this->policy.seed(gen());
     }
 
     ~ModuloCountMinSketch()
@@ -67,31 +91,43 @@ class ModuloCountMinSketch : public CountMinSketch<K, T>
      */
     T estimate(const K& key) const
     {
+        auto t = this->instr.start(utils::Op::Estimate);
+        T result = this->policy.template decode<T>(raw_estimate(get_key_signature(key)));
+        this->instr.finish(utils::Op::Estimate, t);
+        return result;
+    }
+
+    /**
+     * @brief Inserts the key to the data structure
+     * @param key the query key
+     */
+    void insert(const K& key)
+    {
+        auto t = this->instr.start(utils::Op::Insert);
         auto sig = get_key_signature(key);
-        T min = std::numeric_limits<T>::max();
-        for (size_t i = 0; i < this->height; ++i)
+        for(size_t i = 0; i < this->height; ++i)
         {
             size_t idx = hash(sig, i) % this->width;
-            if (min > this->array[i][idx])
-            {
-                min = this->array[i][idx];
-            }
+            this->increment(i, idx);
         }
-        return min;
+        this->instr.finish(utils::Op::Insert, t);
     }
 
     /**
-     * @brief Inserts the key to the data structure
-     * @param key the query key
+     * @brief Inserts count occurrences of the key with one update per row
+     * @param key the key
+     * @param count number of occurrences
      */
-    void insert(const K& key)
+    void insert(const K& key, uint32_t count)
     {
+        auto t = this->instr.start(utils::Op::Insert);
         auto sig = get_key_signature(key);
         for(size_t i = 0; i < this->height; ++i)
         {
             size_t idx = hash(sig, i) % this->width;
-            this->array[i][idx] += 1;
+            this->increment(i, idx, count);
         }
+        this->instr.finish(utils::Op::Insert, t);
     }
 
     /**
@@ -100,26 +136,108 @@ class ModuloCountMinSketch : public CountMinSketch<K, T>
      */
     void conservative_insert(const K& key)
     {
+        auto t = this->instr.start(utils::Op::Insert);
         auto sig = get_key_signature(key);
-        T min = std::numeric_limits<T>::max();
-        for (size_t i = 0; i < this->height; ++i)
+        auto min = raw_estimate(sig);
+        if constexpr (I::ENABLED)
+        {
+            this->count_limit(min);
+        }
+        if (!this->policy.should_increment(min))
+        {
+            this->instr.finish(utils::Op::Insert, t);
+            return;
+        }
+
+        for(size_t i = 0; i < this->height; ++i)
         {
             size_t idx = hash(sig, i) % this->width;
-            if (min > this->array[i][idx])
+            if (P::get(this->array[i], idx) == min)
             {
-                min = this->array[i][idx];
+                P::set(this->array[i], idx, min + 1);
             }
         }
-        
-        T new_val = min + 1;
+        this->instr.finish(utils::Op::Insert, t);
+    }
 
-        for(size_t i = 0; i < this->height; ++i)
+    /**
+     * @brief Estimates a batch of keys, prefetching each row's counters first
+     * @param keys the query keys
+     * @param n number of keys
+     * @param out n estimates
+     */
+    void estimate_batch(const K* keys, size_t n, T* out) const
+    {
+        for (size_t base = 0; base < n; base += BATCH)
         {
-            size_t idx = hash(sig, i) % this->width;
-            if (this->array[i][idx] < new_val)
+            size_t m = std::min(BATCH, n - base);
+            auto t = this->instr.start(utils::Op::Estimate, m);
+            uint32_t sig[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                sig[j] = get_key_signature(keys[base + j]);
+            }
+            typename P::raw_type min[BATCH];
+            std::fill(min, min + m, std::numeric_limits<typename P::raw_type>::max());
+            for (size_t i = 0; i < this->height; ++i)
+            {
+                size_t idx[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    idx[j] = hash(sig[j], i) % this->width;
+                    this->prefetch(i, idx[j]);
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    auto c = P::get(this->array[i], idx[j]);
+                    if (min[j] > c)
+                    {
+                        min[j] = c;
+                    }
+                }
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                out[base + j] = this->policy.template decode<T>(min[j]);
+            }
+            this->instr.finish(utils::Op::Estimate, t, m);
+        }
+    }
+
+    /**
+     * @brief Inserts a batch of keys, prefetching each row's counters first
+     * @param keys the keys
+     * @param n number of keys
+     * @param counts occurrences of each key, nullptr for one each
+     */
+    void insert_batch(const K* keys, size_t n, const uint32_t* counts = nullptr)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = this->instr.start(utils::Op::Insert, m);
+            uint32_t sig[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                sig[j] = get_key_signature(keys[base + j]);
+            }
+            for (size_t i = 0; i < this->height; ++i)
             {
-                this->array[i][idx] = new_val;
+                size_t idx[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    idx[j] = hash(sig[j], i) % this->width;
+                    this->prefetch(i, idx[j]);
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    if (counts)
+                        this->increment(i, idx[j], counts[base + j]);
+                    else
+                        this->increment(i, idx[j]);
+                }
             }
+            this->instr.finish(utils::Op::Insert, t, m);
         }
     }
 };
\ No newline at end of file
@@ -1,18 +1,23 @@
 #pragma once
 #include "CountMinSketch.hh"
 #include "utils/MurmurHash.hh"
+#include <algorithm>
 #include <random>
 #include <vector>
 
 /**
  * @brief Count-min sketch using MurmurHash3
  * @param K key type
- * @param T underlying type for counters
+ * @param T type of the estimates
+ * @param P counter policy
+ * @param I instrumentation policy
  */
-template<typename K, typename T>
-class MurmurCountMinSketch : public CountMinSketch<K, T>
+template<typename K, typename T, typename P = LinearCounter<T>, typename I = utils::NoInstrumentation>
+class MurmurCountMinSketch : public CountMinSketch<K, T, P, I>
 {
     protected:
+    using CountMinSketch<K, T, P, I>::BATCH;
+
     std::vector<uint32_t> seeds;
 
     /**
@@ -28,16 +33,59 @@ class MurmurCountMinSketch : public CountMinSketch<K, T>
         return result;
     }
 
+    /**
+     * @brief Minimum raw counter over all rows
+     */
+    typename P::raw_type raw_estimate(const K& key) const
+    {
+        auto min = std::numeric_limits<typename P::raw_type>::max();
+        for (size_t i = 0; i < this->height; ++i)
+        {
+            size_t idx = hash(key, i) % this->width;
+            auto c = P::get(this->array[i], idx);
+            if (min > c)
+            {
+                min = c;
+            }
+        }
+        return min;
+    }
 
     public:
-    MurmurCountMinSketch(size_t w, size_t h, std::mt19937_64& gen)
-        : CountMinSketch<K, T>(w, h)
+    MurmurCountMinSketch(size_t w, size_t h, std::mt19937_64& gen, const P& policy = P())
+        : CountMinSketch<K, T, P, I>(w, h, policy)
     {
         std::uniform_int_distribution<uint32_t> dist(0, std::numeric_limits<uint32_t>::max());
         for (size_t i = 0; i < this->height; ++i)
         {
             seeds.push_back(dist(gen));
         }
+        this->policy.seed(gen());
+    }
+
+    /**
+     * @brief Maps a sketch persisted with save(); the rows are used in place
+     * Counter policy parameters are not persisted and must match.
+     * @param path the sketch file
+     */
+    MurmurCountMinSketch(const std::string& path, const P& policy = P())
+        : CountMinSketch<K, T, P, I>(new utils::MappedSketch(path, utils::SketchKind::MurmurCountMinSketch), policy)
+    {
+        const utils::SketchHeader& h = this->file->header();
+        if (h.seed_count == 0 || h.seed_count != this->height)
+            throw std::runtime_error(path + " has an incompatible MurmurCountMinSketch layout");
+        seeds.assign(this->file->seeds(), this->file->seeds() + h.seed_count);
+        this->policy.seed(seeds[0]);
+    }
+
+    /**
+     * @brief Persists the sketch; throws std::runtime_error on I/O errors
+     * @param path the sketch file
+     * @param compressed bit-plane code the counters, see utils/SketchCodec.hh
+     */
+    void save(const std::string& path, bool compressed = false) const
+    {
+        this->save_rows(path, utils::SketchKind::MurmurCountMinSketch, seeds, compressed);
     }
 
     /**
@@ -47,16 +95,10 @@ class MurmurCountMinSketch : public CountMinSketch<K, T>
      */
     T estimate(const K& key) const
     {
-        T min = std::numeric_limits<T>::max();
-        for (size_t i = 0; i < this->height; ++i)
-        {
-            size_t idx = hash(key, i) % this->width;
-            if (min > this->array[i][idx])
-            {
-                min = this->array[i][idx];
-            }
-        }
-        return min;
+        auto t = this->instr.start(utils::Op::Estimate);
+        T result = this->policy.template decode<T>(raw_estimate(key));
+        this->instr.finish(utils::Op::Estimate, t);
+        return result;
     }
 
     /**
@@ -65,11 +107,29 @@ class MurmurCountMinSketch : public CountMinSketch<K, T>
      */
     void insert(const K& key)
     {
+        auto t = this->instr.start(utils::Op::Insert);
+        for(size_t i = 0; i < this->height; ++i)
+        {
+            size_t idx = hash(key, i) % this->width;
+            this->increment(i, idx);
+        }
+        this->instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Inserts count occurrences of the key with one update per row
+     * @param key the key
+     * @param count number of occurrences
+     */
+    void insert(const K& key, uint32_t count)
+    {
+        auto t = this->instr.start(utils::Op::Insert);
         for(size_t i = 0; i < this->height; ++i)
         {
             size_t idx = hash(key, i) % this->width;
-            this->array[i][idx] += 1;
+            this->increment(i, idx, count);
         }
+        this->instr.finish(utils::Op::Insert, t);
     }
 
     /**
@@ -78,14 +138,97 @@ class MurmurCountMinSketch : public CountMinSketch<K, T>
      */
     void conservative_insert(const K& key)
     {
-        T new_val = estimate(key) + 1;
+        auto t = this->instr.start(utils::Op::Insert);
+        auto min = raw_estimate(key);
+        if constexpr (I::ENABLED)
+        {
+            this->count_limit(min);
+        }
+        if (!this->policy.should_increment(min))
+        {
+            this->instr.finish(utils::Op::Insert, t);
+            return;
+        }
+
         for(size_t i = 0; i < this->height; ++i)
         {
             size_t idx = hash(key, i) % this->width;
-            if (this->array[i][idx] < new_val)
+            if (P::get(this->array[i], idx) == min)
+            {
+                P::set(this->array[i], idx, min + 1);
+            }
+        }
+        this->instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Estimates a batch of keys, prefetching each row's counters first
+     * @param keys the query keys
+     * @param n number of keys
+     * @param out n estimates
+     */
+    void estimate_batch(const K* keys, size_t n, T* out) const
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = this->instr.start(utils::Op::Estimate, m);
+            typename P::raw_type min[BATCH];
+            std::fill(min, min + m, std::numeric_limits<typename P::raw_type>::max());
+            for (size_t i = 0; i < this->height; ++i)
+            {
+                size_t idx[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    idx[j] = hash(keys[base + j], i) % this->width;
+                    this->prefetch(i, idx[j]);
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    auto c = P::get(this->array[i], idx[j]);
+                    if (min[j] > c)
+                    {
+                        min[j] = c;
+                    }
+                }
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                out[base + j] = this->policy.template decode<T>(min[j]);
+            }
+            this->instr.finish(utils::Op::Estimate, t, m);
+        }
+    }
+
+    /**
+     * @brief Inserts a batch of keys, prefetching each row's counters first
+     * @param keys the keys
+     * @param n number of keys
+     * @param counts occurrences of each key, nullptr for one each
+     */
+    void insert_batch(const K* keys, size_t n, const uint32_t* counts = nullptr)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = this->instr.start(utils::Op::Insert, m);
+            for (size_t i = 0; i < this->height; ++i)
             {
-                this->array[i][idx] = new_val;
+                size_t idx[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    idx[j] = hash(keys[base + j], i) % this->width;
+                    this->prefetch(i, idx[j]);
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    if (counts)
+                        this->increment(i, idx[j], counts[base + j]);
+                    else
+                        this->increment(i, idx[j]);
+                }
             }
+            this->instr.finish(utils::Op::Insert, t, m);
         }
     }
 };
\ No newline at end of file
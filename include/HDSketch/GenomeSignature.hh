@@ -0,0 +1,198 @@
+#pragma once
+#include "BehavioralHD/BinaryHV.hh"
+#include "utils/MurmurHash.hh"
+#include "utils/random.hh"
+#include "utils/utils.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <immintrin.h>
+
+/**
+ * @brief Fixed-size HD signature of all k-mers of a sample
+ * Every k-mer is projected to D random signs, the first D bits of a
+ * SplitMix64 stream seeded by its hash, and the projections of a sample
+ * are bundled. Two bundles have a dot product of D times their shared
+ * k-mer occurrences plus noise, so, like MinHash, samples are compared
+ * without their k-mer sets or a sketch, but with SIMD arithmetic only.
+ * The signs of the bundle are a SimHash of the sample's k-mer counts: the
+ * fraction of differing bits between two signatures estimates the angle
+ * between the count vectors, and similarity() is its cosine.
+ * Projections are counted in bit-sliced counters and added to the int32
+ * bundle every 255 k-mers. Only signatures of the same D and seed compare.
+ * @param D number of dimensions, a multiple of 512
+ * @param K key type
+ */
+template<size_t D, typename K = utils::Compressed128Mer>
+class GenomeSignature
+{
+    static_assert(D % 512 == 0, "GenomeSignature dimensions must be a multiple of 512");
+
+    public:
+    static constexpr size_t WORDS = BinaryHV<D>::WORDS;
+
+    /**
+     * @param seed hash seed of the projection, shared by all compared samples
+     */
+    GenomeSignature(uint32_t seed) : seed(seed), pending(0), total(0), planes() {}
+
+    /**
+     * @brief Bundles the projection of one k-mer
+     */
+    void add(const K& key)
+    {
+        alignas(64) uint64_t bits[WORDS];
+        project(key, bits);
+        hd::slice_add(planes, DEPTH, bits, WORDS);
+        ++total;
+        if (++pending == (1U << DEPTH) - 1)
+        {
+            flush();
+        }
+    }
+
+    /**
+     * @brief Bundles the projections of n k-mers
+     */
+    void add_batch(const K* keys, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            add(keys[i]);
+        }
+    }
+
+    /**
+     * @brief Bundles every 128-mer of a sequence
+     * @param packed the bases, 16 per word as in Fasta
+     * @param n number of bases
+     */
+    void add_sequence(const uint32_t* packed, size_t n)
+    {
+        K key;
+        for (size_t i = 0; i + 128 <= n; ++i)
+        {
+            utils::Read128Mer(packed, i, key);
+            add(key);
+        }
+    }
+
+    /**
+     * @brief Number of k-mers bundled
+     */
+    size_t size() const { return total; }
+
+    /**
+     * @brief The bundle of all projections
+     */
+    const ModelHD<int32_t, D>& bundle()
+    {
+        flush();
+        return acc;
+    }
+
+    /**
+     * @brief The signs of the bundle, the signature that is stored and compared
+     */
+    BinaryHV<D> binary()
+    {
+        return BinaryHV<D>(bundle());
+    }
+
+    /**
+     * @brief Estimated cosine similarity of the k-mer counts of two samples
+     * @param hamming Hamming distance of their signatures
+     */
+    static double similarity(size_t hamming)
+    {
+        return std::cos(M_PI * (double)hamming / D);
+    }
+
+    static double similarity(const BinaryHV<D>& a, const BinaryHV<D>& b)
+    {
+        return similarity(a.hamming(b));
+    }
+
+    /**
+     * @brief Similarities of every pair of signatures
+     * Rows are compared in blocks against the signatures from the block on,
+     * so each pair is computed once and mirrored.
+     * @param sigs n signatures
+     * @param out n * n similarities, row-major
+     */
+    static void all_vs_all(const BinaryHV<D>* sigs, size_t n, float* out)
+    {
+        static_assert(sizeof(BinaryHV<D>) == WORDS * 8, "signatures must be contiguous bits");
+        static constexpr size_t BLOCK = 64;
+        std::vector<float> table(D + 1);
+        for (size_t h = 0; h <= D; ++h)
+        {
+            table[h] = similarity(h);
+        }
+        std::vector<uint32_t> dist(BLOCK * n);
+        for (size_t i = 0; i < n; i += BLOCK)
+        {
+            size_t rows = std::min(BLOCK, n - i);
+            hd::hamming_matrix(sigs[i].data(), rows, sigs[i].data(), n - i, WORDS, dist.data(), n - i);
+            for (size_t r = 0; r < rows; ++r)
+            {
+                for (size_t c = r; c < n - i; ++c)
+                {
+                    float s = table[dist[r * (n - i) + c]];
+                    out[(i + r) * n + i + c] = s;
+                    out[(i + c) * n + i + r] = s;
+                }
+            }
+        }
+    }
+
+    protected:
+    static constexpr size_t DEPTH = 8;
+
+    const uint32_t seed;
+    size_t pending;                 // k-mers in the counters
+    size_t total;
+    ModelHD<int32_t, D> acc;
+    alignas(64) uint64_t planes[DEPTH * WORDS];
+
+    void flush()
+    {
+        if (pending)
+        {
+            hd::slice_flush(acc.data(), planes, DEPTH, D, (int32_t)pending);
+            pending = 0;
+        }
+    }
+
+    /**
+     * @brief D random signs of the key; word i is output i of a SplitMix64
+     * stream seeded by the key's hash
+     */
+    void project(const K& key, uint64_t* bits) const
+    {
+        static constexpr uint64_t GAMMA = 0x9E3779B97F4A7C15ULL;
+        uint64_t h[2];
+        MurmurHash3_x64_128(&key, sizeof(K), seed, h);
+        size_t i = 0;
+#if defined(__AVX512DQ__)
+        __m512i x = _mm512_add_epi64(_mm512_set1_epi64(h[0]),
+            _mm512_mullo_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7), _mm512_set1_epi64(GAMMA)));
+        const __m512i step = _mm512_set1_epi64(8 * GAMMA);
+        const __m512i c1 = _mm512_set1_epi64(0xBF58476D1CE4E5B9ULL);
+        const __m512i c2 = _mm512_set1_epi64(0x94D049BB133111EBULL);
+        for (; i < WORDS; i += 8)
+        {
+            __m512i z = _mm512_add_epi64(x, _mm512_set1_epi64(GAMMA));
+            z = _mm512_mullo_epi64(_mm512_xor_si512(z, _mm512_maskz_srli_epi64(0xFF, z, 30)), c1);
+            z = _mm512_mullo_epi64(_mm512_xor_si512(z, _mm512_maskz_srli_epi64(0xFF, z, 27)), c2);
+            _mm512_store_si512(bits + i, _mm512_xor_si512(z, _mm512_maskz_srli_epi64(0xFF, z, 31)));
+            x = _mm512_add_epi64(x, step);
+        }
+#endif
+        for (; i < WORDS; ++i)
+        {
+            bits[i] = utils::splitmix64(h[0] + i * GAMMA);
+        }
+    }
+};
@@ -1,23 +1,47 @@
 #pragma once
-#include "HV32.hh"
+#include "HV.hh"
+#include "BehavioralHD/BinaryHV.hh"
+#include "utils/BucketIndex.hh"
+#include "utils/Instrumentation.hh"
 #include "utils/MurmurHash.hh"
+#include "utils/random.hh"
+#include <algorithm>
+#include <limits>
 #include <random>
+#include <stdexcept>
+#include <type_traits>
 
 
 /**
  * @brief HDSketch, an approximate hashtable using HD as conflict resolution
+ * A key is projected to D random signs, or, with a sparse projection, to
+ * +1 or -1 on `lanes` of the D dimensions and 0 elsewhere: one random lane
+ * in each block of D / lanes. Estimates divide by the number of nonzero
+ * lanes, so their noise is that of the dense projection, while an insert
+ * or estimate touches `lanes` counters instead of D.
  * @param K key type
  * @param V HD vector element type
+ * @param D number of dimensions
+ * @param I instrumentation policy, see utils/Instrumentation.hh
  */
-template<typename K, typename V>
+template<typename K, typename V, size_t D = 32, typename I = utils::NoInstrumentation>
 class HDSketch
 {
+    static_assert(D <= 65536, "sparse projections index lanes with 16 bits");
+
     public:
-    using HV = HV32<V>;
+    using HVec = HV<V, D>;
 
-    HDSketch(size_t s, std::mt19937_64& gen) : sz(s)
+    /**
+     * @param s number of buckets; a power of two can be folded repeatedly
+     * @param gen seeds the hash functions
+     * @param lanes nonzero lanes of the projection, a divisor of D; 0 or D is dense
+     */
+    HDSketch(size_t s, std::mt19937_64& gen, size_t lanes = 0) : sz(s), index(s), nnz(lanes ? lanes : D)
     {
-        buckets = new HV[sz]();
+        if (nnz > D || D % nnz != 0)
+            throw std::invalid_argument("projection lanes must divide the dimensions");
+        buckets = new HVec[sz]();
         std::uniform_int_distribution<uint32_t> dist(0, std::numeric_limits<uint32_t>::max());
         seed_0 = dist(gen);
         seed_1 = dist(gen);
@@ -36,9 +60,11 @@ class HDSketch
      */
     double estimate(const K& key) const 
     {
-        uint32_t idx = hash(key) % this->sz;
-        uint32_t h = project(key);
-        return (double)buckets[idx].dot(HV(h)) / 32;
+        auto t = instr.start(utils::Op::Estimate);
+        uint32_t idx = index(hash(key));
+        double result = estimate_at(idx, key);
+        instr.finish(utils::Op::Estimate, t);
+        return result;
     }
 
     /**
@@ -47,17 +73,293 @@ class HDSketch
      */
     void insert(const K& key)
     {
-        uint32_t idx = hash(key) % sz;
-        uint32_t h = project(key);
-        buckets[idx] += HV(h);
+        auto t = instr.start(utils::Op::Insert);
+        uint32_t idx = index(hash(key));
+        insert_at(idx, key);
+        instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Inserts count occurrences of the key with one bucket update
+     * @param key the key
+     * @param count number of occurrences
+     */
+    void insert(const K& key, uint32_t count)
+    {
+        auto t = instr.start(utils::Op::Insert);
+        uint32_t idx = index(hash(key));
+        insert_at(idx, key, count);
+        instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Estimates a batch of keys, prefetching all buckets first
+     * @param keys the query keys
+     * @param n number of keys
+     * @param out n estimates
+     */
+    void estimate_batch(const K* keys, size_t n, double* out) const
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Estimate, m);
+            uint32_t idx[BATCH];
+            Sparse proj[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                idx[j] = index(hash(keys[base + j]));
+                if (nnz < D)
+                {
+                    project_sparse(keys[base + j], proj[j]);
+                    prefetch(idx[j], proj[j]);
+                }
+                else
+                {
+                    prefetch(idx[j]);
+                }
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                out[base + j] = nnz < D ? estimate_sparse(idx[j], proj[j]) : estimate_at(idx[j], keys[base + j]);
+            }
+            instr.finish(utils::Op::Estimate, t, m);
+        }
+    }
+
+    /**
+     * @brief Inserts a batch of keys, prefetching all buckets first
+     * @param keys the keys
+     * @param n number of keys
+     * @param counts occurrences of each key, nullptr for one each
+     */
+    void insert_batch(const K* keys, size_t n, const uint32_t* counts = nullptr)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Insert, m);
+            uint32_t idx[BATCH];
+            Sparse proj[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                idx[j] = index(hash(keys[base + j]));
+                if (nnz < D)
+                {
+                    project_sparse(keys[base + j], proj[j]);
+                    prefetch(idx[j], proj[j]);
+                }
+                else
+                {
+                    prefetch(idx[j]);
+                }
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                uint32_t count = counts ? counts[base + j] : 1;
+                if (nnz < D)
+                    insert_sparse(idx[j], proj[j], count);
+                else
+                    insert_at(idx[j], keys[base + j], count);
+            }
+            instr.finish(utils::Op::Insert, t, m);
+        }
+    }
+
+    /**
+     * @brief Halves the memory by bundling bucket i + sz / 2 into bucket i
+     * Every estimate keeps its signal; the noise of the two buckets adds up.
+     * Throws std::logic_error if the number of buckets is odd.
+     */
+    void fold()
+    {
+        if (sz % 2 != 0)
+            throw std::logic_error("cannot fold an odd number of buckets");
+        size_t half = sz / 2;
+        HVec* next = new HVec[half];
+        for (size_t i = 0; i < half; ++i)
+        {
+            next[i] = buckets[i];
+            next[i] += buckets[i + half];
+        }
+        resize(next, half);
+    }
+
+    /**
+     * @brief Doubles the memory by copying every bucket into both halves
+     * Current estimates are unchanged; later inserts spread over twice the
+     * buckets and collide half as often.
+     */
+    void unfold()
+    {
+        HVec* next = new HVec[sz * 2];
+        std::copy(buckets, buckets + sz, next);
+        std::copy(buckets, buckets + sz, next + sz);
+        resize(next, sz * 2);
+    }
+
+    /**
+     * @brief Estimates the second moment of the counts, sum of count^2
+     * Every bucket contributes |bucket|^2 / lanes, whose cross terms between
+     * different keys vanish in expectation.
+     */
+    double second_moment() const
+    {
+        double sum = 0;
+        for (size_t i = 0; i < sz; ++i)
+        {
+            sum += (double)buckets[i].dot(buckets[i]);
+        }
+        return sum / nnz;
+    }
+
+    /**
+     * @brief Nonzero lanes of a projection, D if it is dense
+     */
+    size_t lanes() const
+    {
+        return nnz;
+    }
+
+    /**
+     * @brief Number of buckets
+     */
+    size_t size() const
+    {
+        return sz;
+    }
+
+    /**
+     * @brief Memory used by the buckets in bytes
+     */
+    size_t bytes() const
+    {
+        return sz * sizeof(HVec);
     }
 
+    const I& instrumentation() const { return instr; }
+
 
     protected:
-    const size_t sz;
-    HV* buckets;
+    static constexpr size_t BATCH = 16;
+
+    /**
+     * @brief A sparse projection: nonzero lanes, ascending, and their signs, bit set for +1
+     */
+    struct Sparse
+    {
+        uint16_t lane[D];
+        uint64_t signs[BinaryHV<D>::WORDS];
+    };
+
+    size_t sz;
+    utils::BucketIndex index;
+    size_t nnz;
+    HVec* buckets;
     uint32_t seed_0;
     uint32_t seed_1;
+    mutable I instr;
+
+    void resize(HVec* next, size_t s)
+    {
+        delete[] buckets;
+        buckets = next;
+        sz = s;
+        index = utils::BucketIndex(s);
+    }
+
+    double estimate_at(uint32_t idx, const K& key) const
+    {
+        if (nnz < D)
+        {
+            Sparse proj;
+            project_sparse(key, proj);
+            return estimate_sparse(idx, proj);
+        }
+        return (double)buckets[idx].dot(project(key)) / D;
+    }
+
+    double estimate_sparse(uint32_t idx, const Sparse& proj) const
+    {
+        return (double)hd::dot_sparse(buckets[idx].data(), D, proj.lane, proj.signs, nnz) / nnz;
+    }
+
+    void insert_at(uint32_t idx, const K& key, uint32_t count = 1)
+    {
+        if (nnz < D)
+        {
+            Sparse proj;
+            project_sparse(key, proj);
+            insert_sparse(idx, proj, count);
+            return;
+        }
+        BinaryHV<D> hv = project(key);
+        if constexpr (I::ENABLED && std::is_integral<V>::value)
+        {
+            size_t n = 0;
+            for (size_t i = 0; i < D; ++i)
+            {
+                int64_t next = hv[i] > 0 ? (int64_t)buckets[idx][i] + count : (int64_t)buckets[idx][i] - count;
+                n += next > std::numeric_limits<V>::max() || next < std::numeric_limits<V>::min();
+            }
+            if (n)
+            {
+                instr.overflow(n);
+            }
+        }
+        if (count == 1)
+        {
+            buckets[idx] += hv;
+            return;
+        }
+        HVec w;
+        for (size_t i = 0; i < D; ++i)
+        {
+            w[i] = hv[i] > 0 ? (V)count : (V)-(V)count;
+        }
+        buckets[idx] += w;
+    }
+
+    void insert_sparse(uint32_t idx, const Sparse& proj, uint32_t count)
+    {
+        V* b = buckets[idx].data();
+        if constexpr (I::ENABLED && std::is_integral<V>::value)
+        {
+            size_t n = 0;
+            for (size_t j = 0; j < nnz; ++j)
+            {
+                int64_t v = b[proj.lane[j]];
+                int64_t next = (proj.signs[j / 64] >> (j % 64)) & 1U ? v + count : v - count;
+                n += next > std::numeric_limits<V>::max() || next < std::numeric_limits<V>::min();
+            }
+            if (n)
+            {
+                instr.overflow(n);
+            }
+        }
+        hd::add_sparse(b, D, proj.lane, proj.signs, nnz, (V)count);
+    }
+
+    /**
+     * @brief Prefetches the cache lines of the bucket that a sparse projection touches
+     */
+    void prefetch(uint32_t idx, const Sparse& proj) const
+    {
+        const V* b = buckets[idx].data();
+        for (size_t j = 0; j < nnz; ++j)
+        {
+            __builtin_prefetch(b + proj.lane[j]);
+        }
+    }
+
+    void prefetch(uint32_t idx) const
+    {
+        const char* p = (const char*)(buckets + idx);
+        for (size_t off = 0; off < sizeof(HVec); off += 64)
+        {
+            __builtin_prefetch(p + off);
+        }
+    }
 
     /**
      * @brief Hash function for bucket mapping
@@ -71,12 +373,53 @@ class HDSketch
 
     /**
      * @brief Hash function for HD projection
+     * The projection stays bit-packed; buckets bundle and dot it directly.
+     * @param key the key
+     * @return D random signs
      */
-    uint32_t project(const K& key) const
+    BinaryHV<D> project(const K& key) const
     {
-        uint32_t result;
-        MurmurHash3_x86_32(&key, sizeof(K), seed_1, &result);
-        return result;
-        // return key.u32[0];
+        uint64_t bits[BinaryHV<D>::WORDS];
+        if constexpr (D <= 32)
+        {
+            uint32_t result;
+            MurmurHash3_x86_32(&key, sizeof(K), seed_1, &result);
+            bits[0] = result;
+        }
+        else
+        {
+            uint64_t result[2];
+            MurmurHash3_x64_128(&key, sizeof(K), seed_1, result);
+            for (size_t i = 0; i < BinaryHV<D>::WORDS; ++i)
+            {
+                bits[i] = i < 2 ? result[i] : utils::splitmix64(bits[i - 1] ^ result[i & 1U]);
+            }
+        }
+        return BinaryHV<D>(bits);
+    }
+
+    /**
+     * @brief Sparse projection: lane j is a random lane of block j of D / nnz lanes
+     * The 16-bit chunk j of the projection stream gives lane j its sign,
+     * in the top bit, and its offset in the block.
+     */
+    void project_sparse(const K& key, Sparse& proj) const
+    {
+        uint64_t words[(D + 3) / 4];
+        uint64_t result[2];
+        MurmurHash3_x64_128(&key, sizeof(K), seed_1, result);
+        size_t n = (nnz + 3) / 4;
+        for (size_t i = 0; i < n; ++i)
+        {
+            words[i] = i < 2 ? result[i] : utils::splitmix64(words[i - 1] ^ result[i & 1U]);
+        }
+        std::fill(proj.signs, proj.signs + (nnz + 63) / 64, 0);
+        uint32_t block = D / nnz;
+        for (size_t j = 0; j < nnz; ++j)
+        {
+            uint32_t chunk = (words[j / 4] >> (j % 4 * 16)) & 0xFFFFU;
+            proj.lane[j] = j * block + (((chunk & 0x7FFFU) * block) >> 15U);
+            proj.signs[j / 64] |= (uint64_t)(chunk >> 15U) << (j % 64);
+        }
     }
-};
\ No newline at end of file
+};
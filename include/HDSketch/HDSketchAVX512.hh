@@ -1,16 +1,34 @@
 #pragma once
+#include "utils/BucketIndex.hh"
+#include "utils/Checkpoint.hh"
+#include "utils/Instrumentation.hh"
 #include "utils/MurmurHash.hh"
+#include "utils/SketchFile.hh"
+#include <algorithm>
 #include <limits>
+#include <memory>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <cstdlib>
 #include <cstring>
 #include <immintrin.h>
 
-template<typename K>
+/**
+ * @brief HDSketch with 32 int16 dimensions per 64-byte bucket, using AVX-512
+ * @param K key type
+ * @param I instrumentation policy, see utils/Instrumentation.hh
+ */
+template<typename K, typename I = utils::NoInstrumentation>
 class HDSketchAVX512
 {
     public:
-    HDSketchAVX512(size_t s, std::mt19937_64& gen) : sz(s)
+    /**
+     * @param s number of buckets; a power of two can be folded repeatedly
+     * @param gen seeds the hash functions
+     */
+    HDSketchAVX512(size_t s, std::mt19937_64& gen) : sz(s), index(s), dirty(nullptr)
     {
         buckets = (char*)std::aligned_alloc(64, sz * 64);
         std::memset(buckets, 0, sz * 64);
@@ -19,12 +37,105 @@ class HDSketchAVX512
         seed_1 = dist(gen);
     }
 
+    /**
+     * @brief Maps a sketch persisted with save(); the buckets are used in place
+     * and stay shared with other processes mapping the file until written.
+     * Compressed files are decoded into private memory.
+     * @param path the sketch file
+     */
+    HDSketchAVX512(const std::string& path)
+        : file(new utils::MappedSketch(path, utils::SketchKind::HDSketchAVX512)), sz(file->header().width), index(sz), dirty(nullptr)
+    {
+        const utils::SketchHeader& h = file->header();
+        if (h.cell_bits != 16 || h.height != 1 || h.seed_count != 2 || sz == 0 || sz > h.row_bytes / 64)
+            throw std::runtime_error(path + " has an incompatible HDSketchAVX512 layout");
+        buckets = file->row(0);
+        seed_0 = file->seeds()[0];
+        seed_1 = file->seeds()[1];
+    }
+
     ~HDSketchAVX512()
     {
-        std::free(buckets);
+        if (!file)
+        {
+            std::free(buckets);
+        }
         buckets = nullptr;
     }
 
+    /**
+     * @brief Halves the memory by bundling bucket i + sz / 2 into bucket i
+     * Every estimate keeps its signal; the noise of the two buckets adds up.
+     * A mapped sketch moves to private memory. Throws std::logic_error if the
+     * number of buckets is odd or the sketch is tracked.
+     */
+    void fold()
+    {
+        if (sz % 2 != 0)
+            throw std::logic_error("cannot fold an odd number of buckets");
+        if (dirty)
+            throw std::logic_error("cannot fold a tracked sketch");
+        size_t half = sz / 2;
+        char* next = (char*)std::aligned_alloc(64, half * 64);
+        for (size_t i = 0; i < half; ++i)
+        {
+            __m512i lo = _mm512_load_epi32(buckets + i * 64);
+            __m512i hi = _mm512_load_epi32(buckets + (i + half) * 64);
+            _mm512_store_epi32(next + i * 64, _mm512_add_epi16(lo, hi));
+        }
+        resize(next, half);
+    }
+
+    /**
+     * @brief Doubles the memory by copying every bucket into both halves
+     * Current estimates are unchanged; later inserts spread over twice the
+     * buckets and collide half as often. Throws std::logic_error if the
+     * sketch is tracked.
+     */
+    void unfold()
+    {
+        if (dirty)
+            throw std::logic_error("cannot unfold a tracked sketch");
+        char* next = (char*)std::aligned_alloc(64, sz * 128);
+        std::memcpy(next, buckets, sz * 64);
+        std::memcpy(next + sz * 64, buckets, sz * 64);
+        resize(next, sz * 2);
+    }
+
+    /**
+     * @brief Estimates the second moment of the counts, sum of count^2
+     * Every bucket contributes |bucket|^2 / 32, whose cross terms between
+     * different keys vanish in expectation.
+     */
+    double second_moment() const
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < sz; ++i)
+        {
+            __m512i b = _mm512_load_epi32(buckets + i * 64);
+            sum += _mm512_reduce_add_epi64(sum_pairs(_mm512_madd_epi16(b, b)));
+        }
+        return (double)sum / 32;
+    }
+
+    /**
+     * @brief Number of buckets
+     */
+    size_t size() const
+    {
+        return sz;
+    }
+
+    /**
+     * @brief Persists the sketch; throws std::runtime_error on I/O errors
+     * @param path the sketch file
+     * @param compressed bit-plane code the counters, see utils/SketchCodec.hh
+     */
+    void save(const std::string& path, bool compressed = false) const
+    {
+        utils::write_sketch(path, utils::SketchKind::HDSketchAVX512, sz, 16, {seed_0, seed_1}, {buckets}, sz * 64, compressed);
+    }
+
     /**
      * @brief Estimates the number of occurence of given key
      * @param key the query key
@@ -32,14 +143,14 @@ class HDSketchAVX512
      */
     double estimate(const K& key) const 
     {
-        size_t idx = hash(key) % this->sz;
+        auto t = instr.start(utils::Op::Estimate);
+        size_t idx = index(hash(key));
         uint32_t h = project(key);
 
         __m512i bucket_vec = _mm512_load_epi32(buckets + idx * 64);     // load 32x16 vector from buckets
-        __m512i query_vec = hash_to_vec(h);
-        __m512i prod_vec = _mm512_madd_epi16(bucket_vec, query_vec);    // FMA
-        int dot = _mm512_reduce_add_epi32(prod_vec);                    // Reduce
-        return (double)dot / 32;
+        int d = dot(bucket_vec, h);
+        instr.finish(utils::Op::Estimate, t);
+        return (double)d / 32;
     }
 
     /**
@@ -48,34 +159,243 @@ class HDSketchAVX512
      */
     void insert(const K& key)
     {
-        uint32_t idx = hash(key) % sz;
+        auto t = instr.start(utils::Op::Insert);
+        uint32_t idx = index(hash(key));
         uint32_t h = project(key);
 
         __m512i bucket_vec = _mm512_load_epi32(buckets + idx * 64);     // load 32x16 vector from buckets
-        __m512i query_vec = hash_to_vec(h);
 
-        bucket_vec = _mm512_add_epi16(bucket_vec, query_vec);
+        if constexpr (I::ENABLED)
+        {
+            count_overflow(bucket_vec, h);
+        }
+        bucket_vec = bundle(bucket_vec, h);
         _mm512_store_epi32(buckets + idx * 64, bucket_vec);
+        touch(idx);
+        instr.finish(utils::Op::Insert, t);
     }
 
-    protected:
-    static constexpr uint32_t FULL_MASK_32 = 0xFFFFFFFFU;
-    static constexpr uint32_t UPPER_MASK_32 = 0xFFFF0000U;
-    static constexpr uint32_t LOWER_MASK_32 = 0x0000FFFFU;
+    /**
+     * @brief Inserts count occurrences of the key with one bucket update
+     * @param key the key
+     * @param count number of occurrences
+     */
+    void insert(const K& key, uint32_t count)
+    {
+        auto t = instr.start(utils::Op::Insert);
+        uint32_t idx = index(hash(key));
+        __m512i bucket_vec = _mm512_load_epi32(buckets + idx * 64);
+        bucket_vec = bundle_count(bucket_vec, project(key), count);
+        _mm512_store_epi32(buckets + idx * 64, bucket_vec);
+        touch(idx);
+        instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Inserts the key and estimates it before and after, from one bucket load
+     * @param key the key
+     * @return the estimates before and after the insertion
+     */
+    std::pair<double, double> insert_and_estimate(const K& key)
+    {
+        auto t = instr.start(utils::Op::Insert);
+        uint32_t idx = index(hash(key));
+        std::pair<double, double> result = insert_and_estimate_at(idx, project(key));
+        instr.finish(utils::Op::Insert, t);
+        return result;
+    }
+
+    /**
+     * @brief Fused insert and estimate of a batch of keys, prefetching all buckets first
+     * @param keys the keys
+     * @param n number of keys
+     * @param before n estimates before each insertion
+     * @param after n estimates after each insertion
+     */
+    void insert_and_estimate_batch(const K* keys, size_t n, double* before, double* after)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Insert, m);
+            size_t idx[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                idx[j] = index(hash(keys[base + j]));
+                __builtin_prefetch(buckets + idx[j] * 64, 1);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                auto r = insert_and_estimate_at(idx[j], project(keys[base + j]));
+                before[base + j] = r.first;
+                after[base + j] = r.second;
+            }
+            instr.finish(utils::Op::Insert, t, m);
+        }
+    }
+
+    /**
+     * @brief Estimates a batch of keys, prefetching all buckets first
+     * @param keys the query keys
+     * @param n number of keys
+     * @param out n estimates
+     */
+    void estimate_batch(const K* keys, size_t n, double* out) const
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Estimate, m);
+            size_t idx[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                idx[j] = index(hash(keys[base + j]));
+                __builtin_prefetch(buckets + idx[j] * 64);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                __m512i bucket_vec = _mm512_load_epi32(buckets + idx[j] * 64);
+                out[base + j] = (double)dot(bucket_vec, project(keys[base + j])) / 32;
+            }
+            instr.finish(utils::Op::Estimate, t, m);
+        }
+    }
 
-    static constexpr uint16_t SHIFT_MASK[32] __attribute__((__aligned__(64))) = {
-        0x1U, 0x2U, 0x4U, 0x8U, 0x10U, 0x20U, 0x40U, 0x80U,
-        0x100U, 0x200U, 0x400U, 0x800U, 0x1000U, 0x2000U, 0x4000U, 0x8000U,
-        0x1U, 0x2U, 0x4U, 0x8U, 0x10U, 0x20U, 0x40U, 0x80U,
-        0x100U, 0x200U, 0x400U, 0x800U, 0x1000U, 0x2000U, 0x4000U, 0x8000U,
-    };
+    /**
+     * @brief Inserts a batch of keys, prefetching all buckets first
+     * @param keys the keys
+     * @param n number of keys
+     * @param counts occurrences of each key, nullptr for one each
+     */
+    void insert_batch(const K* keys, size_t n, const uint32_t* counts = nullptr)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Insert, m);
+            size_t idx[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                idx[j] = index(hash(keys[base + j]));
+                __builtin_prefetch(buckets + idx[j] * 64, 1);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                uint32_t h = project(keys[base + j]);
+                __m512i bucket_vec = _mm512_load_epi32(buckets + idx[j] * 64);
+                if (counts)
+                {
+                    bucket_vec = bundle_count(bucket_vec, h, counts[base + j]);
+                }
+                else
+                {
+                    if constexpr (I::ENABLED)
+                    {
+                        count_overflow(bucket_vec, h);
+                    }
+                    bucket_vec = bundle(bucket_vec, h);
+                }
+                _mm512_store_epi32(buckets + idx[j] * 64, bucket_vec);
+                touch(idx[j]);
+            }
+            instr.finish(utils::Op::Insert, t, m);
+        }
+    }
+
+    /**
+     * @brief Memory used by the buckets in bytes
+     */
+    size_t bytes() const
+    {
+        return sz * 64;
+    }
 
-    
+    /**
+     * @brief The buckets, bytes() of them, as laid out in the sketch file
+     */
+    char* data() { return buckets; }
 
-    const size_t sz;
+    const char* data() const { return buckets; }
+
+    /**
+     * @brief Marks the pages of every bucket written from now on, see utils/Checkpoint.hh
+     * The sketch cannot be folded or unfolded while tracked.
+     * @param pages pages of data(), nullptr to stop tracking
+     */
+    void track(utils::DirtyPages* pages)
+    {
+        dirty = pages;
+    }
+
+    const I& instrumentation() const { return instr; }
+
+    protected:
+    template<typename, typename>
+    friend class SnapshotHDSketchAVX512;
+    template<typename, typename>
+    friend class TwoChoiceHDSketchAVX512;
+
+    static constexpr size_t BATCH = 16;
+
+    std::unique_ptr<utils::MappedSketch> file;  // set if the buckets are mapped
+    size_t sz;
+    utils::BucketIndex index;
     char* buckets;
     uint32_t seed_0;
     uint32_t seed_1;
+    utils::DirtyPages* dirty;                   // set while checkpointed
+    mutable I instr;
+
+    void resize(char* next, size_t s)
+    {
+        if (file)
+            file.reset();
+        else
+            std::free(buckets);
+        buckets = next;
+        sz = s;
+        index = utils::BucketIndex(s);
+    }
+
+    void touch(size_t idx)
+    {
+        if (dirty)
+            dirty->mark(idx * 64);
+    }
+
+    /**
+     * @brief Adds the 16 madd lanes of squares in pairs into int64
+     * A lane holds two int16 squares, up to 2^31, so it is zero-extended.
+     */
+    static __m512i sum_pairs(__m512i v)
+    {
+        __m512i lo = _mm512_and_si512(v, _mm512_set1_epi64(0xFFFFFFFF));
+        __m512i hi = _mm512_srli_epi64(v, 32);
+        return _mm512_add_epi64(lo, hi);
+    }
+
+    /**
+     * @brief Reports the lanes that wrap around when c times h is added to bucket_vec
+     */
+    void count_overflow(__m512i bucket_vec, uint32_t h, int16_t c = 1)
+    {
+        int n = overflow_lanes(bucket_vec, h, c);
+        if (n)
+        {
+            instr.overflow(n);
+        }
+    }
+
+    /**
+     * @brief Number of lanes that wrap around when c times h is added to bucket_vec
+     * @param c positive weight
+     */
+    static int overflow_lanes(__m512i bucket_vec, __mmask32 h, int16_t c = 1)
+    {
+        __mmask32 up = _mm512_cmpgt_epi16_mask(bucket_vec, _mm512_set1_epi16(INT16_MAX - c)) & h;
+        __mmask32 down = _mm512_cmplt_epi16_mask(bucket_vec, _mm512_set1_epi16(INT16_MIN + c)) & ~h;
+        return __builtin_popcount(up | down);
+    }
 
     /**
      * @brief Hash function for bucket mapping
@@ -99,27 +419,56 @@ class HDSketchAVX512
     }
 
     /**
-     * @brief Convert 32bit into 32 dimension bi-polar vector
-     * @param h 32-bit input
-     * @return 32x16 bit vector; vec[i] = (h & (1 << i)) ? 1 : -1;
+     * @brief Adds count times the bipolar vector of h, in steps that fit int16 lanes
      */
-    __m512i hash_to_vec(uint32_t h) const 
+    __m512i bundle_count(__m512i bucket_vec, uint32_t h, uint32_t count)
     {
-        // load the mask
-        __m512i shift_mask = _mm512_load_epi32(SHIFT_MASK);
+        while (count > 0)
+        {
+            int16_t c = std::min<uint32_t>(count, INT16_MAX);
+            if constexpr (I::ENABLED)
+            {
+                count_overflow(bucket_vec, h, c);
+            }
+            bucket_vec = bundle(bucket_vec, h, c);
+            count -= c;
+        }
+        return bucket_vec;
+    }
 
-        uint16_t high = h >> 16U;
-        uint16_t low = h;
+    /**
+     * @brief Adds c times the bipolar vector of h to a bucket
+     * The projection bits are the write masks: +c where set, -c where clear.
+     */
+    static __m512i bundle(__m512i bucket_vec, __mmask32 h, int16_t c = 1)
+    {
+        __m512i w = _mm512_set1_epi16(c);
+        bucket_vec = _mm512_mask_add_epi16(bucket_vec, h, bucket_vec, w);
+        return _mm512_mask_sub_epi16(bucket_vec, ~h, bucket_vec, w);
+    }
 
-        __m512i vec = _mm512_set1_epi16(low);                   // set all 32 elements to lower 16 bits of hash
-        __m512i v_one = _mm512_set1_epi16(1);                   // vector of ones
-        __m512i v_minus_one = _mm512_set1_epi16(-1);            // vector of minus ones
-        __m512i v_zero = _mm512_set1_epi16(0);                 // vector of zeros
-        
-        vec = _mm512_mask_set1_epi16(vec, UPPER_MASK_32, high); // set higher 16 elements to higher 16 bits of hash
-        vec = _mm512_and_epi32(shift_mask, vec);                // bit-wise and 
-        __mmask32 zero_mask = _mm512_cmp_epi16_mask(vec, v_zero, _MM_CMPINT_EQ);
-        vec = _mm512_mask_blend_epi16(zero_mask, v_one, v_minus_one);
-        return vec;
+    /**
+     * @brief Dot product of a bucket with the bipolar vector of h
+     * The sign vector is one blend under the mask h; madd then sums the
+     * signed lanes in pairs into int32, which cannot overflow.
+     */
+    static int dot(__m512i bucket_vec, __mmask32 h)
+    {
+        __m512i sign = _mm512_mask_blend_epi16(h, _mm512_set1_epi16(-1), _mm512_set1_epi16(1));
+        return _mm512_reduce_add_epi32(_mm512_madd_epi16(bucket_vec, sign));
+    }
+
+    std::pair<double, double> insert_and_estimate_at(size_t idx, uint32_t h)
+    {
+        __m512i bucket_vec = _mm512_load_epi32(buckets + idx * 64);
+        int d0 = dot(bucket_vec, h);
+        if constexpr (I::ENABLED)
+        {
+            count_overflow(bucket_vec, h);
+        }
+        bucket_vec = bundle(bucket_vec, h);
+        _mm512_store_epi32(buckets + idx * 64, bucket_vec);
+        touch(idx);
+        return std::make_pair((double)d0 / 32, (double)dot(bucket_vec, h) / 32);
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include "BehavioralHD/ModelHD.hh"
+#include <cstdint>
+
+/**
+ * @brief Bipolar D-dimensional vector built from D random bits
+ * @param T element type
+ * @param D number of dimensions
+ */
+template<typename T, size_t D>
+class HV : public ModelHD<T, D>
+{
+    public:
+    static constexpr size_t WORDS = (D + 63) / 64;
+
+    HV() : ModelHD<T, D>() {}
+
+    /**
+     * @brief Constructs the vector from random bits
+     * @param bits WORDS words; vec[i] = bit i ? 1 : -1
+     */
+    HV(const uint64_t* bits) : ModelHD<T, D>()
+    {
+        hd::from_bits(this->buf.data(), bits, D);
+    }
+};
@@ -0,0 +1,426 @@
+#pragma once
+#include "HDSketchAVX512.hh"
+#include <atomic>
+#include <limits>
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+
+/**
+ * @brief HDSketchAVX512 that can be queried while it is being written
+ * The buckets live in 4 KiB pages. One writer inserts into private copies of
+ * the pages, and publish() makes everything inserted so far visible as an
+ * immutable snapshot. Readers pin the current snapshot without locks, and a
+ * page is copied only on its first write after a publish. Replaced pages and
+ * old snapshots are freed by epoch-based reclamation once no reader can hold
+ * them anymore.
+ * insert, insert_batch and publish must be called from one thread at a time;
+ * snapshot, estimate and estimate_batch from any number of threads.
+ * @param K key type
+ * @param I instrumentation policy, see utils/Instrumentation.hh
+ */
+template<typename K, typename I = utils::NoInstrumentation>
+class SnapshotHDSketchAVX512
+{
+    protected:
+    using Base = HDSketchAVX512<K, I>;
+
+    /**
+     * @brief A published, immutable page table
+     */
+    struct Version
+    {
+        uint64_t epoch;
+        std::vector<char*> pages;
+    };
+
+    public:
+    static constexpr size_t PAGE_BUCKETS = 64;
+    static constexpr size_t PAGE_BYTES = PAGE_BUCKETS * 64;
+    static constexpr size_t MAX_READERS = 128;     // concurrently pinned snapshots
+
+    /**
+     * @brief A consistent view of the sketch as of one publish()
+     * Holding a snapshot delays the reclamation of everything replaced after it.
+     */
+    class Snapshot
+    {
+        public:
+        Snapshot(Snapshot&& other) : owner(other.owner), slot(other.slot), version(other.version)
+        {
+            other.owner = nullptr;
+        }
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        ~Snapshot()
+        {
+            if (owner)
+            {
+                owner->unpin(slot);
+            }
+        }
+
+        /**
+         * @brief Number of the publish() this snapshot reflects, 0 for the empty sketch
+         */
+        uint64_t epoch() const { return version->epoch; }
+
+        /**
+         * @brief Estimates the number of occurence of given key
+         * @param key the query key
+         * @return the estimated value
+         */
+        double estimate(const K& key) const
+        {
+            auto t = owner->instr.start(utils::Op::Estimate);
+            size_t idx = owner->index(owner->hash(key));
+            __m512i bucket_vec = _mm512_load_epi32(bucket(idx));
+            int d = Base::dot(bucket_vec, owner->project(key));
+            owner->instr.finish(utils::Op::Estimate, t);
+            return (double)d / 32;
+        }
+
+        /**
+         * @brief Estimates a batch of keys, prefetching all buckets first
+         * @param keys the query keys
+         * @param n number of keys
+         * @param out n estimates
+         */
+        void estimate_batch(const K* keys, size_t n, double* out) const
+        {
+            for (size_t base = 0; base < n; base += BATCH)
+            {
+                size_t m = std::min(BATCH, n - base);
+                auto t = owner->instr.start(utils::Op::Estimate, m);
+                const char* b[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    b[j] = bucket(owner->index(owner->hash(keys[base + j])));
+                    __builtin_prefetch(b[j]);
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    __m512i bucket_vec = _mm512_load_epi32(b[j]);
+                    out[base + j] = (double)Base::dot(bucket_vec, owner->project(keys[base + j])) / 32;
+                }
+                owner->instr.finish(utils::Op::Estimate, t, m);
+            }
+        }
+
+        protected:
+        friend class SnapshotHDSketchAVX512;
+
+        const SnapshotHDSketchAVX512* owner;
+        size_t slot;
+        const Version* version;
+
+        Snapshot(const SnapshotHDSketchAVX512* o, size_t s, const Version* v) : owner(o), slot(s), version(v) {}
+
+        const char* bucket(size_t idx) const
+        {
+            return version->pages[idx / PAGE_BUCKETS] + idx % PAGE_BUCKETS * 64;
+        }
+    };
+
+    SnapshotHDSketchAVX512(size_t s, std::mt19937_64& gen) : sz(s), index(s)
+    {
+        pages.resize((sz + PAGE_BUCKETS - 1) / PAGE_BUCKETS);
+        for (auto& it : pages)
+        {
+            it = alloc_page();
+            std::memset(it, 0, PAGE_BYTES);
+        }
+        shared.assign(pages.size(), 1);
+        current.store(new Version{0, pages});
+
+        std::uniform_int_distribution<uint32_t> dist(0, std::numeric_limits<uint32_t>::max());
+        seed_0 = dist(gen);
+        seed_1 = dist(gen);
+    }
+
+    SnapshotHDSketchAVX512(const SnapshotHDSketchAVX512&) = delete;
+    SnapshotHDSketchAVX512& operator=(const SnapshotHDSketchAVX512&) = delete;
+
+    /**
+     * @brief Frees all pages; no snapshot may outlive the sketch
+     */
+    ~SnapshotHDSketchAVX512()
+    {
+        for (auto& it : retired)
+        {
+            release(it);
+        }
+        Version* v = current.load();
+        for (size_t p = 0; p < pages.size(); ++p)
+        {
+            if (pages[p] != v->pages[p])
+            {
+                std::free(pages[p]);
+            }
+            std::free(v->pages[p]);
+        }
+        delete v;
+    }
+
+    /**
+     * @brief Pins the latest published snapshot; lock-free
+     */
+    Snapshot snapshot() const
+    {
+        size_t slot = pin();
+        return Snapshot(this, slot, current.load(std::memory_order_seq_cst));
+    }
+
+    /**
+     * @brief Estimates a key in the latest published snapshot
+     */
+    double estimate(const K& key) const
+    {
+        return snapshot().estimate(key);
+    }
+
+    /**
+     * @brief Estimates a batch of keys in the latest published snapshot
+     */
+    void estimate_batch(const K* keys, size_t n, double* out) const
+    {
+        snapshot().estimate_batch(keys, n, out);
+    }
+
+    /**
+     * @brief Inserts the key; visible to readers after the next publish()
+     * @param key the key
+     */
+    void insert(const K& key)
+    {
+        auto t = instr.start(utils::Op::Insert);
+        char* b = writable(index(hash(key)));
+        update(b, project(key));
+        instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Inserts a batch of keys, prefetching all buckets first
+     * @param keys the keys
+     * @param n number of keys
+     */
+    void insert_batch(const K* keys, size_t n)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Insert, m);
+            size_t idx[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                idx[j] = index(hash(keys[base + j]));
+                __builtin_prefetch(pages[idx[j] / PAGE_BUCKETS] + idx[j] % PAGE_BUCKETS * 64, 1);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                update(writable(idx[j]), project(keys[base + j]));
+            }
+            instr.finish(utils::Op::Insert, t, m);
+        }
+    }
+
+    /**
+     * @brief Makes all inserts so far visible to new snapshots, and frees
+     * whatever no pinned snapshot can reach anymore
+     * @return the epoch of the new snapshot
+     */
+    uint64_t publish()
+    {
+        Version* old = current.load(std::memory_order_relaxed);
+        Version* v = new Version{old->epoch + 1, pages};
+        current.store(v, std::memory_order_seq_cst);
+        epoch.store(v->epoch + 1, std::memory_order_seq_cst);
+
+        // readers that pinned before the epoch moved may still see old
+        retired.push_back({old->epoch, old, std::move(replaced)});
+        replaced.clear();
+        std::fill(shared.begin(), shared.end(), 1);
+        reclaim();
+        return v->epoch;
+    }
+
+    /**
+     * @brief Memory used by the buckets in bytes, excluding page copies
+     */
+    size_t bytes() const
+    {
+        return sz * 64;
+    }
+
+    /**
+     * @brief Retired pages waiting for readers to move on
+     */
+    size_t retired_pages() const
+    {
+        size_t n = 0;
+        for (const auto& it : retired)
+        {
+            n += it.pages.size();
+        }
+        return n;
+    }
+
+    const I& instrumentation() const { return instr; }
+
+    protected:
+    static constexpr size_t BATCH = Base::BATCH;
+    static constexpr uint64_t IDLE = 0;
+
+    /**
+     * @brief Reader slot holding the epoch a reader pinned, IDLE if free
+     */
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch{IDLE};
+    };
+
+    /**
+     * @brief A version and the pages it alone references, freed together
+     */
+    struct Retired
+    {
+        uint64_t epoch;
+        Version* version;
+        std::vector<char*> pages;
+    };
+
+    const size_t sz;
+    const utils::BucketIndex index;
+    uint32_t seed_0;
+    uint32_t seed_1;
+    mutable I instr;
+
+    // reader side
+    std::atomic<Version*> current;
+    std::atomic<uint64_t> epoch{1};     // pinned epochs are offset by one so that 0 means idle
+    mutable Slot slots[MAX_READERS];
+
+    // writer side
+    std::vector<char*> pages;           // latest pages, private where !shared
+    std::vector<uint8_t> shared;        // page is still referenced by the current version
+    std::vector<char*> replaced;        // current version pages copied since the last publish
+    std::vector<Retired> retired;
+
+    static char* alloc_page()
+    {
+        return (char*)std::aligned_alloc(64, PAGE_BYTES);
+    }
+
+    /**
+     * @brief Claims a reader slot and announces the current epoch in it
+     * An announced epoch blocks the reclamation of everything retired at or
+     * after it, so the version loaded afterwards stays valid.
+     */
+    size_t pin() const
+    {
+        size_t start = utils::thread_slot();
+        for (size_t i = 0;; ++i)
+        {
+            size_t s = (start + i) % MAX_READERS;
+            uint64_t idle = IDLE;
+            uint64_t e = epoch.load(std::memory_order_seq_cst);
+            if (slots[s].epoch.load(std::memory_order_relaxed) == IDLE
+                && slots[s].epoch.compare_exchange_strong(idle, e, std::memory_order_seq_cst))
+            {
+                return s;
+            }
+            if (i % MAX_READERS == MAX_READERS - 1)
+            {
+                _mm_pause();
+            }
+        }
+    }
+
+    void unpin(size_t slot) const
+    {
+        slots[slot].epoch.store(IDLE, std::memory_order_release);
+    }
+
+    /**
+     * @brief Frees retired versions that no pinned reader can reach
+     * A reader pinned at epoch e may hold any version retired at e - 1 or later.
+     */
+    void reclaim()
+    {
+        uint64_t min = std::numeric_limits<uint64_t>::max();
+        for (const auto& it : slots)
+        {
+            uint64_t e = it.epoch.load(std::memory_order_seq_cst);
+            if (e != IDLE)
+            {
+                min = std::min(min, e);
+            }
+        }
+        size_t n = 0;
+        while (n < retired.size() && retired[n].epoch + 1 < min)
+        {
+            release(retired[n]);
+            ++n;
+        }
+        retired.erase(retired.begin(), retired.begin() + n);
+    }
+
+    static void release(Retired& r)
+    {
+        for (auto it : r.pages)
+        {
+            std::free(it);
+        }
+        delete r.version;
+    }
+
+    /**
+     * @brief Bucket idx in a private page, copying the page on its first write after a publish
+     */
+    char* writable(size_t idx)
+    {
+        size_t p = idx / PAGE_BUCKETS;
+        if (shared[p])
+        {
+            char* copy = alloc_page();
+            std::memcpy(copy, pages[p], PAGE_BYTES);
+            replaced.push_back(pages[p]);
+            pages[p] = copy;
+            shared[p] = 0;
+        }
+        return pages[p] + idx % PAGE_BUCKETS * 64;
+    }
+
+    void update(char* b, uint32_t h)
+    {
+        __m512i bucket_vec = _mm512_load_epi32(b);
+        if constexpr (I::ENABLED)
+        {
+            int n = Base::overflow_lanes(bucket_vec, h);
+            if (n)
+            {
+                instr.overflow(n);
+            }
+        }
+        _mm512_store_epi32(b, Base::bundle(bucket_vec, h));
+    }
+
+    uint32_t hash(const K& key) const
+    {
+        uint32_t result;
+        MurmurHash3_x86_32(&key, sizeof(K), seed_0, &result);
+        return result;
+    }
+
+    /**
+     * @brief Projection word, as in HDSketchAVX512
+     */
+    uint32_t project(const K& key) const
+    {
+        return key.u32[0];
+    }
+};
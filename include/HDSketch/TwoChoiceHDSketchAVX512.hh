@@ -0,0 +1,264 @@
+#pragma once
+#include "HDSketchAVX512.hh"
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+
+/**
+ * @brief HDSketchAVX512 with two candidate buckets per key
+ * A key hashes to a pair of buckets in adjacent cache lines of one 128-byte
+ * block, so both are fetched together, and to one of 8 classes of the pair.
+ * The first insert of a class picks the lighter bucket, the one with the
+ * smaller squared norm, and records it in a tag; later inserts and all
+ * estimates of the class use the tagged bucket only, so every occurrence
+ * of a key lands in one bucket and an estimate reads one bucket. The tag
+ * takes lane 31 of the first bucket, whose keys use the other 31 lanes.
+ * @param K key type
+ * @param I instrumentation policy, see utils/Instrumentation.hh
+ */
+template<typename K, typename I = utils::NoInstrumentation>
+class TwoChoiceHDSketchAVX512
+{
+    protected:
+    using Base = HDSketchAVX512<K, I>;
+
+    public:
+    /**
+     * @param s number of buckets, rounded up to an even number
+     * @param gen seeds the hash functions
+     */
+    TwoChoiceHDSketchAVX512(size_t s, std::mt19937_64& gen) : pairs(std::max<size_t>(1, (s + 1) / 2)), index(pairs)
+    {
+        buckets = (char*)std::aligned_alloc(128, pairs * 128);
+        std::memset(buckets, 0, pairs * 128);
+        std::uniform_int_distribution<uint32_t> dist(0, std::numeric_limits<uint32_t>::max());
+        seed_0 = dist(gen);
+        seed_1 = dist(gen);
+    }
+
+    TwoChoiceHDSketchAVX512(const TwoChoiceHDSketchAVX512&) = delete;
+    TwoChoiceHDSketchAVX512& operator=(const TwoChoiceHDSketchAVX512&) = delete;
+
+    ~TwoChoiceHDSketchAVX512()
+    {
+        std::free(buckets);
+        buckets = nullptr;
+    }
+
+    /**
+     * @brief Estimates the number of occurence of given key
+     * @param key the query key
+     * @return the estimated value
+     */
+    double estimate(const K& key) const
+    {
+        auto t = instr.start(utils::Op::Estimate);
+        uint32_t hv = hash(key);
+        double result = estimate_at(index(hv), hv, project(key));
+        instr.finish(utils::Op::Estimate, t);
+        return result;
+    }
+
+    /**
+     * @brief Inserts the key into the bucket tagged for its class
+     * @param key the key
+     */
+    void insert(const K& key)
+    {
+        auto t = instr.start(utils::Op::Insert);
+        uint32_t hv = hash(key);
+        insert_at(index(hv), hv, project(key));
+        instr.finish(utils::Op::Insert, t);
+    }
+
+    /**
+     * @brief Estimates a batch of keys, prefetching all pairs first
+     * @param keys the query keys
+     * @param n number of keys
+     * @param out n estimates
+     */
+    void estimate_batch(const K* keys, size_t n, double* out) const
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Estimate, m);
+            uint32_t hv[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                hv[j] = hash(keys[base + j]);
+                prefetch(index(hv[j]), 0);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                out[base + j] = estimate_at(index(hv[j]), hv[j], project(keys[base + j]));
+            }
+            instr.finish(utils::Op::Estimate, t, m);
+        }
+    }
+
+    /**
+     * @brief Inserts a batch of keys, prefetching all pairs first
+     * @param keys the keys
+     * @param n number of keys
+     */
+    void insert_batch(const K* keys, size_t n)
+    {
+        for (size_t base = 0; base < n; base += BATCH)
+        {
+            size_t m = std::min(BATCH, n - base);
+            auto t = instr.start(utils::Op::Insert, m);
+            uint32_t hv[BATCH];
+            for (size_t j = 0; j < m; ++j)
+            {
+                hv[j] = hash(keys[base + j]);
+                prefetch(index(hv[j]), 1);
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                insert_at(index(hv[j]), hv[j], project(keys[base + j]));
+            }
+            instr.finish(utils::Op::Insert, t, m);
+        }
+    }
+
+    /**
+     * @brief Memory used by the buckets in bytes
+     */
+    size_t bytes() const
+    {
+        return pairs * 128;
+    }
+
+    const I& instrumentation() const { return instr; }
+
+    protected:
+    static constexpr size_t BATCH = Base::BATCH;
+
+    const size_t pairs;
+    const utils::BucketIndex index;
+    char* buckets;
+    uint32_t seed_0;
+    uint32_t seed_1;
+    mutable I instr;
+
+    static constexpr __mmask32 FIRST_LANES = 0x7FFFFFFF;    // lanes of the first bucket; lane 31 is the tag
+
+    /**
+     * @brief Squared norm of the given lanes of a bucket, up to 32 * 2^30
+     */
+    static int64_t norm(__m512i v, __mmask32 lanes)
+    {
+        v = _mm512_maskz_mov_epi16(lanes, v);
+        __m512i sq = _mm512_madd_epi16(v, v);
+        __m512i lo = _mm512_and_si512(sq, _mm512_set1_epi64(0xFFFFFFFF));
+        return _mm512_reduce_add_epi64(_mm512_add_epi64(lo, _mm512_srli_epi64(sq, 32)));
+    }
+
+    static int dot(__m512i v, __mmask32 h, __mmask32 lanes)
+    {
+        __m512i sign = _mm512_mask_blend_epi16(h, _mm512_set1_epi16(-1), _mm512_set1_epi16(1));
+        return _mm512_reduce_add_epi32(_mm512_madd_epi16(v, _mm512_maskz_mov_epi16(lanes, sign)));
+    }
+
+    /**
+     * @brief Tag bit of the class that the key hash selects
+     * Bits 0-7 mark the classes placed so far, bits 8-15 those placed in
+     * the second bucket.
+     */
+    static uint16_t tag_bit(uint32_t hv)
+    {
+        return (uint16_t)(1U << (hv >> 29U));
+    }
+
+    double estimate_at(size_t pair, uint32_t hv, uint32_t h) const
+    {
+        const char* p = buckets + pair * 128;
+        uint16_t tag;
+        std::memcpy(&tag, p + 62, sizeof(tag));
+        uint16_t bit = tag_bit(hv);
+        // selected without branches, which the random placement would mispredict
+        bool second = tag & (bit << 8U);
+        __mmask32 lanes = second ? ~0U : FIRST_LANES;
+        double d = dot(_mm512_load_epi32(p + 64 * second), h, lanes);
+        // a class with no key inserted yet estimates 0
+        return (tag & bit) ? d / (31 + second) : 0;
+    }
+
+    void insert_at(size_t pair, uint32_t hv, uint32_t h)
+    {
+        char* p = buckets + pair * 128;
+        uint16_t tag;
+        std::memcpy(&tag, p + 62, sizeof(tag));
+        uint16_t bit = tag_bit(hv);
+        bool second = tag & (bit << 8U);
+        bool placed = tag & bit;
+        if (!placed)
+        {
+            // ties, mostly between empty buckets, are broken by a projection bit
+            int64_t na = norm(_mm512_load_epi32(p), FIRST_LANES);
+            int64_t nb = norm(_mm512_load_epi32(p + 64), ~0U);
+            second = nb < na || (na == nb && (h >> 31U));
+            tag |= bit | (second ? bit << 8U : 0);
+        }
+        char* dst = p + 64 * second;
+        __mmask32 lanes = second ? ~0U : FIRST_LANES;
+        __m512i v = _mm512_load_epi32(dst);
+        if constexpr (I::ENABLED)
+        {
+            // the zeroed tag lane cannot wrap around
+            int n = Base::overflow_lanes(_mm512_maskz_mov_epi16(lanes, v), h);
+            if (n)
+            {
+                instr.overflow(n);
+            }
+        }
+        __m512i w = _mm512_set1_epi16(1);
+        v = _mm512_mask_add_epi16(v, h & lanes, v, w);
+        v = _mm512_mask_sub_epi16(v, ~h & lanes, v, w);
+        // the tag goes out with the first bucket in one store; a narrow store
+        // next to it would stall the next wide load of the pair
+        if (!second)
+        {
+            v = _mm512_mask_set1_epi16(v, ~FIRST_LANES, (short)tag);
+        }
+        else if (!placed)
+        {
+            std::memcpy(p + 62, &tag, sizeof(tag));
+        }
+        _mm512_store_epi32(dst, v);
+    }
+
+    void prefetch(size_t pair, int rw) const
+    {
+        const char* p = buckets + pair * 128;
+        if (rw)
+        {
+            __builtin_prefetch(p, 1);
+            __builtin_prefetch(p + 64, 1);
+        }
+        else
+        {
+            __builtin_prefetch(p);
+            __builtin_prefetch(p + 64);
+        }
+    }
+
+    uint32_t hash(const K& key) const
+    {
+        uint32_t result;
+        MurmurHash3_x86_32(&key, sizeof(K), seed_0, &result);
+        return result;
+    }
+
+    /**
+     * @brief Projection word, as in HDSketchAVX512
+     */
+    uint32_t project(const K& key) const
+    {
+        return key.u32[0];
+    }
+};
@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace bench
+{
+    /**
+     * @brief Errors of the keys whose true count lies in [lo, hi]
+     */
+    struct Stratum
+    {
+        uint64_t lo = 0;
+        uint64_t hi = 0;
+        size_t count = 0;
+        double mse = 0;
+        double mae = 0;
+        double mre = 0;     // mean of |err| / truth
+        double bias = 0;    // mean of estimate - truth
+    };
+
+    /**
+     * @brief Error distribution of a sketch against exact counts
+     */
+    struct ErrorStats
+    {
+        size_t count = 0;
+        double mse = 0;
+        double mae = 0;
+        double mre = 0;
+        double bias = 0;
+        double max_abs = 0;
+        // percentiles of |err|
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+        double p999 = 0;
+        // by true count, power-of-two wide: [1], [2, 3], [4, 7], ...
+        std::vector<Stratum> strata;
+    };
+
+    /**
+     * @brief Collects the errors of one partition of the keys
+     */
+    class ErrorAccumulator
+    {
+        public:
+        void add(double estimate, uint64_t truth)
+        {
+            double err = estimate - (double)truth;
+            double abs_err = err < 0 ? -err : err;
+            double rel = truth == 0 ? 0 : abs_err / truth;
+            size_t s = 63 - __builtin_clzll(truth | 1U);
+
+            total.add(err, abs_err, rel);
+            strata[s].add(err, abs_err, rel);
+            abs_errors.push_back((float)abs_err);
+        }
+
+        /**
+         * @brief Moves the errors of other into this accumulator
+         */
+        void merge(ErrorAccumulator& other);
+
+        /**
+         * @brief Computes the summary; reorders the collected errors
+         */
+        ErrorStats finish();
+
+        protected:
+        static constexpr size_t STRATA = 64;
+
+        struct Sums
+        {
+            size_t count = 0;
+            double square = 0;
+            double abs = 0;
+            double rel = 0;
+            double sum = 0;
+
+            void add(double err, double abs_err, double rel_err)
+            {
+                ++count;
+                square += err * err;
+                abs += abs_err;
+                rel += rel_err;
+                sum += err;
+            }
+
+            void merge(const Sums& other)
+            {
+                count += other.count;
+                square += other.square;
+                abs += other.abs;
+                rel += other.rel;
+                sum += other.sum;
+            }
+        };
+
+        Sums total;
+        Sums strata[STRATA];
+        std::vector<float> abs_errors;
+    };
+
+    /**
+     * @brief Evaluates a sketch against an exact table in parallel
+     * The slots of the table are split into one contiguous range per thread;
+     * each thread gathers its keys into chunks and estimates them in batches.
+     * @param truth exact counts, a utils::FlatHashMap
+     * @param estimate_batch callable(const K* keys, size_t n, double* out), safe to call concurrently
+     * @param threads number of worker threads
+     */
+    template <typename Map, typename F>
+    ErrorStats evaluate(const Map& truth, F estimate_batch, size_t threads)
+    {
+        using Key = typename Map::key_type;
+        constexpr size_t CHUNK = 256;
+
+        threads = std::max<size_t>(1, threads);
+        std::vector<ErrorAccumulator> acc(threads);
+        size_t slice = (truth.capacity() + threads - 1) / threads;
+
+        auto work = [&](size_t t)
+        {
+            size_t begin = std::min(truth.capacity(), t * slice);
+            size_t end = std::min(truth.capacity(), begin + slice);
+            Key keys[CHUNK];
+            uint64_t counts[CHUNK];
+            double out[CHUNK];
+            size_t m = 0;
+
+            auto flush = [&]()
+            {
+                estimate_batch(keys, m, out);
+                for (size_t i = 0; i < m; ++i)
+                {
+                    acc[t].add(out[i], counts[i]);
+                }
+                m = 0;
+            };
+
+            truth.for_each_in(begin, end, [&](const Key& key, uint64_t count)
+            {
+                keys[m] = key;
+                counts[m] = count;
+                if (++m == CHUNK)
+                {
+                    flush();
+                }
+            });
+            if (m)
+            {
+                flush();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; ++t)
+        {
+            workers.emplace_back(work, t);
+        }
+        work(0);
+        for (auto& it : workers)
+        {
+            it.join();
+        }
+
+        for (size_t t = 1; t < threads; ++t)
+        {
+            acc[0].merge(acc[t]);
+        }
+        return acc[0].finish();
+    }
+}
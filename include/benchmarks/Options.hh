@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    /**
+     * @brief One point of the parameter sweep
+     */
+    struct Config
+    {
+        std::string sketch;
+        size_t dim;             // HD dimensions, 0 if not applicable
+        size_t lanes;           // nonzero lanes of a sparse HD projection, 0 if dense or not applicable
+        size_t rows;            // rows of row-based sketches, 0 if not applicable
+        double load_factor;     // keys per 64-byte bucket of the 32-dim HD baseline
+        size_t keys;            // number of stream keys inserted
+        size_t threads;         // query threads
+        size_t batch;           // keys per insert/estimate call
+        size_t cache;           // entries of the exact front cache, 0 = none
+        size_t prefilter;       // singleton filter bits per stream key, 0 = none
+    };
+
+    /**
+     * @brief Command line options of the benchmark suite
+     */
+    struct Options
+    {
+        std::string fasta;
+        std::string workload;   // synthetic workload spec, used instead of fasta
+        std::vector<std::string> sketches = {"hd", "hd-avx512", "cms", "count-sketch"};
+        std::vector<size_t> dims = {32};
+        std::vector<size_t> lanes = {0};
+        std::vector<size_t> rows = {1, 2, 4, 8};
+        std::vector<double> load_factors = {1.0};
+        std::vector<size_t> keys = {0};
+        std::vector<size_t> threads = {1};
+        std::vector<size_t> batches = {1};
+        std::vector<size_t> caches = {0};
+        std::vector<size_t> prefilters = {0};
+        size_t sample = 0;          // syncmer window of FASTA input, 0 = every k-mer
+        size_t warmup = 1;
+        size_t reps = 3;
+        size_t eval_threads = 0;    // accuracy evaluation threads, 0 = all cores
+        bool instrument = false;    // build sketches with SampledInstrumentation
+        std::string format = "text";
+        std::string output;
+        unsigned long seed = 0;
+
+        /**
+         * @brief Parses argv; throws std::invalid_argument on bad input
+         */
+        static Options parse(int argc, char** argv);
+
+        static std::string usage(const char* prog);
+
+        /**
+         * @brief Expands the sweep into individual configurations
+         * Parameters that do not apply to a sketch are not swept for it.
+         * @param total_keys number of keys available from the input
+         */
+        std::vector<Config> expand(size_t total_keys) const;
+    };
+
+    /**
+     * @brief Whether the sketch is parameterized by HD dimensions
+     */
+    bool uses_dim(const std::string& sketch);
+
+    /**
+     * @brief Whether the sketch has a sparse projection mode
+     */
+    bool uses_lanes(const std::string& sketch);
+
+    /**
+     * @brief Whether the sketch is parameterized by rows
+     */
+    bool uses_rows(const std::string& sketch);
+}
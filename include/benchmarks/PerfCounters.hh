@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    /**
+     * @brief Hardware events counted around each benchmark phase
+     */
+    enum PerfEvent : size_t
+    {
+        CYCLES = 0,
+        INSTRUCTIONS,
+        LLC_MISSES,
+        DTLB_MISSES,
+        BRANCH_MISSES,
+        PERF_EVENTS
+    };
+
+    /**
+     * @brief Short name of an event, used as report key
+     */
+    const char* perf_event_name(size_t e);
+
+    /**
+     * @brief Event counts of one measured region
+     */
+    struct PerfSample
+    {
+        double counts[PERF_EVENTS] = {};
+        bool valid[PERF_EVENTS] = {};
+    };
+
+    /**
+     * @brief Hardware counters of one phase, normalized per operation and
+     * averaged over the recorded repetitions
+     */
+    struct PerfStats
+    {
+        double per_op[PERF_EVENTS] = {};
+        bool valid[PERF_EVENTS] = {};
+
+        /**
+         * @param ops operations per repetition
+         * @param samples counts of each repetition
+         */
+        static PerfStats of(size_t ops, const std::vector<PerfSample>& samples);
+
+        /**
+         * @brief Instructions per cycle, 0 if either counter is unavailable
+         */
+        double ipc() const;
+    };
+
+    /**
+     * @brief User-space hardware counters of this process via perf_event_open
+     * Counters are inherited by threads created after construction, so query
+     * threads are included once they are joined. Events the kernel or CPU
+     * does not provide are left invalid; everything else keeps working.
+     */
+    class PerfCounters
+    {
+        public:
+        PerfCounters();
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        /**
+         * @brief Whether at least one event could be opened
+         */
+        bool available() const;
+
+        /**
+         * @brief Reason the first unavailable event failed to open, empty if all opened
+         */
+        const std::string& error() const { return err; }
+
+        /**
+         * @brief Resets and enables all counters
+         */
+        void start();
+
+        /**
+         * @brief Disables the counters and reads them, scaled for multiplexing
+         */
+        PerfSample stop();
+
+        protected:
+        int fd[PERF_EVENTS];
+        std::string err;
+    };
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "Evaluator.hh"
+#include "Options.hh"
+#include "PerfCounters.hh"
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    /**
+     * @brief Mean and 95% confidence interval of repeated measurements
+     */
+    struct Summary
+    {
+        double mean = 0;
+        double stddev = 0;
+        double ci95 = 0;    // half width, Student's t
+
+        static Summary of(const std::vector<double>& samples);
+    };
+
+    /**
+     * @brief Timing of one benchmark phase over all recorded repetitions
+     */
+    struct PhaseStats
+    {
+        size_t ops = 0;         // operations per repetition
+        Summary ns_per_op;
+        Summary ops_per_sec;
+
+        /**
+         * @param ops operations per repetition
+         * @param seconds wall-clock time of each repetition
+         */
+        static PhaseStats of(size_t ops, const std::vector<double>& seconds);
+    };
+
+    /**
+     * @brief Measurements of one configuration
+     */
+    struct Result
+    {
+        Config config;
+        size_t distinct_keys = 0;
+        size_t bytes = 0;
+        ErrorStats errors;
+        PhaseStats insert;
+        PhaseStats query;
+        PerfStats insert_perf;
+        PerfStats query_perf;
+        std::string instrumentation;    // JSON snapshot of the last repetition, empty if disabled
+
+        double bytes_per_key() const
+        {
+            return distinct_keys == 0 ? 0 : (double)bytes / distinct_keys;
+        }
+    };
+
+    /**
+     * @brief Writes results as an aligned table, CSV or JSON
+     */
+    void write_results(std::ostream& os, const std::string& format, const std::vector<Result>& results);
+}
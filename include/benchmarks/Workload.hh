@@ -0,0 +1,122 @@
+#pragma once
+#include "utils/fasta.hh"
+#include "utils/utils.hh"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench
+{
+    /**
+     * @brief Walker/Vose alias table for O(1) sampling of a discrete distribution
+     */
+    class AliasTable
+    {
+        public:
+        AliasTable() {}
+
+        /**
+         * @param weights non-negative, not all zero
+         */
+        AliasTable(const std::vector<double>& weights);
+
+        /**
+         * @brief Maps a uniform 64-bit word to an outcome
+         */
+        uint32_t sample(uint64_t r) const
+        {
+            uint32_t i = ((r >> 32U) * prob.size()) >> 32U;
+            return (uint32_t)r < prob[i] ? i : alias[i];
+        }
+
+        size_t size() const { return prob.size(); }
+
+        protected:
+        std::vector<uint32_t> prob;     // acceptance threshold scaled to 2^32
+        std::vector<uint32_t> alias;
+    };
+
+    /**
+     * @brief Synthetic key stream with controlled skew
+     * Spec strings are "<kind>:name=value,...":
+     *   uniform:keys=N,ops=M
+     *   zipf:alpha=A,keys=N,ops=M
+     *   hotset:hot=H,frac=F,keys=N,ops=M    F of the operations hit H hot keys
+     *   collide:group=G,keys=N,ops=M        uniform over groups of G keys that share
+     *                                       the 32-bit signature of ModuloCountMinSketch
+     *                                       and the projection word of HDSketchAVX512
+     * plus an optional seed=S (default 1).
+     */
+    class Workload
+    {
+        public:
+        /**
+         * @brief Generates the stream; throws std::invalid_argument on a bad spec
+         */
+        Workload(const std::string& spec);
+
+        size_t size() const { return stream.size(); }
+
+        size_t distinct() const { return pool.size(); }
+
+        const Compressed128Mer& key(size_t i) const { return pool[stream[i]]; }
+
+        /**
+         * @brief Index into the key pool of the i-th stream element
+         */
+        uint32_t key_index(size_t i) const { return stream[i]; }
+
+        const std::vector<Compressed128Mer>& keys() const { return pool; }
+
+        const std::string& description() const { return spec; }
+
+        protected:
+        std::string spec;
+        std::vector<Compressed128Mer> pool;
+        std::vector<uint32_t> stream;
+
+        void make_random_pool(size_t n, uint64_t seed);
+        void make_colliding_pool(size_t n, size_t group, uint64_t seed);
+    };
+
+    /**
+     * @brief The key stream of a benchmark run: the 128-mers of a FASTA file or a synthetic workload
+     */
+    class KeySource
+    {
+        public:
+        KeySource(const Fasta& f) : fa(&f), wl(nullptr), sampled(false) {}
+        KeySource(const Workload& w) : fa(nullptr), wl(&w), sampled(false) {}
+
+        /**
+         * @brief Only the 128-mers starting at the given offsets, e.g. the syncmers of utils/Syncmer.hh
+         */
+        KeySource(const Fasta& f, std::vector<uint32_t> offsets)
+            : fa(&f), wl(nullptr), sampled(true), positions(std::move(offsets)) {}
+
+        size_t size() const
+        {
+            if (sampled)
+                return positions.size();
+            return wl ? wl->size() : (fa->size() < 128 ? 0 : fa->size() - 127);
+        }
+
+        void read(size_t i, Compressed128Mer& out) const
+        {
+            if (wl)
+                out = wl->key(i);
+            else
+                fa->Read128Mer(sampled ? positions[i] : i, out);
+        }
+
+        const Workload* workload() const { return wl; }
+
+        protected:
+        const Fasta* fa;
+        const Workload* wl;
+        bool sampled;
+        std::vector<uint32_t> positions;
+    };
+}
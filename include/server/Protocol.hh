@@ -0,0 +1,110 @@
+#pragma once
+#include "utils/utils.hh"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief Wire protocol of the sketch server
+ * A request is a RequestHeader followed by count keys (Compressed128Mer, 32
+ * bytes each); the response is count estimates as doubles, in order. A client
+ * may pipeline any number of requests on one connection.
+ */
+namespace server
+{
+    static constexpr uint32_t REQUEST_MAGIC = 0x48445351;   // "HDSQ"
+    static constexpr uint32_t MAX_KEYS_PER_REQUEST = 1U << 16U;
+
+    struct RequestHeader
+    {
+        uint32_t magic;
+        uint32_t count;
+    };
+
+    /**
+     * @brief Fills a sockaddr_un; throws std::invalid_argument if the path is too long
+     */
+    inline sockaddr_un unix_address(const std::string& path)
+    {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::invalid_argument("socket path too long: " + path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        return addr;
+    }
+
+    /**
+     * @brief Connects to a server; throws std::runtime_error on failure
+     */
+    inline int connect_unix(const std::string& path)
+    {
+        sockaddr_un addr = unix_address(path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            std::string err = std::strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            throw std::runtime_error("cannot connect to " + path + ": " + err);
+        }
+        return fd;
+    }
+
+    /**
+     * @brief Blocking write of n bytes
+     */
+    inline bool write_full(int fd, const void* buf, size_t n)
+    {
+        const char* p = (const char*)buf;
+        while (n > 0)
+        {
+            ssize_t r = write(fd, p, n);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            p += r;
+            n -= r;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Blocking read of n bytes
+     */
+    inline bool read_full(int fd, void* buf, size_t n)
+    {
+        char* p = (char*)buf;
+        while (n > 0)
+        {
+            ssize_t r = read(fd, p, n);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            p += r;
+            n -= r;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Sends one request and waits for its estimates
+     * @return false if the connection failed
+     */
+    inline bool estimate(int fd, const utils::Compressed128Mer* keys, uint32_t n, double* out)
+    {
+        RequestHeader h = {REQUEST_MAGIC, n};
+        return write_full(fd, &h, sizeof(h))
+            && write_full(fd, keys, n * sizeof(utils::Compressed128Mer))
+            && read_full(fd, out, n * sizeof(double));
+    }
+}
@@ -0,0 +1,508 @@
+#pragma once
+#include "utils/random.hh"
+#include "utils/utils.hh"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <immintrin.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief Sketches split by key hash over processes on one machine
+ * The front end routes every key to the shard that owns its hash range and
+ * passes keys and estimates through single-producer single-consumer rings
+ * in shared memory, in slots of SHARD_BATCH keys, so a shard sees the same
+ * batched inserts and queries as an in-process sketch. Each shard is an
+ * independent sketch of its keys, sized by the caller, usually the total
+ * divided by the number of shards; it is allocated after the fork, so its
+ * pages land on the memory node of the CPU the shard runs on.
+ */
+namespace server
+{
+    static constexpr size_t SHARD_BATCH = 256;
+    static constexpr uint32_t RING_SLOTS = 64;
+
+    /**
+     * @brief Sleeps while word holds seen, at most timeout
+     */
+    inline void futex_wait(std::atomic<uint32_t>& word, uint32_t seen, const timespec* timeout)
+    {
+        syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT, seen, timeout, nullptr, 0);
+    }
+
+    inline void futex_wake(std::atomic<uint32_t>& word)
+    {
+        syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    /**
+     * @brief Ring of RING_SLOTS messages between two processes, placed in shared memory
+     * Slots are filled and read in place. A side that finds the ring full or
+     * empty spins briefly, then sleeps on a futex until the other side moves
+     * its counter. Waiting on a closed ring, or for a peer process that has
+     * exited, throws std::runtime_error.
+     */
+    template<typename T>
+    class ShmRing
+    {
+        public:
+        ShmRing() : head(0), consumer_waiting(0), tail(0), producer_waiting(0), closed(0) {}
+
+        /**
+         * @brief The next free slot; waits while the ring is full
+         * @param peer child process that consumes the ring, 0 for none
+         */
+        T& acquire(pid_t peer = 0)
+        {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            wait(tail, producer_waiting, peer, [&]() { return h - tail.load(std::memory_order_acquire) < RING_SLOTS; });
+            return slots[h % RING_SLOTS];
+        }
+
+        /**
+         * @brief Hands the acquired slot to the consumer
+         */
+        void publish()
+        {
+            head.fetch_add(1);
+            if (consumer_waiting.load())
+                futex_wake(head);
+        }
+
+        /**
+         * @brief The oldest published slot; waits while the ring is empty
+         * @param peer child process that produces the ring, 0 for none
+         */
+        const T& front(pid_t peer = 0)
+        {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            wait(head, consumer_waiting, peer, [&]() { return head.load(std::memory_order_acquire) != t; });
+            return slots[t % RING_SLOTS];
+        }
+
+        /**
+         * @brief Returns the front slot to the producer
+         */
+        void release()
+        {
+            tail.fetch_add(1);
+            if (producer_waiting.load())
+                futex_wake(tail);
+        }
+
+        /**
+         * @brief Fails the waits of both sides, e.g. when one of them gives up
+         */
+        void close()
+        {
+            closed.store(1);
+            futex_wake(head);
+            futex_wake(tail);
+        }
+
+        protected:
+        alignas(64) std::atomic<uint32_t> head;
+        std::atomic<uint32_t> consumer_waiting;
+        alignas(64) std::atomic<uint32_t> tail;
+        std::atomic<uint32_t> producer_waiting;
+        std::atomic<uint32_t> closed;
+        alignas(64) T slots[RING_SLOTS];
+
+        /**
+         * @brief Waits until ready(); sleeps on the other side's counter
+         * The flag is set before the counter is read again, and the other
+         * side moves the counter before it reads the flag, so a wake-up is
+         * never lost. Sleeps are bounded so that a crashed peer, which
+         * cannot close the ring, is noticed.
+         */
+        template<typename F>
+        void wait(std::atomic<uint32_t>& counter, std::atomic<uint32_t>& waiting, pid_t peer, F ready)
+        {
+            static const timespec timeout = {0, 100000000};
+            for (int i = 0; i < 256; ++i)
+            {
+                if (ready())
+                    return;
+                _mm_pause();
+            }
+            while (true)
+            {
+                uint32_t seen = counter.load();
+                waiting.store(1);
+                if (ready())
+                    break;
+                if (closed.load() || (peer && exited(peer)))
+                {
+                    waiting.store(0);
+                    throw std::runtime_error("shard ring closed");
+                }
+                futex_wait(counter, seen, &timeout);
+            }
+            waiting.store(0);
+        }
+
+        /**
+         * @brief Whether a child has exited; leaves it to be reaped
+         */
+        static bool exited(pid_t pid)
+        {
+            siginfo_t info;
+            info.si_pid = 0;
+            return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid == pid;
+        }
+    };
+
+    enum class ShardOp : uint32_t
+    {
+        Insert,
+        Estimate,
+        Stop,
+    };
+
+    struct ShardRequest
+    {
+        ShardOp op;
+        uint32_t count;
+        utils::Compressed128Mer keys[SHARD_BATCH];
+    };
+
+    struct ShardResponse
+    {
+        uint32_t count;
+        double estimates[SHARD_BATCH];
+    };
+
+    /**
+     * @brief The two rings between the front end and one shard
+     */
+    struct ShardChannel
+    {
+        ShmRing<ShardRequest> requests;
+        ShmRing<ShardResponse> responses;
+
+        void close()
+        {
+            requests.close();
+            responses.close();
+        }
+    };
+
+    /**
+     * @brief Runs a shard: applies requests to the sketch until Stop
+     * Estimates answer in request order, on the response ring.
+     */
+    template<typename S>
+    void serve_shard(S& sketch, ShardChannel& channel)
+    {
+        using E = decltype(sketch.estimate(std::declval<const utils::Compressed128Mer&>()));
+        E buf[SHARD_BATCH];
+        while (true)
+        {
+            const ShardRequest& r = channel.requests.front();
+            if (r.op == ShardOp::Stop)
+            {
+                channel.requests.release();
+                return;
+            }
+            if (r.op == ShardOp::Insert)
+            {
+                sketch.insert_batch(r.keys, r.count);
+            }
+            else
+            {
+                ShardResponse& out = channel.responses.acquire();
+                out.count = r.count;
+                if constexpr (std::is_same<E, double>::value)
+                {
+                    sketch.estimate_batch(r.keys, r.count, out.estimates);
+                }
+                else
+                {
+                    sketch.estimate_batch(r.keys, r.count, buf);
+                    std::copy(buf, buf + r.count, out.estimates);
+                }
+                channel.responses.publish();
+            }
+            channel.requests.release();
+        }
+    }
+
+    /**
+     * @brief Front end of shards forked as local processes
+     * Inserts are buffered per shard and sent in full slots; flush() sends
+     * the rest. Estimates flush first, so they see every earlier insert.
+     * Not thread-safe: one front end thread drives all rings.
+     */
+    class ShardedSketch
+    {
+        public:
+        /**
+         * @brief Forks the shards; each runs worker(shard, channel) and exits
+         * The worker builds the shard's sketch and calls serve_shard.
+         * @param shards number of shard processes
+         * @param seed seeds the routing hash, independent of the sketches' hashes
+         * @param worker the shard's main function; an exception fails the shard
+         * and closes its rings, so the front end throws instead of waiting
+         * @param pin pins shard i to CPU i modulo the CPUs available
+         */
+        ShardedSketch(size_t shards, uint32_t seed, const std::function<void(size_t, ShardChannel&)>& worker, bool pin = false)
+            : n(shards), seed(seed), open(shards, nullptr), finished(false)
+        {
+            if (n == 0)
+                throw std::invalid_argument("at least one shard is required");
+            length = n * sizeof(ShardChannel);
+            void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                throw std::runtime_error(std::string("cannot map shard rings: ") + std::strerror(errno));
+            channels = (ShardChannel*)p;
+            for (size_t i = 0; i < n; ++i)
+            {
+                new (channels + i) ShardChannel();
+            }
+
+            cpu_set_t cpus;
+            sched_getaffinity(0, sizeof(cpus), &cpus);
+            for (size_t i = 0; i < n; ++i)
+            {
+                pid_t pid = fork();
+                if (pid < 0)
+                {
+                    stop(i);
+                    munmap(channels, length);
+                    throw std::runtime_error(std::string("cannot fork a shard: ") + std::strerror(errno));
+                }
+                if (pid == 0)
+                {
+                    prctl(PR_SET_PDEATHSIG, SIGKILL);
+                    if (pin)
+                        pin_to(cpus, i);
+                    int status = 0;
+                    try
+                    {
+                        worker(i, channels[i]);
+                    }
+                    catch (...)
+                    {
+                        channels[i].close();
+                        status = 1;
+                    }
+                    _exit(status);
+                }
+                pids.push_back(pid);
+            }
+        }
+
+        ShardedSketch(const ShardedSketch&) = delete;
+        ShardedSketch& operator=(const ShardedSketch&) = delete;
+
+        ~ShardedSketch()
+        {
+            if (!finished)
+                stop(n);
+            munmap(channels, length);
+        }
+
+        size_t shards() const { return n; }
+
+        /**
+         * @brief The shard that owns a key
+         * The front end hashes every key once more than an in-process sketch,
+         * so the routing hash is a SplitMix64 finalizer of the folded words
+         * rather than MurmurHash.
+         */
+        size_t owner(const utils::Compressed128Mer& key) const
+        {
+            uint64_t w[4];
+            std::memcpy(w, key.u32, sizeof(w));
+            uint64_t h = utils::splitmix64((w[0] ^ w[1] ^ w[2] ^ w[3]) + seed);
+            return (uint64_t)(((unsigned __int128)h * n) >> 64U);
+        }
+
+        /**
+         * @brief Routes a batch of keys to their shards; full slots are sent at once
+         */
+        void insert_batch(const utils::Compressed128Mer* keys, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                size_t s = owner(keys[i]);
+                ShardRequest& r = slot(s, ShardOp::Insert);
+                r.keys[r.count++] = keys[i];
+                if (r.count == SHARD_BATCH)
+                    send(s);
+            }
+        }
+
+        /**
+         * @brief Sends the partly filled slots of every shard
+         */
+        void flush()
+        {
+            for (size_t s = 0; s < n; ++s)
+            {
+                if (open[s])
+                    send(s);
+            }
+        }
+
+        /**
+         * @brief Estimates a batch of keys on their shards
+         * Keys go out in chunks that leave every shard at most half a
+         * response ring of answers, so neither side can block the other.
+         * @param keys the keys
+         * @param count number of keys
+         * @param out count estimates
+         */
+        void estimate_batch(const utils::Compressed128Mer* keys, size_t count, double* out)
+        {
+            static constexpr size_t CHUNK = RING_SLOTS / 2 * SHARD_BATCH;
+            flush();
+            routed.resize(n);
+            sent.resize(n);
+            for (size_t base = 0; base < count; base += CHUNK)
+            {
+                size_t m = std::min(CHUNK, count - base);
+                for (size_t s = 0; s < n; ++s)
+                {
+                    routed[s].clear();
+                    sent[s] = 0;
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    size_t s = owner(keys[base + j]);
+                    ShardRequest& r = slot(s, ShardOp::Estimate);
+                    r.keys[r.count++] = keys[base + j];
+                    routed[s].push_back(base + j);
+                    if (r.count == SHARD_BATCH)
+                    {
+                        send(s);
+                        ++sent[s];
+                    }
+                }
+                for (size_t s = 0; s < n; ++s)
+                {
+                    if (open[s])
+                    {
+                        send(s);
+                        ++sent[s];
+                    }
+                }
+                for (size_t s = 0; s < n; ++s)
+                {
+                    const size_t* dst = routed[s].data();
+                    for (size_t k = 0; k < sent[s]; ++k)
+                    {
+                        const ShardResponse& r = channels[s].responses.front(pids[s]);
+                        for (uint32_t j = 0; j < r.count; ++j)
+                        {
+                            out[*dst++] = r.estimates[j];
+                        }
+                        channels[s].responses.release();
+                    }
+                }
+            }
+        }
+
+        /**
+         * @brief Sends the buffered inserts, stops every shard and waits for it to exit
+         * Throws std::runtime_error if a shard failed.
+         */
+        void finish()
+        {
+            flush();
+            finished = true;
+            if (!stop(n))
+                throw std::runtime_error("a shard process failed");
+        }
+
+        protected:
+        size_t n;
+        uint32_t seed;
+        ShardChannel* channels;
+        size_t length;
+        std::vector<pid_t> pids;
+        std::vector<ShardRequest*> open;    // slot being filled, per shard
+        std::vector<std::vector<size_t>> routed;
+        std::vector<size_t> sent;
+        bool finished;
+
+        ShardRequest& slot(size_t s, ShardOp op)
+        {
+            if (open[s] && open[s]->op != op)
+                send(s);
+            if (!open[s])
+            {
+                open[s] = &channels[s].requests.acquire(pids[s]);
+                open[s]->op = op;
+                open[s]->count = 0;
+            }
+            return *open[s];
+        }
+
+        void send(size_t s)
+        {
+            channels[s].requests.publish();
+            open[s] = nullptr;
+        }
+
+        /**
+         * @brief Sends Stop to the first m shards and reaps them
+         * @return whether all of them exited cleanly
+         */
+        bool stop(size_t m)
+        {
+            for (size_t s = 0; s < m; ++s)
+            {
+                try
+                {
+                    slot(s, ShardOp::Stop);
+                    send(s);
+                }
+                catch (const std::runtime_error&)
+                {
+                    // the shard failed and is exiting anyway
+                }
+            }
+            bool ok = true;
+            for (size_t s = 0; s < m; ++s)
+            {
+                int status;
+                ok = waitpid(pids[s], &status, 0) == pids[s] && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+            }
+            return ok;
+        }
+
+        static void pin_to(const cpu_set_t& cpus, size_t i)
+        {
+            size_t count = CPU_COUNT(&cpus);
+            for (size_t c = 0, k = 0; c < CPU_SETSIZE; ++c)
+            {
+                if (CPU_ISSET(c, &cpus) && k++ == i % count)
+                {
+                    cpu_set_t one;
+                    CPU_ZERO(&one);
+                    CPU_SET(c, &one);
+                    sched_setaffinity(0, sizeof(one), &one);
+                    return;
+                }
+            }
+        }
+    };
+}
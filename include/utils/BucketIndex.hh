@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+    inline bool is_pow2(size_t n)
+    {
+        return n != 0 && (n & (n - 1)) == 0;
+    }
+
+    /**
+     * @brief Smallest power of two not less than n
+     */
+    inline size_t next_pow2(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+        {
+            p <<= 1U;
+        }
+        return p;
+    }
+
+    /**
+     * @brief Maps 32-bit hashes onto n buckets
+     * The bucket is always h % n, computed with a mask when n is a power of
+     * two. Since (h % n) % (n / 2) == h % (n / 2), a sketch with an even number
+     * of buckets can be folded in half by merging bucket i + n / 2 into bucket i.
+     */
+    class BucketIndex
+    {
+        public:
+        BucketIndex(size_t n) : n(n), mask(is_pow2(n) ? n - 1 : 0) {}
+
+        size_t operator()(uint32_t h) const
+        {
+            return mask ? h & mask : h % n;
+        }
+
+        size_t size() const { return n; }
+
+        protected:
+        size_t n;
+        size_t mask;    // n - 1 for powers of two above 1, else 0
+    };
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include "BucketIndex.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace utils
+{
+    /**
+     * @brief What is known about the data a sketch is sized for
+     */
+    struct CapacityTarget
+    {
+        double distinct;        // expected distinct keys
+        double total = 0;       // expected stream length, 0 = every key once
+        double f2 = 0;          // sum of squared counts, 0 = equal counts, total^2 / distinct
+        double error = 1;       // absolute error of an estimate, in counts
+        double delta = 0.01;    // probability of exceeding it
+
+        double stream() const { return total > 0 ? total : distinct; }
+
+        double second_moment() const { return f2 > 0 ? f2 : stream() * stream() / std::max(1.0, distinct); }
+    };
+
+    /**
+     * @brief Dimensions of a sketch meeting a CapacityTarget
+     */
+    struct CapacityPlan
+    {
+        std::string sketch;
+        size_t dim;             // HD dimensions, 0 if not applicable
+        size_t rows;            // rows of row-based sketches, 0 if not applicable
+        size_t width;           // buckets, or counters per row
+        size_t bytes;
+        double error;           // error bound the plan achieves at the same delta
+        bool overflow_risk;     // int16 lanes may wrap at this load
+    };
+
+    /**
+     * @brief z such that a standard normal exceeds |z| with probability delta
+     */
+    inline double two_sided_quantile(double delta)
+    {
+        double lo = 0, hi = 40;
+        for (int i = 0; i < 100; ++i)
+        {
+            double mid = (lo + hi) / 2;
+            (std::erfc(mid / std::sqrt(2.0)) > delta ? lo : hi) = mid;
+        }
+        return hi;
+    }
+
+    /**
+     * @brief Plans an HD sketch with int16 lanes
+     * An estimate is its count plus the sum of count * dot(h_key, h_other) / dim
+     * over the other keys of the bucket, so the noise is near normal with
+     * variance f2 / (buckets * dim). The memory, buckets * dim lanes, does not
+     * depend on dim; smaller dims touch fewer cache lines per operation.
+     * @param t the target
+     * @param dim dimensions per bucket
+     * @param pow2 round buckets up to a power of two so the sketch can be folded
+     */
+    inline CapacityPlan plan_hd(const CapacityTarget& t, size_t dim = 32, bool pow2 = true)
+    {
+        double z = two_sided_quantile(t.delta);
+        double f2 = t.second_moment();
+        double lanes = f2 * z * z / (t.error * t.error);
+        size_t buckets = std::max<size_t>(1, std::ceil(lanes / dim));
+        if (pow2)
+            buckets = next_pow2(buckets);
+
+        // a lane is a random walk of standard deviation sqrt(f2 / buckets)
+        bool risk = 6 * std::sqrt(f2 / buckets) > INT16_MAX;
+        return {dim == 32 ? "hd-avx512" : "hd", dim, 0, buckets, buckets * dim * 2,
+            z * std::sqrt(f2 / ((double)buckets * dim)), risk};
+    }
+
+    /**
+     * @brief Plans a Count-Min sketch with int16 counters
+     * A row overestimates by at most e * total / width with probability
+     * 1 - 1 / e, so ln(1 / delta) rows bound the minimum.
+     */
+    inline CapacityPlan plan_cms(const CapacityTarget& t)
+    {
+        double total = t.stream();
+        size_t rows = std::max(1.0, std::ceil(std::log(1 / t.delta)));
+        size_t width = std::max(1.0, std::ceil(std::exp(1.0) * total / t.error));
+        return {"cms", 0, rows, width, rows * width * 2, std::exp(1.0) * total / width,
+            total / width * 6 > INT16_MAX};
+    }
+
+    /**
+     * @brief Plans a Count sketch with int16 counters
+     * A row errs by more than sqrt(3 * f2 / width) with probability at most
+     * 1 / 3, and the median of the rows fails far less often. Rows are
+     * ln(1 / delta) rounded up to odd, the usual practical choice; the
+     * worst-case Chernoff bound asks for many more.
+     */
+    inline CapacityPlan plan_count_sketch(const CapacityTarget& t)
+    {
+        double f2 = t.second_moment();
+        size_t rows = std::max(1.0, std::ceil(std::log(1 / t.delta)));
+        rows |= 1U;
+        size_t width = std::max(1.0, std::ceil(3 * f2 / (t.error * t.error)));
+        return {"count-sketch", 0, rows, width, rows * width * 2, std::sqrt(3 * f2 / width),
+            6 * std::sqrt(f2 / width) > INT16_MAX};
+    }
+
+    /**
+     * @brief Plans the named sketch; throws std::invalid_argument for others
+     */
+    inline CapacityPlan plan(const std::string& sketch, const CapacityTarget& t)
+    {
+        if (t.distinct <= 0 || t.error <= 0 || t.delta <= 0 || t.delta >= 1)
+            throw std::invalid_argument("distinct keys and error must be positive and delta in (0, 1)");
+        if (sketch == "hd-avx512")
+            return plan_hd(t, 32);
+        if (sketch == "cms")
+            return plan_cms(t);
+        if (sketch == "count-sketch")
+            return plan_count_sketch(t);
+        throw std::invalid_argument("cannot plan " + sketch);
+    }
+
+    /**
+     * @brief Folds an HD sketch while it still meets the error target
+     * The second moment is measured from the sketch itself, so an
+     * over-provisioned sketch shrinks to what its data needs.
+     * @param sketch an HDSketch or HDSketchAVX512
+     * @param dim its dimensions
+     * @param error absolute error target, in counts
+     * @param delta probability of exceeding it
+     * @return number of folds
+     */
+    template <typename S>
+    size_t fold_to_fit(S& sketch, size_t dim, double error, double delta = 0.01)
+    {
+        CapacityTarget t;
+        t.distinct = 1;
+        t.f2 = std::max(1.0, sketch.second_moment());
+        t.error = error;
+        t.delta = delta;
+        size_t need = plan_hd(t, dim, false).width;
+
+        size_t folds = 0;
+        while (sketch.size() % 2 == 0 && sketch.size() / 2 >= need)
+        {
+            sketch.fold();
+            ++folds;
+        }
+        return folds;
+    }
+}
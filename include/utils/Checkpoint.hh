@@ -0,0 +1,441 @@
+#pragma once
+#include "MurmurHash.hh"
+#include "SketchFile.hh"
+#include "random.hh"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utils
+{
+    /**
+     * @brief Bitmap of the 4KB pages of a buffer written since it was last taken
+     * Marking a page is one OR; the writer owns the bitmap and takes it at
+     * checkpoints, on the same thread.
+     */
+    class DirtyPages
+    {
+        public:
+        static constexpr size_t PAGE = 4096;
+
+        /**
+         * @param bytes size of the tracked buffer
+         */
+        DirtyPages(size_t bytes) : count((bytes + PAGE - 1) / PAGE), bits((count + 63) / 64, 0) {}
+
+        /**
+         * @brief Marks the page holding byte offset as written
+         */
+        void mark(size_t offset)
+        {
+            size_t p = offset / PAGE;
+            bits[p / 64] |= 1ULL << (p % 64);
+        }
+
+        size_t pages() const { return count; }
+
+        /**
+         * @brief The written pages, ascending; clears the bitmap
+         */
+        std::vector<uint32_t> take()
+        {
+            std::vector<uint32_t> result;
+            for (size_t w = 0; w < bits.size(); ++w)
+            {
+                for (uint64_t m = bits[w]; m; m &= m - 1)
+                {
+                    result.push_back(w * 64 + __builtin_ctzll(m));
+                }
+                bits[w] = 0;
+            }
+            return result;
+        }
+
+        protected:
+        size_t count;
+        std::vector<uint64_t> bits;
+    };
+
+    /**
+     * @brief Header of one record of a delta log
+     * The header is followed by pages 32-bit page numbers, padded to 8
+     * bytes, then the pages, PAGE bytes each. A record without pages only
+     * carries a position.
+     */
+    struct DeltaHeader
+    {
+        static constexpr char MAGIC[8] = {'H', 'D', 'D', 'E', 'L', 'T', 'A', 'S'};
+
+        char magic[8];
+        uint64_t sequence;
+        uint64_t position;      // stream position the sketch had reached
+        uint64_t pages;
+        uint64_t checksum;      // of the fields above and the payload
+    };
+
+    /**
+     * @brief Checksum of a record: its header fields, page numbers and pages
+     */
+    inline uint64_t delta_checksum(const DeltaHeader& h, const uint32_t* numbers, const char* data)
+    {
+        uint64_t c = splitmix64(h.sequence ^ splitmix64(h.position ^ splitmix64(h.pages)));
+        uint64_t out[2];
+        if (h.pages)
+        {
+            MurmurHash3_x64_128(numbers, h.pages * sizeof(uint32_t), (uint32_t)c, out);
+            c = splitmix64(c ^ out[0]);
+        }
+        for (size_t i = 0; i < h.pages; ++i)
+        {
+            MurmurHash3_x64_128(data + i * DirtyPages::PAGE, DirtyPages::PAGE, (uint32_t)c, out);
+            c = splitmix64(c ^ out[0]);
+        }
+        return c;
+    }
+
+    inline std::string checkpoint_base(const std::string& dir) { return dir + "/base.sketch"; }
+
+    inline std::string checkpoint_log(const std::string& dir) { return dir + "/delta.log"; }
+
+    /**
+     * @brief Flushes a file, or a directory after a rename, to disk
+     */
+    inline void sync_path(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        bool ok = fd >= 0 && ::fsync(fd) == 0;
+        if (fd >= 0)
+            ::close(fd);
+        if (!ok)
+            throw std::runtime_error("cannot sync " + path + ": " + std::strerror(errno));
+    }
+
+    /**
+     * @brief Writes n bytes at offset; throws std::runtime_error on I/O errors
+     */
+    inline void pwrite_full(int fd, const void* buf, size_t n, off_t offset, const std::string& path)
+    {
+        const char* p = (const char*)buf;
+        while (n > 0)
+        {
+            ssize_t r = ::pwrite(fd, p, n, offset);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                throw std::runtime_error("cannot write " + path + ": " + std::strerror(errno));
+            p += r;
+            n -= r;
+            offset += r;
+        }
+    }
+
+    /**
+     * @brief Incremental, asynchronous checkpoints of a sketch for crash recovery
+     * The directory holds a base snapshot, a sketch file, and a log of deltas.
+     * Inserts mark the 4KB pages they write; checkpoint() copies only those
+     * pages and hands them to a background thread, which appends them to
+     * the log as one checksummed record and syncs it. The pages are then
+     * also written into the base in place, and once the log outgrows the
+     * sketch the base is synced and the log restarted with the position
+     * alone. A crash can tear the base but not a synced record, and records
+     * are whole pages, so replaying the log over the base is always exact.
+     * The sketch must provide data(), bytes(), save() and track(), and must
+     * not be resized while the writer lives.
+     * @param S the sketch
+     */
+    template<typename S>
+    class CheckpointWriter
+    {
+        public:
+        /**
+         * @brief Writes a new base snapshot and an empty log, then starts tracking
+         * @param sketch the sketch
+         * @param dir checkpoint directory, created if missing
+         * @param position stream position of the sketch's current state
+         */
+        CheckpointWriter(S& sketch, const std::string& dir, uint64_t position = 0)
+            : sketch(sketch), dir(dir), dirty(sketch.bytes()), sequence(0), completed(0), written(0), log_bytes(0),
+              log_fd(-1), base_fd(-1), busy(false), stop(false)
+        {
+            if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+                throw std::runtime_error("cannot create " + dir + ": " + std::strerror(errno));
+            std::string base = checkpoint_base(dir);
+            sketch.save(base + ".tmp");
+            sync_path(base + ".tmp");
+            if (std::rename((base + ".tmp").c_str(), base.c_str()) != 0)
+                throw std::runtime_error("cannot rename " + base + ": " + std::strerror(errno));
+            base_fd = ::open(base.c_str(), O_RDWR);
+            if (base_fd < 0)
+                throw std::runtime_error("cannot open " + base + ": " + std::strerror(errno));
+            SketchHeader h;
+            if (::pread(base_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+                throw std::runtime_error("cannot read " + base);
+            data_offset = h.data_offset;
+            restart_log(position);
+            sketch.track(&dirty);
+            worker = std::thread([this]() { run(); });
+        }
+
+        CheckpointWriter(const CheckpointWriter&) = delete;
+        CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+        /**
+         * @brief Finishes the queued checkpoint and stops tracking; write errors are dropped
+         */
+        ~CheckpointWriter()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [this]() { return !busy; });
+                stop = true;
+            }
+            ready.notify_one();
+            worker.join();
+            sketch.track(nullptr);
+            ::close(log_fd);
+            ::close(base_fd);
+        }
+
+        /**
+         * @brief Copies the pages written since the last checkpoint and queues them
+         * Waits for the previous checkpoint to be written first, and rethrows
+         * its error if it failed.
+         * @param position stream position the sketch has reached; recovery returns it
+         */
+        void checkpoint(uint64_t position)
+        {
+            wait();
+            Job& j = job;
+            j.numbers = dirty.take();
+            j.data.resize(j.numbers.size() * DirtyPages::PAGE);
+            const char* src = sketch.data();
+            size_t bytes = sketch.bytes();
+            for (size_t i = 0; i < j.numbers.size(); ++i)
+            {
+                size_t begin = (size_t)j.numbers[i] * DirtyPages::PAGE;
+                size_t n = std::min(DirtyPages::PAGE, bytes - begin);
+                std::memcpy(j.data.data() + i * DirtyPages::PAGE, src + begin, n);
+                std::memset(j.data.data() + i * DirtyPages::PAGE + n, 0, DirtyPages::PAGE - n);
+            }
+            j.position = position;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy = true;
+            }
+            ready.notify_one();
+        }
+
+        /**
+         * @brief Waits until the queued checkpoint is on disk; rethrows its error
+         */
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]() { return !busy; });
+            if (error)
+            {
+                std::exception_ptr e = error;
+                error = nullptr;
+                std::rethrow_exception(e);
+            }
+        }
+
+        /**
+         * @brief Checkpoints written so far
+         */
+        size_t checkpoints() const { return completed; }
+
+        /**
+         * @brief Page bytes written to the log so far
+         */
+        size_t bytes_written() const { return written; }
+
+        protected:
+        struct Job
+        {
+            uint64_t position;
+            std::vector<uint32_t> numbers;
+            std::vector<char> data;
+        };
+
+        S& sketch;
+        const std::string dir;
+        DirtyPages dirty;
+        Job job;
+        size_t sequence;
+        size_t completed;
+        size_t written;
+        size_t log_bytes;
+        size_t data_offset;
+        int log_fd;
+        int base_fd;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::condition_variable done;
+        bool busy;
+        bool stop;
+        std::exception_ptr error;
+
+        void run()
+        {
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this]() { return busy || stop; });
+                    if (!busy)
+                        return;
+                }
+                try
+                {
+                    write(job);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    error = std::current_exception();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy = false;
+                }
+                done.notify_all();
+            }
+        }
+
+        /**
+         * @brief Appends a record to the log and syncs it
+         */
+        void append(uint64_t position, const std::vector<uint32_t>& numbers, const char* data)
+        {
+            DeltaHeader h;
+            std::memcpy(h.magic, DeltaHeader::MAGIC, sizeof(h.magic));
+            h.sequence = ++sequence;
+            h.position = position;
+            h.pages = numbers.size();
+            h.checksum = delta_checksum(h, numbers.data(), data);
+            size_t index_bytes = (numbers.size() * sizeof(uint32_t) + 7) / 8 * 8;
+            std::vector<char> head(sizeof(h) + index_bytes, 0);
+            std::memcpy(head.data(), &h, sizeof(h));
+            std::memcpy(head.data() + sizeof(h), numbers.data(), numbers.size() * sizeof(uint32_t));
+            std::string path = checkpoint_log(dir);
+            pwrite_full(log_fd, head.data(), head.size(), log_bytes, path);
+            pwrite_full(log_fd, data, numbers.size() * DirtyPages::PAGE, log_bytes + head.size(), path);
+            if (::fdatasync(log_fd) != 0)
+                throw std::runtime_error("cannot sync " + path + ": " + std::strerror(errno));
+            log_bytes += head.size() + numbers.size() * DirtyPages::PAGE;
+        }
+
+        /**
+         * @brief Replaces the log by one that holds only the position
+         */
+        void restart_log(uint64_t position)
+        {
+            std::string path = checkpoint_log(dir);
+            int fd = ::open((path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw std::runtime_error("cannot create " + path + ": " + std::strerror(errno));
+            if (log_fd >= 0)
+                ::close(log_fd);
+            log_fd = fd;
+            log_bytes = 0;
+            append(position, {}, nullptr);
+            if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+                throw std::runtime_error("cannot rename " + path + ": " + std::strerror(errno));
+            sync_path(dir);
+        }
+
+        void write(const Job& j)
+        {
+            append(j.position, j.numbers, j.data.data());
+            written += j.data.size();
+            ++completed;
+
+            // the record is durable, so the base may now be torn by a crash
+            size_t bytes = sketch.bytes();
+            std::string base = checkpoint_base(dir);
+            for (size_t i = 0; i < j.numbers.size(); ++i)
+            {
+                size_t begin = (size_t)j.numbers[i] * DirtyPages::PAGE;
+                pwrite_full(base_fd, j.data.data() + i * DirtyPages::PAGE, std::min(DirtyPages::PAGE, bytes - begin),
+                    data_offset + begin, base);
+            }
+            if (log_bytes > bytes)
+            {
+                if (::fdatasync(base_fd) != 0)
+                    throw std::runtime_error("cannot sync " + base + ": " + std::strerror(errno));
+                restart_log(j.position);
+            }
+        }
+    };
+
+    /**
+     * @brief Rebuilds a sketch from a checkpoint directory
+     * The base snapshot is loaded and the complete records of the log are
+     * applied in order; a torn or corrupt record ends the log.
+     * @param dir checkpoint directory written by CheckpointWriter
+     * @param position set to the stream position of the last complete record
+     * @return the sketch; throws std::runtime_error if the base or log is missing
+     */
+    template<typename S>
+    std::unique_ptr<S> recover(const std::string& dir, uint64_t& position)
+    {
+        std::unique_ptr<S> sketch(new S(checkpoint_base(dir)));
+        std::string path = checkpoint_log(dir);
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f)
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+
+        char* dst = sketch->data();
+        size_t bytes = sketch->bytes();
+        size_t records = 0;
+        DeltaHeader h;
+        std::vector<uint32_t> numbers;
+        std::vector<char> data;
+        while (std::fread(&h, sizeof(h), 1, f) == 1)
+        {
+            if (std::memcmp(h.magic, DeltaHeader::MAGIC, sizeof(h.magic)) != 0 || h.pages > (bytes + DirtyPages::PAGE - 1) / DirtyPages::PAGE)
+                break;
+            numbers.resize((h.pages + 1) / 2 * 2);
+            data.resize(h.pages * DirtyPages::PAGE);
+            if (std::fread(numbers.data(), sizeof(uint32_t), numbers.size(), f) != numbers.size()
+                || std::fread(data.data(), 1, data.size(), f) != data.size()
+                || delta_checksum(h, numbers.data(), data.data()) != h.checksum)
+                break;
+            bool valid = true;
+            for (size_t i = 0; i < h.pages; ++i)
+            {
+                valid = valid && (size_t)numbers[i] * DirtyPages::PAGE < bytes;
+            }
+            if (!valid)
+                break;
+            for (size_t i = 0; i < h.pages; ++i)
+            {
+                size_t begin = (size_t)numbers[i] * DirtyPages::PAGE;
+                std::memcpy(dst + begin, data.data() + i * DirtyPages::PAGE, std::min(DirtyPages::PAGE, bytes - begin));
+            }
+            position = h.position;
+            ++records;
+        }
+        std::fclose(f);
+        if (records == 0)
+            throw std::runtime_error(path + " has no complete record");
+        return sketch;
+    }
+}
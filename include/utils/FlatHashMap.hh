@@ -0,0 +1,337 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <immintrin.h>
+
+namespace utils
+{
+    /**
+     * @brief Fast 64-bit hash of a trivially copyable key, read as 64-bit words
+     */
+    template<typename K>
+    struct FlatHash
+    {
+        uint64_t operator()(const K& key) const
+        {
+            const char* p = (const char*)&key;
+            uint64_t h = 0x9E3779B97F4A7C15ULL ^ sizeof(K);
+            size_t i = 0;
+            for (; i + 8 <= sizeof(K); i += 8)
+            {
+                uint64_t w;
+                std::memcpy(&w, p + i, 8);
+                h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+                h ^= h >> 29U;
+            }
+            if (i < sizeof(K))
+            {
+                uint64_t w = 0;
+                std::memcpy(&w, p + i, sizeof(K) - i);
+                h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+            }
+            h ^= h >> 32U;
+            h *= 0x94D049BB133111EBULL;
+            return h ^ (h >> 29U);
+        }
+    };
+
+    /**
+     * @brief Open-addressing hash map with SIMD-probed control bytes (SwissTable layout)
+     * Keys and values live inline in one slot array. A control byte per slot holds
+     * 7 bits of the hash or EMPTY; a 16-slot group is matched with one SSE compare.
+     * Erasure is not supported, so there are no tombstones.
+     * @param K trivially copyable key, compared bytewise
+     * @param V value type
+     * @param H hash functor returning 64 bits
+     */
+    template<typename K, typename V, typename H = FlatHash<K>>
+    class FlatHashMap
+    {
+        static_assert(std::is_trivially_copyable<K>::value, "FlatHashMap keys must be trivially copyable");
+
+        public:
+        using key_type = K;
+        using mapped_type = V;
+
+        struct Slot
+        {
+            K key;
+            V value;
+        };
+
+        /**
+         * @param expected number of keys to size the table for
+         */
+        FlatHashMap(size_t expected = 0) : ctrl(nullptr), slots(nullptr), cap(0), count(0)
+        {
+            allocate(capacity_for(expected));
+        }
+
+        ~FlatHashMap()
+        {
+            release();
+        }
+
+        FlatHashMap(const FlatHashMap&) = delete;
+        FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+        /**
+         * @brief Returns the value of key, inserting V() if absent
+         */
+        V& operator[](const K& key)
+        {
+            if ((count + 1) * 8 > cap * 7)
+            {
+                rehash(cap * 2);
+            }
+            uint64_t h = hasher(key);
+            size_t pos;
+            if (!probe(key, h, pos))
+            {
+                ctrl[pos] = h2(h);
+                std::memcpy(&slots[pos].key, &key, sizeof(K));
+                new (&slots[pos].value) V();
+                ++count;
+            }
+            return slots[pos].value;
+        }
+
+        /**
+         * @return pointer to the value of key, nullptr if absent
+         */
+        const V* find(const K& key) const
+        {
+            size_t pos;
+            return probe(key, hasher(key), pos) ? &slots[pos].value : nullptr;
+        }
+
+        /**
+         * @brief Looks up a batch of keys, prefetching their first groups
+         * @param keys the query keys
+         * @param n number of keys
+         * @param out n values; missing for absent keys
+         * @param missing value reported for absent keys
+         */
+        void find_batch(const K* keys, size_t n, V* out, V missing = V()) const
+        {
+            for (size_t base = 0; base < n; base += BATCH)
+            {
+                size_t m = std::min(BATCH, n - base);
+                uint64_t h[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    h[j] = hasher(keys[base + j]);
+                    prefetch(h[j]);
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    size_t pos;
+                    out[base + j] = probe(keys[base + j], h[j], pos) ? slots[pos].value : missing;
+                }
+            }
+        }
+
+        /**
+         * @brief Adds delta to the values of a batch of keys, inserting absent keys
+         */
+        void add_batch(const K* keys, size_t n, V delta = 1)
+        {
+            for (size_t base = 0; base < n; base += BATCH)
+            {
+                size_t m = std::min(BATCH, n - base);
+                if ((count + m) * 8 > cap * 7)
+                {
+                    rehash(cap * 2);
+                }
+                uint64_t h[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    h[j] = hasher(keys[base + j]);
+                    prefetch(h[j]);
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    size_t pos;
+                    if (!probe(keys[base + j], h[j], pos))
+                    {
+                        ctrl[pos] = h2(h[j]);
+                        std::memcpy(&slots[pos].key, &keys[base + j], sizeof(K));
+                        new (&slots[pos].value) V();
+                        ++count;
+                    }
+                    slots[pos].value += delta;
+                }
+            }
+        }
+
+        /**
+         * @brief Calls f(key, value) for every entry
+         */
+        template<typename F>
+        void for_each(F f) const
+        {
+            for_each_in(0, cap, f);
+        }
+
+        /**
+         * @brief Calls f(key, value) for the entries in slots [begin, end)
+         * Disjoint slot ranges can be walked by different threads.
+         */
+        template<typename F>
+        void for_each_in(size_t begin, size_t end, F f) const
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (ctrl[i] != EMPTY)
+                {
+                    f(slots[i].key, slots[i].value);
+                }
+            }
+        }
+
+        void reserve(size_t n)
+        {
+            size_t c = capacity_for(n);
+            if (c > cap)
+            {
+                rehash(c);
+            }
+        }
+
+        size_t size() const { return count; }
+
+        /**
+         * @brief Number of slots
+         */
+        size_t capacity() const { return cap; }
+
+        /**
+         * @brief Memory used by control bytes and slots
+         */
+        size_t bytes() const { return cap * (1 + sizeof(Slot)); }
+
+        protected:
+        static constexpr size_t GROUP = 16;
+        static constexpr size_t BATCH = 16;
+        static constexpr int8_t EMPTY = -128;
+
+        int8_t* ctrl;
+        Slot* slots;
+        size_t cap;         // power of two, multiple of GROUP
+        size_t count;
+        H hasher;
+
+        static int8_t h2(uint64_t h) { return h & 0x7FU; }
+
+        static size_t capacity_for(size_t n)
+        {
+            size_t c = GROUP;
+            while (c * 7 < n * 8)
+            {
+                c *= 2;
+            }
+            return c;
+        }
+
+        void allocate(size_t c)
+        {
+            cap = c;
+            ctrl = (int8_t*)std::aligned_alloc(64, std::max<size_t>(64, cap));
+            slots = (Slot*)std::aligned_alloc(64, (cap * sizeof(Slot) + 63) / 64 * 64);
+            if (!ctrl || !slots)
+            {
+                throw std::bad_alloc();
+            }
+            std::memset(ctrl, EMPTY, cap);
+        }
+
+        void release()
+        {
+            if (slots && !std::is_trivially_destructible<V>::value)
+            {
+                for (size_t i = 0; i < cap; ++i)
+                {
+                    if (ctrl[i] != EMPTY)
+                    {
+                        slots[i].value.~V();
+                    }
+                }
+            }
+            std::free(ctrl);
+            std::free(slots);
+            ctrl = nullptr;
+            slots = nullptr;
+        }
+
+        void rehash(size_t c)
+        {
+            int8_t* old_ctrl = ctrl;
+            Slot* old_slots = slots;
+            size_t old_cap = cap;
+            allocate(c);
+
+            for (size_t i = 0; i < old_cap; ++i)
+            {
+                if (old_ctrl[i] == EMPTY)
+                {
+                    continue;
+                }
+                uint64_t h = hasher(old_slots[i].key);
+                size_t pos;
+                probe(old_slots[i].key, h, pos);
+                ctrl[pos] = h2(h);
+                std::memcpy(&slots[pos].key, &old_slots[i].key, sizeof(K));
+                new (&slots[pos].value) V(std::move(old_slots[i].value));
+                old_slots[i].value.~V();
+            }
+            std::free(old_ctrl);
+            std::free(old_slots);
+        }
+
+        void prefetch(uint64_t h) const
+        {
+            size_t g = ((h >> 7U) * GROUP) & (cap - 1);
+            __builtin_prefetch(ctrl + g);
+            __builtin_prefetch(slots + g);
+        }
+
+        /**
+         * @brief Probes groups quadratically until key or an empty slot is found
+         * @param pos output, slot of key if found, else the first empty slot
+         * @return whether key is present
+         */
+        bool probe(const K& key, uint64_t h, size_t& pos) const
+        {
+            __m128i tag = _mm_set1_epi8(h2(h));
+            __m128i empty = _mm_set1_epi8(EMPTY);
+            size_t mask = cap - 1;
+            size_t g = ((h >> 7U) * GROUP) & mask;
+            for (size_t step = GROUP; ; g = (g + step) & mask, step += GROUP)
+            {
+                __m128i c = _mm_load_si128((const __m128i*)(ctrl + g));
+                uint32_t match = _mm_movemask_epi8(_mm_cmpeq_epi8(c, tag));
+                while (match)
+                {
+                    size_t i = g + __builtin_ctz(match);
+                    if (std::memcmp(&slots[i].key, &key, sizeof(K)) == 0)
+                    {
+                        pos = i;
+                        return true;
+                    }
+                    match &= match - 1;
+                }
+                uint32_t free = _mm_movemask_epi8(_mm_cmpeq_epi8(c, empty));
+                if (free)
+                {
+                    pos = g + __builtin_ctz(free);
+                    return false;
+                }
+            }
+        }
+    };
+}
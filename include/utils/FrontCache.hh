@@ -0,0 +1,362 @@
+#pragma once
+#include "BucketIndex.hh"
+#include "FlatHashMap.hh"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+
+namespace utils
+{
+    /**
+     * @brief Small exact table in front of a sketch that absorbs hot keys
+     * A set-associative table of exact counts sits between the stream and
+     * the sketch. Repeats of a resident key only bump its count; a key is
+     * written to the sketch once, weighted by its count, when it is evicted
+     * (or on flush()). Victims are the least counted entries of their set;
+     * they are collected and written with one weighted insert_batch, so the
+     * sketch still prefetches its buckets.
+     * Keys that were never evicted are answered exactly from the table; a
+     * bitmap of evicted key hashes tells which resident counts must be added
+     * to the sketch estimate. Sketches without weighted inserts are flushed
+     * one insert at a time.
+     * @param S the sketch
+     * @param K key type
+     * @param Ways entries per set; 8 tags and counts fill one cache line
+     */
+    template<typename S, typename K, size_t Ways = 8>
+    class FrontCache
+    {
+        static_assert(std::is_trivially_copyable<K>::value, "FrontCache keys must be trivially copyable");
+
+        public:
+        /**
+         * @param entries table entries, rounded up to a power of two number of sets
+         * @param args forwarded to the sketch constructor
+         */
+        template<typename... Args>
+        FrontCache(size_t entries, Args&&... args)
+            : sketch(std::forward<Args>(args)...), sets(next_pow2(std::max<size_t>(1, (entries + Ways - 1) / Ways))),
+              spilled_bits(next_pow2(sets * Ways * 64)), hit_count(0), miss_count(0)
+        {
+            table = (Set*)std::aligned_alloc(64, sets * sizeof(Set));
+            std::memset(table, 0, sets * sizeof(Set));
+            resident = (K*)std::aligned_alloc(64, (sets * Ways * sizeof(K) + 63) / 64 * 64);
+            spilled.assign(spilled_bits / 64, 0);
+        }
+
+        FrontCache(const FrontCache&) = delete;
+        FrontCache& operator=(const FrontCache&) = delete;
+
+        ~FrontCache()
+        {
+            std::free(table);
+            std::free(resident);
+            table = nullptr;
+            resident = nullptr;
+        }
+
+        /**
+         * @brief Counts the key in the table, evicting the least counted entry of its set on a miss
+         * @param key the key
+         */
+        void insert(const K& key)
+        {
+            insert_hashed(key, hasher(key));
+            drain();
+        }
+
+        /**
+         * @brief Inserts a batch of keys, prefetching all sets first
+         * @param keys the keys
+         * @param n number of keys
+         */
+        void insert_batch(const K* keys, size_t n)
+        {
+            for (size_t base = 0; base < n; base += BATCH)
+            {
+                size_t m = std::min(BATCH, n - base);
+                uint64_t h[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    h[j] = hasher(keys[base + j]);
+                    __builtin_prefetch(table + (h[j] & (sets - 1)), 1);
+                }
+                if (pending_size + m > PENDING)
+                {
+                    drain();
+                }
+                for (size_t j = 0; j < m; ++j)
+                {
+                    insert_hashed(keys[base + j], h[j]);
+                }
+            }
+            drain();
+        }
+
+        /**
+         * @brief Estimates the number of occurence of given key
+         * @param key the query key
+         * @return the exact count if the key was never evicted, else the
+         * resident count plus the sketch estimate
+         */
+        double estimate(const K& key) const
+        {
+            uint64_t h = hasher(key);
+            int w = find(key, h);
+            if (w < 0)
+            {
+                return sketch.estimate(key);
+            }
+            double count = table[h & (sets - 1)].count[w];
+            return was_spilled(h) ? count + sketch.estimate(key) : count;
+        }
+
+        /**
+         * @brief Estimates a batch of keys; only keys the table cannot answer reach the sketch
+         * @param keys the query keys
+         * @param n number of keys
+         * @param out n estimates
+         */
+        void estimate_batch(const K* keys, size_t n, double* out) const
+        {
+            using E = decltype(sketch.estimate(keys[0]));
+            for (size_t base = 0; base < n; base += BATCH)
+            {
+                size_t m = std::min(BATCH, n - base);
+                uint64_t h[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    h[j] = hasher(keys[base + j]);
+                    __builtin_prefetch(table + (h[j] & (sets - 1)));
+                }
+
+                K miss[BATCH];
+                size_t pos[BATCH];
+                size_t k = 0;
+                for (size_t j = 0; j < m; ++j)
+                {
+                    int w = find(keys[base + j], h[j]);
+                    out[base + j] = w < 0 ? 0 : table[h[j] & (sets - 1)].count[w];
+                    if (w < 0 || was_spilled(h[j]))
+                    {
+                        miss[k] = keys[base + j];
+                        pos[k++] = base + j;
+                    }
+                }
+                E est[BATCH];
+                sketch.estimate_batch(miss, k, est);
+                for (size_t j = 0; j < k; ++j)
+                {
+                    out[pos[j]] += est[j];
+                }
+            }
+        }
+
+        /**
+         * @brief Writes every resident count to the sketch and empties the table
+         */
+        void flush()
+        {
+            for (size_t s = 0; s < sets; ++s)
+            {
+                if (pending_size + Ways > PENDING)
+                {
+                    drain();
+                }
+                for (size_t w = 0; w < Ways; ++w)
+                {
+                    if (table[s].tag[w])
+                    {
+                        evict(s, w);
+                    }
+                }
+            }
+            drain();
+        }
+
+        /**
+         * @brief Flushes the table and publishes the sketch, for sketches that snapshot inserts
+         */
+        template<typename T = S>
+        auto publish() -> decltype(std::declval<T&>().publish(), void())
+        {
+            flush();
+            sketch.publish();
+        }
+
+        /**
+         * @brief Memory of the sketch plus the table, its keys and the eviction bitmap
+         */
+        size_t bytes() const
+        {
+            return sketch.bytes() + sets * (sizeof(Set) + Ways * sizeof(K)) + spilled_bits / 8;
+        }
+
+        const auto& instrumentation() const { return sketch.instrumentation(); }
+
+        /**
+         * @brief Inserts that found their key resident
+         */
+        size_t hits() const { return hit_count; }
+
+        /**
+         * @brief Inserts that admitted a new key
+         */
+        size_t misses() const { return miss_count; }
+
+        protected:
+        static constexpr size_t BATCH = 16;
+        static constexpr size_t PENDING = 64;
+
+        /**
+         * @brief Tags and counts of one set; tag 0 marks an empty way
+         */
+        struct alignas(64) Set
+        {
+            uint32_t tag[Ways];
+            uint32_t count[Ways];
+        };
+
+        S sketch;
+        const size_t sets;
+        const size_t spilled_bits;
+        Set* table;
+        K* resident;
+        std::vector<uint64_t> spilled;
+        FlatHash<K> hasher;
+        size_t hit_count;
+        size_t miss_count;
+        K pending[PENDING];             // evicted entries not yet in the sketch
+        uint32_t pending_count[PENDING];
+        size_t pending_size = 0;
+
+        static uint32_t tag_of(uint64_t h)
+        {
+            return (uint32_t)(h >> 32U) | 1U;
+        }
+
+        /**
+         * @brief Ways of the set whose tag equals t, as a bit mask
+         */
+        uint32_t match(const Set& set, uint32_t t) const
+        {
+#if defined(__AVX2__)
+            if constexpr (Ways == 8)
+            {
+                __m256i v = _mm256_load_si256((const __m256i*)set.tag);
+                return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, _mm256_set1_epi32(t))));
+            }
+#endif
+            uint32_t mask = 0;
+            for (size_t w = 0; w < Ways; ++w)
+            {
+                mask |= (uint32_t)(set.tag[w] == t) << w;
+            }
+            return mask;
+        }
+
+        /**
+         * @brief Way holding the key, or -1
+         */
+        int find(const K& key, uint64_t h) const
+        {
+            size_t s = h & (sets - 1);
+            for (uint32_t m = match(table[s], tag_of(h)); m; m &= m - 1)
+            {
+                int w = __builtin_ctz(m);
+                if (std::memcmp(resident + s * Ways + w, &key, sizeof(K)) == 0)
+                {
+                    return w;
+                }
+            }
+            return -1;
+        }
+
+        bool was_spilled(uint64_t h) const
+        {
+            size_t bit = (h >> 16U) & (spilled_bits - 1);
+            return (spilled[bit / 64] >> (bit % 64)) & 1U;
+        }
+
+        void insert_hashed(const K& key, uint64_t h)
+        {
+            size_t s = h & (sets - 1);
+            Set& set = table[s];
+            int w = find(key, h);
+            if (w >= 0)
+            {
+                ++set.count[w];
+                ++hit_count;
+                return;
+            }
+            ++miss_count;
+
+            // an empty way if there is one, else the least counted entry
+            uint32_t empty = match(set, 0);
+            size_t victim = empty ? __builtin_ctz(empty) : 0;
+            if (!empty)
+            {
+                for (size_t i = 1; i < Ways; ++i)
+                {
+                    victim = set.count[i] < set.count[victim] ? i : victim;
+                }
+                evict(s, victim);
+            }
+            set.tag[victim] = tag_of(h);
+            set.count[victim] = 1;
+            resident[s * Ways + victim] = key;
+        }
+
+        /**
+         * @brief Queues the entry for the sketch and marks its key as evicted
+         * The caller drains the queue before it can overflow.
+         */
+        void evict(size_t s, size_t w)
+        {
+            const K& key = resident[s * Ways + w];
+            pending[pending_size] = key;
+            pending_count[pending_size++] = table[s].count[w];
+            size_t bit = (hasher(key) >> 16U) & (spilled_bits - 1);
+            spilled[bit / 64] |= 1ULL << (bit % 64);
+            table[s].tag[w] = 0;
+            table[s].count[w] = 0;
+        }
+
+        /**
+         * @brief Writes the queued entries to the sketch
+         */
+        void drain()
+        {
+            if (pending_size)
+            {
+                add(sketch, pending, pending_count, pending_size, 0);
+                pending_size = 0;
+            }
+        }
+
+        template<typename T>
+        static auto add(T& s, const K* keys, const uint32_t* counts, size_t n, int)
+            -> decltype(s.insert_batch(keys, n, counts), void())
+        {
+            s.insert_batch(keys, n, counts);
+        }
+
+        template<typename T>
+        static void add(T& s, const K* keys, const uint32_t* counts, size_t n, long)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                for (uint32_t c = 0; c < counts[i]; ++c)
+                {
+                    s.insert(keys[i]);
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,268 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <x86intrin.h>
+
+namespace utils
+{
+    /**
+     * @brief Operations recorded by an instrumentation policy
+     */
+    enum class Op : size_t
+    {
+        Insert = 0,
+        Estimate = 1,
+    };
+
+    /**
+     * @brief Default instrumentation policy; every hook is empty and compiles away
+     * Sketches call start/finish around each operation and report counter
+     * overflow and saturation events, guarded by if constexpr (ENABLED).
+     */
+    struct NoInstrumentation
+    {
+        static constexpr bool ENABLED = false;
+
+        uint64_t start(Op, size_t = 1) { return 0; }
+        void finish(Op, uint64_t, size_t = 1) {}
+        void overflow(size_t) {}
+        void saturation(size_t) {}
+    };
+
+    /**
+     * @brief Log-linear latency histogram in the style of HdrHistogram
+     * Values below 16 have exact buckets; above, each power of two is split
+     * into 16 buckets, so bucket bounds are within 6.25% of the value.
+     */
+    class LatencyHistogram
+    {
+        public:
+        static constexpr size_t SUB_BITS = 4;
+        static constexpr size_t SUB = 1U << SUB_BITS;
+        static constexpr size_t BUCKETS = 48 * SUB;
+
+        LatencyHistogram()
+        {
+            for (auto& it : counts)
+            {
+                it.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void record(uint64_t v)
+        {
+            counts[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint64_t count(size_t b) const { return counts[b].load(std::memory_order_relaxed); }
+
+        static size_t bucket(uint64_t v)
+        {
+            if (v < SUB)
+                return v;
+            size_t e = 63 - __builtin_clzll(v);
+            size_t b = (e - SUB_BITS + 1) * SUB + ((v >> (e - SUB_BITS)) & (SUB - 1));
+            return b < BUCKETS ? b : BUCKETS - 1;
+        }
+
+        /**
+         * @brief Smallest value that falls into bucket b
+         */
+        static uint64_t lower(size_t b)
+        {
+            if (b < SUB)
+                return b;
+            size_t e = b / SUB + SUB_BITS - 1;
+            return (SUB + b % SUB) << (e - SUB_BITS);
+        }
+
+        protected:
+        std::atomic<uint64_t> counts[BUCKETS];
+    };
+
+    /**
+     * @brief Point-in-time copy of the instrumentation counters
+     */
+    struct InstrumentationSnapshot
+    {
+        struct Latency
+        {
+            uint64_t samples = 0;
+            double p50_ns = 0;
+            double p90_ns = 0;
+            double p99_ns = 0;
+            double p999_ns = 0;
+            double max_ns = 0;
+        };
+
+        uint64_t ops[2] = {0, 0};
+        std::vector<uint64_t> thread_ops[2];    // per active thread slot
+        uint64_t overflow = 0;
+        uint64_t saturation = 0;
+        Latency latency[2];
+
+        std::string to_json() const
+        {
+            static const char* names[] = {"insert", "estimate"};
+            std::stringstream ss;
+            ss << "{\"overflow\": " << overflow << ", \"saturation\": " << saturation;
+            for (size_t op = 0; op < 2; ++op)
+            {
+                const Latency& l = latency[op];
+                ss << ", \"" << names[op] << "\": {\"ops\": " << ops[op] << ", \"thread_ops\": [";
+                for (size_t i = 0; i < thread_ops[op].size(); ++i)
+                {
+                    ss << (i ? ", " : "") << thread_ops[op][i];
+                }
+                ss << "], \"samples\": " << l.samples << ", \"p50_ns\": " << l.p50_ns
+                   << ", \"p90_ns\": " << l.p90_ns << ", \"p99_ns\": " << l.p99_ns
+                   << ", \"p999_ns\": " << l.p999_ns << ", \"max_ns\": " << l.max_ns << "}";
+            }
+            ss << "}";
+            return ss.str();
+        }
+    };
+
+    /**
+     * @brief Small dense id of the calling thread
+     */
+    inline size_t thread_slot()
+    {
+        static std::atomic<size_t> next{0};
+        thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+
+    /**
+     * @brief Sampling instrumentation: op counts per thread, overflow and
+     * saturation events, and TSC latency histograms of one in 2^SampleShift ops
+     * Counters are sharded by thread slot in cache-line aligned shards, so
+     * concurrent estimates do not contend.
+     * @param SampleShift log2 of the sampling period
+     */
+    template<size_t SampleShift = 6>
+    class SampledInstrumentation
+    {
+        public:
+        static constexpr bool ENABLED = true;
+        static constexpr size_t SHARDS = 64;
+
+        SampledInstrumentation()
+            : shards(new Shard[SHARDS]), tsc0(__rdtsc()), clock0(std::chrono::steady_clock::now())
+        {}
+
+        uint64_t start(Op op, size_t n = 1)
+        {
+            Shard& s = shard();
+            s.ops[(size_t)op].fetch_add(n, std::memory_order_relaxed);
+            uint64_t tick = s.tick.fetch_add(1, std::memory_order_relaxed);
+            return (tick & ((1ULL << SampleShift) - 1)) == 0 ? __rdtsc() : 0;
+        }
+
+        /**
+         * @param t value returned by start; 0 if the operation is not sampled
+         * @param n operations covered; the sample is the mean latency
+         */
+        void finish(Op op, uint64_t t, size_t n = 1)
+        {
+            if (t != 0)
+            {
+                shard().latency[(size_t)op].record((__rdtsc() - t) / n);
+            }
+        }
+
+        void overflow(size_t n)
+        {
+            shard().overflow.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void saturation(size_t n)
+        {
+            shard().saturation.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Copies the counters; safe to call while the sketch is in use
+         */
+        InstrumentationSnapshot snapshot() const
+        {
+            InstrumentationSnapshot snap;
+            double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - clock0).count();
+            double ns_per_tick = elapsed_ns > 0 ? elapsed_ns / (double)(__rdtsc() - tsc0) : 0;
+
+            for (size_t op = 0; op < 2; ++op)
+            {
+                std::vector<uint64_t> merged(LatencyHistogram::BUCKETS);
+                for (size_t i = 0; i < SHARDS; ++i)
+                {
+                    uint64_t ops = shards[i].ops[op].load(std::memory_order_relaxed);
+                    snap.ops[op] += ops;
+                    if (ops)
+                    {
+                        snap.thread_ops[op].push_back(ops);
+                    }
+                    for (size_t b = 0; b < merged.size(); ++b)
+                    {
+                        merged[b] += shards[i].latency[op].count(b);
+                    }
+                }
+                summarize(merged, ns_per_tick, snap.latency[op]);
+            }
+            for (size_t i = 0; i < SHARDS; ++i)
+            {
+                snap.overflow += shards[i].overflow.load(std::memory_order_relaxed);
+                snap.saturation += shards[i].saturation.load(std::memory_order_relaxed);
+            }
+            return snap;
+        }
+
+        protected:
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> ops[2] = {};
+            std::atomic<uint64_t> tick{0};
+            std::atomic<uint64_t> overflow{0};
+            std::atomic<uint64_t> saturation{0};
+            LatencyHistogram latency[2];
+        };
+
+        std::unique_ptr<Shard[]> shards;
+        uint64_t tsc0;
+        std::chrono::steady_clock::time_point clock0;
+
+        Shard& shard() const { return shards[thread_slot() % SHARDS]; }
+
+        static void summarize(const std::vector<uint64_t>& hist, double ns_per_tick, InstrumentationSnapshot::Latency& out)
+        {
+            for (auto it : hist)
+            {
+                out.samples += it;
+            }
+            if (out.samples == 0)
+                return;
+
+            double qs[] = {0.5, 0.9, 0.99, 0.999};
+            double* outs[] = {&out.p50_ns, &out.p90_ns, &out.p99_ns, &out.p999_ns};
+            size_t q = 0;
+            uint64_t seen = 0;
+            for (size_t b = 0; b < hist.size(); ++b)
+            {
+                seen += hist[b];
+                while (q < 4 && seen > qs[q] * (out.samples - 1))
+                {
+                    *outs[q++] = LatencyHistogram::lower(b) * ns_per_tick;
+                }
+                if (hist[b])
+                {
+                    out.max_ns = LatencyHistogram::lower(b) * ns_per_tick;
+                }
+            }
+        }
+    };
+}
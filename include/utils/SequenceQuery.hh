@@ -0,0 +1,135 @@
+#pragma once
+#include "Syncmer.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace utils
+{
+    /**
+     * @brief 2-bit code of a base, as Fasta encodes it: A, C, G and anything else as T
+     */
+    inline uint32_t base_code(char c)
+    {
+        switch (c)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            default: return 3;
+        }
+    }
+
+    /**
+     * @brief Encodes the 128-mers of a sequence by rolling, 2 bits per base
+     * The k-mer is kept as four 64-bit words; each base shifts it down by
+     * one base and enters at the top, so consecutive k-mers cost a few
+     * shifts instead of a 128-base re-encode.
+     */
+    class KmerRoller
+    {
+        public:
+        static constexpr size_t K = 128;
+
+        KmerRoller() : words() {}
+
+        void push(char c)
+        {
+            words[0] = (words[0] >> 2U) | (words[1] << 62U);
+            words[1] = (words[1] >> 2U) | (words[2] << 62U);
+            words[2] = (words[2] >> 2U) | (words[3] << 62U);
+            words[3] = (words[3] >> 2U) | ((uint64_t)base_code(c) << 62U);
+        }
+
+        /**
+         * @brief The last 128 pushed bases, laid out as Read128Mer
+         */
+        void read(Compressed128Mer& out) const
+        {
+            std::memcpy(out.u32, words, sizeof(words));
+        }
+
+        protected:
+        uint64_t words[4];
+    };
+
+    /**
+     * @brief Estimates every 128-mer of a sequence, e.g. a read or a contig
+     * The k-mers are rolled out of the sequence and estimated in prefetched
+     * batches through the sketch's estimate_batch. Wrap a sketch built from
+     * syncmers in a SampledSketch, so the other k-mers come out UNSAMPLED.
+     * @param sketch any sketch with estimate_batch
+     * @param seq the bases
+     * @param len number of bases
+     * @param out len - 127 estimates, nothing if len < 128
+     * @return number of estimates
+     */
+    template<typename S>
+    size_t estimate_sequence(const S& sketch, const char* seq, size_t len, double* out)
+    {
+        static constexpr size_t CHUNK = 256;
+        using E = decltype(sketch.estimate(std::declval<const Compressed128Mer&>()));
+        if (len < KmerRoller::K)
+            return 0;
+
+        KmerRoller roller;
+        for (size_t i = 0; i + 1 < KmerRoller::K; ++i)
+        {
+            roller.push(seq[i]);
+        }
+        size_t n = len - KmerRoller::K + 1;
+        Compressed128Mer keys[CHUNK];
+        E est[CHUNK];
+        for (size_t base = 0; base < n; base += CHUNK)
+        {
+            size_t m = std::min(CHUNK, n - base);
+            for (size_t j = 0; j < m; ++j)
+            {
+                roller.push(seq[base + j + KmerRoller::K - 1]);
+                roller.read(keys[j]);
+            }
+            sketch.estimate_batch(keys, m, est);
+            std::copy(est, est + m, out + base);
+        }
+        return n;
+    }
+
+    /**
+     * @brief Smallest k-mer abundance of a sequence, 0 if it has no k-mers
+     * UNSAMPLED estimates are skipped.
+     */
+    inline double min_abundance(const double* est, size_t n)
+    {
+        const double* result = nullptr;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (est[i] != UNSAMPLED && (!result || est[i] < *result))
+                result = est + i;
+        }
+        return result ? *result : 0;
+    }
+
+    /**
+     * @brief Median k-mer abundance of a sequence, 0 if it has no k-mers
+     * The usual read-level abundance: a few erroneous or shared k-mers do
+     * not move it. UNSAMPLED estimates are skipped.
+     */
+    inline double median_abundance(const double* est, size_t n)
+    {
+        std::vector<double> v;
+        std::remove_copy(est, est + n, std::back_inserter(v), UNSAMPLED);
+        n = v.size();
+        if (n == 0)
+            return 0;
+        auto mid = v.begin() + n / 2;
+        std::nth_element(v.begin(), mid, v.end());
+        if (n & 1U)
+            return *mid;
+        return (*mid + *std::max_element(v.begin(), mid)) / 2;
+    }
+}
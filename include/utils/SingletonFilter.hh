@@ -0,0 +1,253 @@
+#pragma once
+#include "BucketIndex.hh"
+#include "FlatHashMap.hh"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <immintrin.h>
+
+namespace utils
+{
+    /**
+     * @brief Blocked Bloom filter that keeps first occurrences out of a sketch
+     * Most distinct k-mers of a read set are sequencing errors seen once.
+     * The first occurrence of a key only sets its bits in the filter; later
+     * occurrences are forwarded to the sketch, and estimates add the one
+     * occurrence the filter absorbed. Keys the filter has never seen are
+     * answered 0 without touching the sketch. A false positive forwards a
+     * first occurrence, so estimates can be high by 1.
+     * The filter is split-block: a key sets one bit in each of the 8 words
+     * of a 32-byte block, so a probe touches one cache line and is one AVX2
+     * compare.
+     * @param S the sketch
+     * @param K key type
+     */
+    template<typename S, typename K>
+    class SingletonFilter
+    {
+        static_assert(std::is_trivially_copyable<K>::value, "SingletonFilter keys must be trivially copyable");
+
+        public:
+        /**
+         * @param bits filter size, rounded up to a power of two number of blocks
+         * @param args forwarded to the sketch constructor
+         */
+        template<typename... Args>
+        SingletonFilter(size_t bits, Args&&... args)
+            : sketch(std::forward<Args>(args)...), blocks(next_pow2(std::max<size_t>(1, (bits + 255) / 256)))
+        {
+            filter = (Block*)std::aligned_alloc(64, std::max<size_t>(64, blocks * sizeof(Block)));
+            std::memset(filter, 0, blocks * sizeof(Block));
+        }
+
+        SingletonFilter(const SingletonFilter&) = delete;
+        SingletonFilter& operator=(const SingletonFilter&) = delete;
+
+        ~SingletonFilter()
+        {
+            std::free(filter);
+            filter = nullptr;
+        }
+
+        /**
+         * @brief Records the key, forwarding it to the sketch if it was seen before
+         * @param key the key
+         */
+        void insert(const K& key)
+        {
+            if (test_and_set(hasher(key)))
+            {
+                sketch.insert(key);
+            }
+        }
+
+        /**
+         * @brief Inserts a batch of keys, prefetching all blocks first
+         * Repeats are forwarded to the sketch as one batch.
+         * @param keys the keys
+         * @param n number of keys
+         */
+        void insert_batch(const K* keys, size_t n)
+        {
+            for (size_t base = 0; base < n; base += BATCH)
+            {
+                size_t m = std::min(BATCH, n - base);
+                uint64_t h[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    h[j] = hasher(keys[base + j]);
+                    __builtin_prefetch(filter + (h[j] & (blocks - 1)), 1);
+                }
+                K repeat[BATCH];
+                size_t k = 0;
+                for (size_t j = 0; j < m; ++j)
+                {
+                    if (test_and_set(h[j]))
+                    {
+                        repeat[k++] = keys[base + j];
+                    }
+                }
+                if (k)
+                {
+                    sketch.insert_batch(repeat, k);
+                }
+            }
+        }
+
+        /**
+         * @brief Estimates the number of occurence of given key
+         * @param key the query key
+         * @return 0 for keys the filter has not seen, else the sketch estimate + 1
+         */
+        double estimate(const K& key) const
+        {
+            return contains(hasher(key)) ? (double)sketch.estimate(key) + 1 : 0;
+        }
+
+        /**
+         * @brief Estimates a batch of keys; only keys the filter has seen reach the sketch
+         * @param keys the query keys
+         * @param n number of keys
+         * @param out n estimates
+         */
+        void estimate_batch(const K* keys, size_t n, double* out) const
+        {
+            using E = decltype(sketch.estimate(keys[0]));
+            for (size_t base = 0; base < n; base += BATCH)
+            {
+                size_t m = std::min(BATCH, n - base);
+                uint64_t h[BATCH];
+                for (size_t j = 0; j < m; ++j)
+                {
+                    h[j] = hasher(keys[base + j]);
+                    __builtin_prefetch(filter + (h[j] & (blocks - 1)));
+                }
+                K seen[BATCH];
+                size_t pos[BATCH];
+                size_t k = 0;
+                for (size_t j = 0; j < m; ++j)
+                {
+                    out[base + j] = 0;
+                    if (contains(h[j]))
+                    {
+                        seen[k] = keys[base + j];
+                        pos[k++] = base + j;
+                    }
+                }
+                E est[BATCH];
+                sketch.estimate_batch(seen, k, est);
+                for (size_t j = 0; j < k; ++j)
+                {
+                    out[pos[j]] = (double)est[j] + 1;
+                }
+            }
+        }
+
+        /**
+         * @brief Publishes the sketch, for sketches that snapshot inserts
+         */
+        template<typename T = S>
+        auto publish() -> decltype(std::declval<T&>().publish(), void())
+        {
+            sketch.publish();
+        }
+
+        /**
+         * @brief Memory of the sketch plus the filter
+         */
+        size_t bytes() const
+        {
+            return sketch.bytes() + blocks * sizeof(Block);
+        }
+
+        const auto& instrumentation() const { return sketch.instrumentation(); }
+
+        protected:
+        static constexpr size_t BATCH = 16;
+
+        struct alignas(32) Block
+        {
+            uint32_t word[8];
+        };
+
+        S sketch;
+        const size_t blocks;
+        Block* filter;
+        FlatHash<K> hasher;
+
+        /**
+         * @brief Odd multipliers picking one bit per word, from the Parquet split-block filter
+         */
+        alignas(32) static constexpr uint32_t SALT[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+        /**
+         * @brief The bit of every word of a block that the hash sets
+         */
+#if defined(__AVX2__)
+        static __m256i mask_of(uint64_t h)
+        {
+            __m256i x = _mm256_mullo_epi32(_mm256_set1_epi32((uint32_t)(h >> 32U)),
+                _mm256_loadu_si256((const __m256i*)SALT));
+            return _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_srli_epi32(x, 27));
+        }
+#else
+        static Block mask_of(uint64_t h)
+        {
+            uint32_t x = (uint32_t)(h >> 32U);
+            Block mask;
+            for (size_t i = 0; i < 8; ++i)
+            {
+                mask.word[i] = 1U << ((x * SALT[i]) >> 27U);
+            }
+            return mask;
+        }
+#endif
+
+        bool contains(uint64_t h) const
+        {
+            const Block& b = filter[h & (blocks - 1)];
+#if defined(__AVX2__)
+            __m256i v = _mm256_load_si256((const __m256i*)b.word);
+            return _mm256_testc_si256(v, mask_of(h));
+#else
+            Block mask = mask_of(h);
+            uint32_t missing = 0;
+            for (size_t i = 0; i < 8; ++i)
+            {
+                missing |= mask.word[i] & ~b.word[i];
+            }
+            return missing == 0;
+#endif
+        }
+
+        /**
+         * @brief Sets the key's bits
+         * @return whether they were all set before
+         */
+        bool test_and_set(uint64_t h)
+        {
+            Block& b = filter[h & (blocks - 1)];
+#if defined(__AVX2__)
+            __m256i v = _mm256_load_si256((const __m256i*)b.word);
+            __m256i m = mask_of(h);
+            bool present = _mm256_testc_si256(v, m);
+            _mm256_store_si256((__m256i*)b.word, _mm256_or_si256(v, m));
+            return present;
+#else
+            Block mask = mask_of(h);
+            uint32_t missing = 0;
+            for (size_t i = 0; i < 8; ++i)
+            {
+                missing |= mask.word[i] & ~b.word[i];
+                b.word[i] |= mask.word[i];
+            }
+            return missing == 0;
+#endif
+        }
+    };
+}
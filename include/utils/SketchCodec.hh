@@ -0,0 +1,136 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+namespace utils
+{
+    /**
+     * @brief Zigzag bit-plane codec for int16 counters
+     * Every group of 32 lanes (one 64-byte bucket) is zigzag-mapped, so small
+     * values of either sign get small codes, and stored as one byte b, the
+     * bit width of the largest code, followed by b 32-bit planes: bit i of
+     * plane k is bit k of lane i. Groups of zeros take one byte.
+     */
+    namespace bitplane
+    {
+        static constexpr size_t GROUP_BYTES = 64;
+        static constexpr size_t LANES = 32;
+
+        /**
+         * @brief Largest encoding of n bytes
+         */
+        inline size_t max_encoded(size_t n)
+        {
+            return n / GROUP_BYTES * (1 + GROUP_BYTES);
+        }
+
+        inline uint16_t zigzag(int16_t v)
+        {
+            return (uint16_t)(((uint16_t)v << 1U) ^ (uint16_t)(v >> 15));
+        }
+
+        inline int16_t unzigzag(uint16_t z)
+        {
+            return (int16_t)((z >> 1U) ^ (uint16_t)-(z & 1U));
+        }
+
+        /**
+         * @brief Encodes n bytes of int16 lanes, n a multiple of 64
+         * @return bytes written to out, at most max_encoded(n)
+         */
+        inline size_t encode(const char* in, size_t n, char* out)
+        {
+            char* p = out;
+            for (size_t g = 0; g < n; g += GROUP_BYTES)
+            {
+#if defined(__AVX512BW__)
+                __m512i v = _mm512_loadu_si512(in + g);
+                __m512i z = _mm512_xor_si512(_mm512_slli_epi16(v, 1), _mm512_srai_epi16(v, 15));
+                uint32_t any = _mm512_reduce_or_epi32(z);
+                any = (any | (any >> 16U)) & 0xFFFFU;
+                uint8_t b = any ? 32 - __builtin_clz(any) : 0;
+                *p++ = (char)b;
+                for (uint8_t k = 0; k < b; ++k)
+                {
+                    uint32_t plane = _mm512_test_epi16_mask(z, _mm512_set1_epi16((int16_t)(1U << k)));
+                    std::memcpy(p, &plane, 4);
+                    p += 4;
+                }
+#else
+                uint16_t z[LANES];
+                uint16_t any = 0;
+                for (size_t i = 0; i < LANES; ++i)
+                {
+                    int16_t v;
+                    std::memcpy(&v, in + g + 2 * i, 2);
+                    z[i] = zigzag(v);
+                    any |= z[i];
+                }
+                uint8_t b = any ? 32 - __builtin_clz(any) : 0;
+                *p++ = (char)b;
+                for (uint8_t k = 0; k < b; ++k)
+                {
+                    uint32_t plane = 0;
+                    for (size_t i = 0; i < LANES; ++i)
+                    {
+                        plane |= (uint32_t)((z[i] >> k) & 1U) << i;
+                    }
+                    std::memcpy(p, &plane, 4);
+                    p += 4;
+                }
+#endif
+            }
+            return p - out;
+        }
+
+        /**
+         * @brief Decodes n bytes of int16 lanes from m encoded bytes
+         * @return false if the input is truncated or malformed
+         */
+        inline bool decode(const char* in, size_t m, char* out, size_t n)
+        {
+            const char* p = in;
+            const char* end = in + m;
+            for (size_t g = 0; g < n; g += GROUP_BYTES)
+            {
+                if (p == end)
+                    return false;
+                uint8_t b = *p++;
+                if (b > 16 || (size_t)(end - p) < 4U * b)
+                    return false;
+#if defined(__AVX512BW__)
+                __m512i z = _mm512_setzero_si512();
+                for (uint8_t k = 0; k < b; ++k)
+                {
+                    uint32_t plane;
+                    std::memcpy(&plane, p, 4);
+                    p += 4;
+                    z = _mm512_mask_add_epi16(z, plane, z, _mm512_set1_epi16((int16_t)(1U << k)));
+                }
+                __m512i sign = _mm512_sub_epi16(_mm512_setzero_si512(), _mm512_and_si512(z, _mm512_set1_epi16(1)));
+                _mm512_storeu_si512(out + g, _mm512_xor_si512(_mm512_srli_epi16(z, 1), sign));
+#else
+                uint16_t z[LANES] = {};
+                for (uint8_t k = 0; k < b; ++k)
+                {
+                    uint32_t plane;
+                    std::memcpy(&plane, p, 4);
+                    p += 4;
+                    for (size_t i = 0; i < LANES; ++i)
+                    {
+                        z[i] |= (uint16_t)(((plane >> i) & 1U) << k);
+                    }
+                }
+                for (size_t i = 0; i < LANES; ++i)
+                {
+                    int16_t v = unzigzag(z[i]);
+                    std::memcpy(out + g + 2 * i, &v, 2);
+                }
+#endif
+            }
+            return p == end;
+        }
+    }
+}
@@ -0,0 +1,373 @@
+#pragma once
+#include "SketchCodec.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utils
+{
+    /**
+     * @brief Sketch types that can be persisted
+     */
+    enum class SketchKind : uint32_t
+    {
+        HDSketchAVX512 = 1,
+        MurmurCountMinSketch = 2,
+    };
+
+    /**
+     * @brief On-disk header of a persisted sketch
+     * The file is the header, seed_count 32-bit seeds, then height rows of
+     * row_bytes each, starting at data_offset. Offsets and rows are 64-byte
+     * aligned, so counters can be used in place from a mapping.
+     */
+    struct SketchHeader
+    {
+        static constexpr char MAGIC[8] = {'H', 'D', 'S', 'K', 'E', 'T', 'C', 'H'};
+        static constexpr char COMPRESSED_MAGIC[8] = {'H', 'D', 'S', 'K', 'E', 'T', 'C', 'Z'};
+        static constexpr uint32_t VERSION = 1;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t kind;
+        uint64_t width;         // buckets, or counters per row
+        uint64_t height;        // rows
+        uint32_t cell_bits;     // bits per counter
+        uint32_t seed_count;
+        uint64_t row_bytes;     // bytes per row, a multiple of 64
+        uint64_t data_offset;
+    };
+
+    /**
+     * @brief Follows the seeds in a compressed sketch file
+     * The rows are cut into blocks of at most block_bytes, which never span
+     * two rows, and every block is encoded on its own so that blocks can be
+     * decoded in parallel. offsets[blocks + 1], relative to the first block,
+     * come next. Header fields describe the decoded layout.
+     */
+    struct CompressedHeader
+    {
+        static constexpr uint32_t RAW = 0;          // blocks are stored as is
+        static constexpr uint32_t BITPLANE16 = 1;   // see SketchCodec.hh
+
+        uint32_t codec;
+        uint32_t reserved;
+        uint64_t block_bytes;
+        uint64_t blocks;
+    };
+
+    inline size_t align64(size_t n) { return (n + 63) / 64 * 64; }
+
+    /**
+     * @brief Runs f(i) for i in [0, n) on up to all cores
+     */
+    template <typename F>
+    void parallel_blocks(size_t n, F f)
+    {
+        size_t threads = std::min<size_t>(n, std::max(1U, std::thread::hardware_concurrency()));
+        if (threads <= 1)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                f(i);
+            }
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t]()
+            {
+                for (size_t i = t; i < n; i += threads)
+                {
+                    f(i);
+                }
+            });
+        }
+        for (auto& it : workers)
+        {
+            it.join();
+        }
+    }
+
+    /**
+     * @brief Writes a compressed sketch file; throws std::runtime_error on I/O errors
+     * int16 counters are bit-plane coded, other widths are stored raw.
+     */
+    inline void write_compressed_sketch(const SketchHeader& raw, const std::string& path,
+        const std::vector<uint32_t>& seeds, const std::vector<const void*>& rows, size_t row_size)
+    {
+        static constexpr size_t BLOCK_BYTES = 1U << 16U;
+        SketchHeader h = raw;
+        std::memcpy(h.magic, SketchHeader::COMPRESSED_MAGIC, sizeof(h.magic));
+        CompressedHeader c;
+        c.codec = h.cell_bits == 16 ? CompressedHeader::BITPLANE16 : CompressedHeader::RAW;
+        c.reserved = 0;
+        c.block_bytes = BLOCK_BYTES;
+        size_t per_row = (h.row_bytes + BLOCK_BYTES - 1) / BLOCK_BYTES;
+        c.blocks = per_row * rows.size();
+
+        std::vector<std::vector<char>> encoded(c.blocks);
+        parallel_blocks(c.blocks, [&](size_t b)
+        {
+            size_t r = b / per_row;
+            size_t begin = b % per_row * BLOCK_BYTES;
+            size_t n = std::min<size_t>(BLOCK_BYTES, h.row_bytes - begin);
+
+            // the zero padding of the row is part of its last block
+            std::vector<char> raw_block(n, 0);
+            if (begin < row_size)
+                std::memcpy(raw_block.data(), (const char*)rows[r] + begin, std::min(n, row_size - begin));
+            if (c.codec == CompressedHeader::RAW)
+            {
+                encoded[b] = std::move(raw_block);
+                return;
+            }
+            encoded[b].resize(bitplane::max_encoded(n));
+            encoded[b].resize(bitplane::encode(raw_block.data(), n, encoded[b].data()));
+        });
+
+        std::vector<uint64_t> offsets(c.blocks + 1, 0);
+        for (size_t b = 0; b < c.blocks; ++b)
+        {
+            offsets[b + 1] = offsets[b] + encoded[b].size();
+        }
+
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f)
+            throw std::runtime_error("cannot create " + path + ": " + std::strerror(errno));
+        bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1
+            && std::fwrite(seeds.data(), sizeof(uint32_t), seeds.size(), f) == seeds.size()
+            && std::fwrite(&c, sizeof(c), 1, f) == 1
+            && std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f) == offsets.size();
+        for (size_t b = 0; ok && b < c.blocks; ++b)
+        {
+            ok = std::fwrite(encoded[b].data(), 1, encoded[b].size(), f) == encoded[b].size();
+        }
+        ok = std::fclose(f) == 0 && ok;
+        if (!ok)
+            throw std::runtime_error("cannot write " + path);
+    }
+
+    /**
+     * @brief Writes a sketch file; throws std::runtime_error on I/O errors
+     * @param rows one pointer per row
+     * @param row_size bytes of each row; rows are padded to 64 bytes in the file
+     * @param compressed write the compressed format, which MappedSketch decodes on load
+     */
+    inline void write_sketch(const std::string& path, SketchKind kind, uint64_t width, uint32_t cell_bits,
+        const std::vector<uint32_t>& seeds, const std::vector<const void*>& rows, size_t row_size,
+        bool compressed = false)
+    {
+        SketchHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, SketchHeader::MAGIC, sizeof(h.magic));
+        h.version = SketchHeader::VERSION;
+        h.kind = (uint32_t)kind;
+        h.width = width;
+        h.height = rows.size();
+        h.cell_bits = cell_bits;
+        h.seed_count = seeds.size();
+        h.row_bytes = align64(row_size);
+        h.data_offset = align64(sizeof(h) + seeds.size() * sizeof(uint32_t));
+        if (compressed)
+        {
+            write_compressed_sketch(h, path, seeds, rows, row_size);
+            return;
+        }
+
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f)
+            throw std::runtime_error("cannot create " + path + ": " + std::strerror(errno));
+
+        static const char zeros[64] = {};
+        size_t pad = h.data_offset - sizeof(h) - seeds.size() * sizeof(uint32_t);
+        bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1
+            && std::fwrite(seeds.data(), sizeof(uint32_t), seeds.size(), f) == seeds.size()
+            && std::fwrite(zeros, 1, pad, f) == pad;
+        for (size_t i = 0; ok && i < rows.size(); ++i)
+        {
+            ok = std::fwrite(rows[i], 1, row_size, f) == row_size
+                && std::fwrite(zeros, 1, h.row_bytes - row_size, f) == h.row_bytes - row_size;
+        }
+        ok = std::fclose(f) == 0 && ok;
+        if (!ok)
+            throw std::runtime_error("cannot write " + path);
+    }
+
+    /**
+     * @brief Reads the kind of a sketch file; throws std::runtime_error if it is not one
+     */
+    inline SketchKind sketch_kind(const std::string& path)
+    {
+        SketchHeader h;
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f)
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        bool ok = std::fread(&h, sizeof(h), 1, f) == 1;
+        std::fclose(f);
+        if (!ok || (std::memcmp(h.magic, SketchHeader::MAGIC, sizeof(h.magic)) != 0
+            && std::memcmp(h.magic, SketchHeader::COMPRESSED_MAGIC, sizeof(h.magic)) != 0))
+            throw std::runtime_error(path + " is not a sketch file");
+        return (SketchKind)h.kind;
+    }
+
+    /**
+     * @brief A sketch file mapped copy-on-write
+     * Pages stay shared with the page cache, and with every other process
+     * mapping the file, until they are written. Compressed files are decoded
+     * in parallel into private memory of the same layout instead.
+     */
+    class MappedSketch
+    {
+        public:
+        /**
+         * @param path the sketch file
+         * @param kind expected kind; throws std::runtime_error on mismatch
+         */
+        MappedSketch(const std::string& path, SketchKind kind) : base(nullptr), length(0)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SketchHeader))
+            {
+                ::close(fd);
+                throw std::runtime_error(path + " is not a sketch file");
+            }
+            length = st.st_size;
+            void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+            base = (char*)p;
+            if (std::memcmp(header().magic, SketchHeader::COMPRESSED_MAGIC, sizeof(header().magic)) == 0)
+            {
+                decompress(path);
+            }
+
+            const SketchHeader& h = header();
+            // checked in an order that cannot wrap around: the seeds stay in bounds,
+            // then the rows, sized by division
+            if (std::memcmp(h.magic, SketchHeader::MAGIC, sizeof(h.magic)) != 0 || h.version != SketchHeader::VERSION
+                || h.data_offset < sizeof(SketchHeader) + (uint64_t)h.seed_count * sizeof(uint32_t)
+                || h.data_offset % 64 != 0 || h.row_bytes == 0 || h.row_bytes % 64 != 0 || h.data_offset > length
+                || h.height > (length - h.data_offset) / h.row_bytes)
+            {
+                release();
+                throw std::runtime_error(path + " is not a sketch file");
+            }
+            if (h.kind != (uint32_t)kind)
+            {
+                release();
+                throw std::runtime_error(path + " holds a different kind of sketch");
+            }
+        }
+
+        ~MappedSketch()
+        {
+            release();
+        }
+
+        MappedSketch(const MappedSketch&) = delete;
+        MappedSketch& operator=(const MappedSketch&) = delete;
+
+        const SketchHeader& header() const { return *(const SketchHeader*)base; }
+
+        const uint32_t* seeds() const { return (const uint32_t*)(base + sizeof(SketchHeader)); }
+
+        char* row(size_t i) { return base + header().data_offset + i * header().row_bytes; }
+
+        protected:
+        char* base;
+        size_t length;
+
+        /**
+         * @brief Replaces the mapping of a compressed file by its decoded layout
+         */
+        void decompress(const std::string& path)
+        {
+            const char* in = base;
+            size_t in_length = length;
+            SketchHeader h = header();
+            size_t seeds_end = sizeof(h) + h.seed_count * sizeof(uint32_t);
+            CompressedHeader c;
+            size_t per_row = 0;
+            bool ok = h.version == SketchHeader::VERSION && h.data_offset >= seeds_end && h.row_bytes % 64 == 0
+                && in_length >= seeds_end + sizeof(c);
+            if (ok)
+            {
+                std::memcpy(&c, in + seeds_end, sizeof(c));
+                per_row = c.block_bytes ? (h.row_bytes + c.block_bytes - 1) / c.block_bytes : 0;
+                ok = c.block_bytes > 0 && c.block_bytes % 64 == 0 && c.blocks == per_row * h.height
+                    && (in_length - seeds_end - sizeof(c)) / sizeof(uint64_t) > c.blocks;
+            }
+            if (!ok)
+            {
+                release();
+                throw std::runtime_error(path + " is not a valid compressed sketch file");
+            }
+
+            size_t decoded = h.data_offset + h.height * h.row_bytes;
+            void* p = mmap(nullptr, decoded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+            {
+                release();
+                throw std::runtime_error("cannot allocate " + std::to_string(decoded) + " bytes for " + path);
+            }
+            char* out = (char*)p;
+            std::memcpy(out, in, seeds_end);
+            std::memcpy(out, SketchHeader::MAGIC, sizeof(h.magic));
+
+            const char* table = in + seeds_end + sizeof(c);
+            const char* payload = table + (c.blocks + 1) * sizeof(uint64_t);
+            size_t payload_length = in + in_length - payload;
+            std::vector<char> failed(c.blocks, 0);
+            parallel_blocks(c.blocks, [&](size_t b)
+            {
+                uint64_t begin, end;
+                std::memcpy(&begin, table + b * sizeof(uint64_t), sizeof(uint64_t));
+                std::memcpy(&end, table + (b + 1) * sizeof(uint64_t), sizeof(uint64_t));
+                size_t offset = b % per_row * c.block_bytes;
+                size_t n = std::min<size_t>(c.block_bytes, h.row_bytes - offset);
+                char* dst = out + h.data_offset + b / per_row * h.row_bytes + offset;
+                if (begin > end || end > payload_length)
+                    failed[b] = 1;
+                else if (c.codec == CompressedHeader::RAW && end - begin == n)
+                    std::memcpy(dst, payload + begin, n);
+                else if (c.codec == CompressedHeader::BITPLANE16)
+                    failed[b] = !bitplane::decode(payload + begin, end - begin, dst, n);
+                else
+                    failed[b] = 1;
+            });
+
+            release();
+            base = out;
+            length = decoded;
+            if (std::count(failed.begin(), failed.end(), 1))
+            {
+                release();
+                throw std::runtime_error(path + " is corrupt");
+            }
+        }
+
+        void release()
+        {
+            if (base)
+                munmap(base, length);
+            base = nullptr;
+        }
+    };
+}
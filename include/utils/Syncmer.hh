@@ -0,0 +1,276 @@
+#pragma once
+#include "utils.hh"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+
+namespace utils
+{
+    /**
+     * @brief Closed syncmer sampling of 128-mers
+     * A 128-mer is made of w overlapping s-mers, s = 129 - w. It is sampled
+     * if its smallest s-mer hash is the first or the last one, which keeps
+     * about 2 / w of the k-mers and leaves no gap longer than w - 1 k-mers.
+     * Unlike minimizers the decision depends on the k-mer alone, so
+     * every occurrence of a sampled k-mer is counted, and a query key can be
+     * tested with selected(); SampledSketch does so for a whole sketch.
+     * s-mers are hashed with an ntHash-style rolling hash; a stream is
+     * sampled with a SIMD sliding-window minimum over (hash, position) words,
+     * so ties go to the leftmost s-mer in both paths.
+     * Bases are 2-bit codes packed 16 per word, base i at bits 2 * (i % 16),
+     * the layout of Fasta and Compressed128Mer.
+     */
+    class SyncmerSampler
+    {
+        public:
+        static constexpr size_t K = 128;
+        static constexpr size_t MAX_WINDOW = 112;
+
+        /**
+         * @param window s-mers per k-mer, in [2, 112]; shorter s-mers tie too often
+         */
+        SyncmerSampler(size_t window) : w(window), s(K + 1 - window)
+        {
+            if (window < 2 || window > MAX_WINDOW)
+                throw std::invalid_argument("syncmer window must be in [2, 112]");
+        }
+
+        size_t window() const { return w; }
+
+        /**
+         * @brief Expected fraction of sampled k-mers on random sequence
+         */
+        double density() const { return 2.0 / w; }
+
+        /**
+         * @brief Whether the k-mer is sampled
+         */
+        bool selected(const Compressed128Mer& kmer) const
+        {
+            uint64_t h = first(kmer.u32, 0);
+            uint64_t min = pack(h, 0);
+            for (size_t i = 1; i < w; ++i)
+            {
+                h = roll(h, kmer.u32, i - 1);
+                min = std::min(min, pack(h, i));
+            }
+            uint32_t pos = (uint32_t)min;
+            return pos == 0 || pos == w - 1;
+        }
+
+        /**
+         * @brief Start positions of the sampled 128-mers of a sequence, ascending
+         * @param packed the bases
+         * @param n number of bases, below 2^32
+         */
+        std::vector<uint32_t> select(const uint32_t* packed, size_t n) const
+        {
+            std::vector<uint32_t> result;
+            if (n < K)
+                return result;
+            size_t kmers = n - K + 1;
+            size_t smers = n - s + 1;
+
+            // buf[j] is s-mer c + j of the current chunk
+            std::vector<uint64_t> buf(CHUNK + w - 1);
+            std::vector<uint64_t> mins(CHUNK + w - 1);
+            std::vector<uint64_t> carry(w - 1);
+            uint64_t h = first(packed, 0);
+            size_t next = 0;
+            size_t filled = 0;
+            for (size_t c = 0; c < kmers; c += CHUNK)
+            {
+                size_t m = std::min(CHUNK, kmers - c);
+                if (c)
+                {
+                    std::copy(carry.begin(), carry.end(), buf.begin());
+                    filled = w - 1;
+                }
+                for (; filled < m + w - 1; ++filled, ++next)
+                {
+                    buf[filled] = pack(h, next);
+                    if (next + 1 < smers)
+                        h = roll(h, packed, next);
+                }
+                // window_min overwrites buf, so the hashes the next chunk shares are kept first
+                std::copy(buf.begin() + m, buf.begin() + m + w - 1, carry.begin());
+                window_min(buf.data(), m + w - 1, mins.data());
+                for (size_t i = 0; i < m; ++i)
+                {
+                    uint32_t pos = (uint32_t)mins[i];
+                    if (pos == c + i || pos == c + i + w - 1)
+                        result.push_back(c + i);
+                }
+            }
+            return result;
+        }
+
+        protected:
+        static constexpr size_t CHUNK = 1 << 14;
+
+        // ntHash seeds of A, C, G and T
+        static constexpr uint64_t SEED[4] = {0x3c8bfbb395c60474ULL, 0x3193c18562a02b4cULL,
+            0x20323ed082572324ULL, 0x295549f54be24456ULL};
+
+        const size_t w;
+        const size_t s;
+
+        static uint32_t base(const uint32_t* packed, size_t i)
+        {
+            return (packed[i / 16] >> (i % 16 * 2)) & 3U;
+        }
+
+        static uint64_t rol(uint64_t x, size_t r)
+        {
+            r %= 64;
+            return r ? (x << r) | (x >> (64 - r)) : x;
+        }
+
+        /**
+         * @brief Hash of the s-mer at position i
+         */
+        uint64_t first(const uint32_t* packed, size_t i) const
+        {
+            uint64_t h = 0;
+            for (size_t j = 0; j < s; ++j)
+            {
+                h ^= rol(SEED[base(packed, i + j)], s - 1 - j);
+            }
+            return h;
+        }
+
+        /**
+         * @brief Hash of the s-mer at i + 1 from the hash h of the s-mer at i
+         */
+        uint64_t roll(uint64_t h, const uint32_t* packed, size_t i) const
+        {
+            return rol(h, 1) ^ rol(SEED[base(packed, i)], s) ^ SEED[base(packed, i + s)];
+        }
+
+        /**
+         * @brief Mixed 32-bit hash above the s-mer position, so minima break ties leftmost
+         */
+        static uint64_t pack(uint64_t h, size_t pos)
+        {
+            return ((h * 0x9E3779B97F4A7C15ULL) & 0xFFFFFFFF00000000ULL) | pos;
+        }
+
+        /**
+         * @brief a[i] = min(a[i], a[i + p]) for i < n
+         */
+        static void min_shift(uint64_t* a, size_t n, size_t p)
+        {
+            size_t i = 0;
+#if defined(__AVX512F__)
+            for (; i + 8 <= n; i += 8)
+            {
+                __m512i x = _mm512_loadu_si512(a + i);
+                __m512i y = _mm512_loadu_si512(a + i + p);
+                _mm512_storeu_si512(a + i, _mm512_maskz_min_epu64(0xFF, x, y));
+            }
+#endif
+            for (; i < n; ++i)
+            {
+                a[i] = std::min(a[i], a[i + p]);
+            }
+        }
+
+        /**
+         * @brief out[i] = min(a[i .. i + w - 1]) for every full window of a[0 .. n)
+         * Minima over power-of-two spans are built by doubling, and a window
+         * is the minimum of two overlapping spans. a is overwritten.
+         */
+        void window_min(uint64_t* a, size_t n, uint64_t* out) const
+        {
+            size_t p = 1;
+            while (2 * p <= w)
+            {
+                min_shift(a, n - p, p);
+                n -= p;
+                p *= 2;
+            }
+            size_t m = n - (w - p);
+            size_t i = 0;
+#if defined(__AVX512F__)
+            for (; i + 8 <= m; i += 8)
+            {
+                __m512i x = _mm512_loadu_si512(a + i);
+                __m512i y = _mm512_loadu_si512(a + i + w - p);
+                _mm512_storeu_si512(out + i, _mm512_maskz_min_epu64(0xFF, x, y));
+            }
+#endif
+            for (; i < m; ++i)
+            {
+                out[i] = std::min(a[i], a[i + w - p]);
+            }
+        }
+    };
+
+    /**
+     * @brief Estimate of a k-mer that a sampled sketch holds no count of
+     * Not NaN, which -ffast-math builds cannot test for.
+     */
+    constexpr double UNSAMPLED = -std::numeric_limits<double>::max();
+
+    /**
+     * @brief Queries a sketch built from the syncmers of a SyncmerSampler
+     * Such a sketch holds no counts of the other k-mers, whose estimates
+     * would be collision noise alone. Only selected keys are passed to the
+     * sketch; the others are reported as UNSAMPLED.
+     * @param S any sketch with estimate and estimate_batch
+     */
+    template<typename S>
+    class SampledSketch
+    {
+        public:
+        /**
+         * @param sketch the sketch, kept by reference
+         * @param sampler the sampler the sketch was built with
+         */
+        SampledSketch(const S& sketch, const SyncmerSampler& sampler) : sketch(sketch), sampler(sampler) {}
+
+        double estimate(const Compressed128Mer& key) const
+        {
+            return sampler.selected(key) ? (double)sketch.estimate(key) : UNSAMPLED;
+        }
+
+        /**
+         * @brief Estimates the selected keys in one batch of the sketch
+         * @param keys the query keys
+         * @param n number of keys
+         * @param out n estimates, UNSAMPLED for keys not selected
+         */
+        void estimate_batch(const Compressed128Mer* keys, size_t n, double* out) const
+        {
+            using E = decltype(sketch.estimate(std::declval<const Compressed128Mer&>()));
+            std::vector<Compressed128Mer> kept;
+            std::vector<size_t> where;
+            for (size_t i = 0; i < n; ++i)
+            {
+                out[i] = UNSAMPLED;
+                if (sampler.selected(keys[i]))
+                {
+                    kept.push_back(keys[i]);
+                    where.push_back(i);
+                }
+            }
+            if (kept.empty())
+                return;
+            std::vector<E> est(kept.size());
+            sketch.estimate_batch(kept.data(), kept.size(), est.data());
+            for (size_t j = 0; j < kept.size(); ++j)
+            {
+                out[where[j]] = est[j];
+            }
+        }
+
+        protected:
+        const S& sketch;
+        const SyncmerSampler& sampler;
+    };
+}
@@ -1,17 +1,30 @@
 #pragma once
 #include "utils.hh"
 #include <string>
+#include <vector>
 
 using utils::Compressed128Mer;
 
 class Fasta
 {
     public:
+    /**
+     * @brief A record of the sequence, starting at a word boundary
+     */
+    struct Record
+    {
+        size_t offset;  // first base, a multiple of 16
+        size_t length;  // bases
+    };
+
     /**
      * @brief Constructor, reads fasta to CPU memory
      * @param path Path to fasta file
+     * @param all_records read every record, each padded to a word boundary,
+     * instead of the first only; k-mers read across a record end are not
+     * in the file, so iterate over records()
      */
-    Fasta(std::string path);
+    Fasta(std::string path, bool all_records = false);
 
     /**
      * @brief Reads Compressed128Mer
@@ -22,7 +35,15 @@ class Fasta
 
     size_t size() const {return sz;}
 
+    /**
+     * @brief The 2-bit bases, 16 per word, base i at bits 2 * (i % 16)
+     */
+    const uint32_t* data() const {return compressed.data();}
+
+    const std::vector<Record>& records() const {return recs;}
+
     protected:
     size_t sz;
-    uint32_t* compressed;
+    std::vector<uint32_t> compressed;
+    std::vector<Record> recs;
 };
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+
+namespace utils
+{
+    /**
+     * @brief SplitMix64 finalizer, a cheap 64-bit bijective mixer
+     * @param x input word
+     * @return mixed word
+     */
+    inline uint64_t splitmix64(uint64_t x)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30U)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27U)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31U);
+    }
+
+    /**
+     * @brief Counter-based generator: output i of a stream is a pure function
+     * of (key, stream, i), so streams can be split across threads and any
+     * trial can be reproduced without replaying the ones before it.
+     * Satisfies UniformRandomBitGenerator.
+     */
+    class CounterRng
+    {
+        public:
+        using result_type = uint64_t;
+
+        CounterRng(uint64_t key, uint64_t stream = 0)
+            : base(splitmix64(key ^ splitmix64(stream))), counter(0) {}
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+        result_type operator()()
+        {
+            return splitmix64(base + 0x9E3779B97F4A7C15ULL * counter++);
+        }
+
+        protected:
+        uint64_t base;
+        uint64_t counter;
+    };
+
+    /**
+     * @brief wyrand, a tiny 64-bit generator for hot update paths
+     * Satisfies UniformRandomBitGenerator so it can feed std distributions.
+     */
+    class WyRand
+    {
+        public:
+        using result_type = uint64_t;
+
+        WyRand(uint64_t seed = 0) : state(seed) {}
+
+        void seed(uint64_t s) { state = s; }
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+        result_type operator()()
+        {
+            state += 0xA0761D6478BD642FULL;
+            __uint128_t t = (__uint128_t)state * (state ^ 0xE7037ED1A0B428DBULL);
+            return (uint64_t)(t >> 64U) ^ (uint64_t)t;
+        }
+
+        protected:
+        uint64_t state;
+    };
+}
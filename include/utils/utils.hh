@@ -17,10 +17,10 @@ namespace utils
 
     /**
      * @brief Load Compressed128Mer from global string
-     * @param data global string
-     * @param offset
-     * @param out the 128Mer
+     * @param data global string, 16 2-bit bases per word
+     * @param offset position of the first base
+     * @param out the 128Mer, base i at bits 2 * (i % 16) of word i / 16
      */
-    void Read128Mer(uint32_t* data, uint32_t offset, Compressed128Mer& out);
+    void Read128Mer(const uint32_t* data, uint32_t offset, Compressed128Mer& out);
 }
 
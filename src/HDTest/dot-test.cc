@@ -1,67 +1,272 @@
-#include "BehavioralHD/RandomModelHD.hh"
+#include "BehavioralHD/Kernels.hh"
+#include "utils/random.hh"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 using namespace std;
 
-template <size_t D>
-double gen_square_err(size_t conflicts, mt19937_64& gen)
+/**
+ * @brief One point of the sweep
+ */
+struct Experiment
 {
-    using RandHD = RandomModelHD<int16_t, D>;
-    const int multiplicity = 16;
+    size_t dim;
+    size_t conflicts;
+    size_t multiplicity;
+    size_t lane_bits;
+};
 
-    ModelHD<int16_t, D> class_hv;
-    RandHD query_hv(gen);
+struct Options
+{
+    vector<size_t> dims = {16, 32, 64, 128, 256, 512, 1024};
+    vector<size_t> conflicts = {32};
+    vector<size_t> multiplicities = {16};
+    vector<size_t> lane_bits = {16};
+    size_t trials = 10000;
+    size_t threads = 0;
+    uint64_t seed = 0;
+};
 
-    class_hv += query_hv;
-    class_hv *= multiplicity;
+string usage(const char* prog)
+{
+    stringstream ss;
+    ss << "Usage: " << prog << " [options]\n"
+       << "Monte Carlo error of one dot-product query against a bundled class vector:\n"
+       << "the class is multiplicity * query + conflicts random vectors.\n"
+       << "  --dims LIST           dimensions, any positive size (default 16,32,...,1024)\n"
+       << "  --conflicts LIST      random vectors bundled with the query (default 32)\n"
+       << "  --multiplicity LIST   weight of the query in the bundle (default 16)\n"
+       << "  --lane-bits LIST      class vector lanes: 16 or 32 wrap around like the\n"
+       << "                        sketch's counters, 64 is exact (default 16)\n"
+       << "  --trials N            trials per configuration (default 10000)\n"
+       << "  --threads N           worker threads, 0 = all cores (default 0)\n"
+       << "  --seed N              RNG seed, 0 = random (default 0)\n";
+    return ss.str();
+}
 
-    for (size_t i = 0; i < conflicts; ++i)
+vector<size_t> parse_list(const string& s)
+{
+    vector<size_t> result;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ','))
     {
-        RandHD noise(gen);
-        class_hv += noise;
+        size_t pos;
+        unsigned long long v = stoull(item, &pos);
+        if (pos != item.size())
+            throw invalid_argument("not a number: " + item);
+        result.push_back(v);
     }
+    if (result.empty())
+        throw invalid_argument("empty list: " + s);
+    return result;
+}
 
-    double res = class_hv.dot(query_hv) / D;
-    double square_error = res - multiplicity;
-    square_error *= square_error;
+size_t parse_size(const string& s)
+{
+    size_t pos;
+    unsigned long long v = stoull(s, &pos);
+    if (pos != s.size())
+        throw invalid_argument("not a number: " + s);
+    return v;
+}
 
-    return square_error;
+Options parse(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+            throw invalid_argument("missing value for " + arg);
+        string val = argv[++i];
+
+        if (arg == "--dims")
+            opt.dims = parse_list(val);
+        else if (arg == "--conflicts")
+            opt.conflicts = parse_list(val);
+        else if (arg == "--multiplicity")
+            opt.multiplicities = parse_list(val);
+        else if (arg == "--lane-bits")
+            opt.lane_bits = parse_list(val);
+        else if (arg == "--trials")
+            opt.trials = parse_size(val);
+        else if (arg == "--threads")
+            opt.threads = parse_size(val);
+        else if (arg == "--seed")
+            opt.seed = parse_size(val);
+        else
+            throw invalid_argument("unknown option " + arg);
+    }
+    for (auto d : opt.dims)
+    {
+        if (d == 0)
+            throw invalid_argument("dimensions must be positive");
+    }
+    for (auto b : opt.lane_bits)
+    {
+        if (b != 16 && b != 32 && b != 64)
+            throw invalid_argument("lane bits must be 16, 32 or 64");
+    }
+    if (opt.trials == 0)
+        throw invalid_argument("trials must be positive");
+    return opt;
+}
+
+/**
+ * @brief Draws a random bipolar vector as bits, 64 signs per random word
+ */
+void random_bits(utils::CounterRng& rng, vector<uint64_t>& bits, size_t dim)
+{
+    for (auto& it : bits)
+    {
+        it = rng();
+    }
+    if (dim % 64 != 0)
+    {
+        bits.back() &= (1ULL << (dim % 64)) - 1;
+    }
 }
 
-template <size_t D>
-double run(mt19937_64& gen)
+/**
+ * @brief Adds m times a bipolar vector given as bits, wrapping around as the lanes do
+ */
+template <typename T>
+void add_weighted(T* acc, const uint64_t* bits, size_t dim, int64_t m)
 {
-    double sum_square_err = 0;
-    const int times = 10000;
-    const size_t conflicts = 32;
+    using U = typename make_unsigned<T>::type;
+    for (size_t i = 0; i < dim; ++i)
+    {
+        U w = (bits[i / 64] >> (i % 64)) & 1U ? (U)m : (U)-m;
+        acc[i] = (T)(U)((U)acc[i] + w);
+    }
+}
 
-    for (int j = 0; j < times; ++j)
+/**
+ * @brief Noise term of one trial, the error of the estimate times dim
+ * dot(class, query) = multiplicity * dim + sum of dot(noise, query), and every
+ * noise term is dim - 2 * hamming(noise, query), so the class vector is never
+ * materialized and the arithmetic is exact.
+ */
+int64_t trial_noise(const Experiment& e, utils::CounterRng& rng, vector<uint64_t>& query, vector<uint64_t>& noise)
+{
+    random_bits(rng, query, e.dim);
+    int64_t sum = 0;
+    for (size_t i = 0; i < e.conflicts; ++i)
     {
-        sum_square_err += gen_square_err<D>(conflicts, gen);
+        random_bits(rng, noise, e.dim);
+        sum += (int64_t)e.dim - 2 * (int64_t)hd::hamming(noise.data(), query.data(), noise.size());
     }
-    double mse = sum_square_err / times;
-    return mse;
+    return sum;
 }
 
-int main()
+/**
+ * @brief Noise term of one trial with the class vector bundled in T lanes
+ * The same vectors as the exact trial are bundled with the kernels of
+ * ModelHD, so lanes that wrap around at high multiplicity show as error.
+ */
+template <typename T>
+int64_t trial_noise(const Experiment& e, utils::CounterRng& rng, vector<uint64_t>& query, vector<uint64_t>& noise,
+    vector<T>& cls)
 {
-    random_device rd;
-    mt19937_64 gen(rd());
+    random_bits(rng, query, e.dim);
+    fill(cls.begin(), cls.end(), 0);
+    for (size_t i = 0; i < e.conflicts; ++i)
+    {
+        random_bits(rng, noise, e.dim);
+        hd::add_bits(cls.data(), noise.data(), e.dim);
+    }
+    add_weighted(cls.data(), query.data(), e.dim, e.multiplicity);
+    return (int64_t)hd::dot_bits(cls.data(), query.data(), e.dim) - (int64_t)(e.multiplicity * e.dim);
+}
 
-    constexpr size_t dimensions[] = {16, 32, 64, 128, 256, 512, 1024};
-    vector<double> mse;
+/**
+ * @brief Mean squared error of the estimate dot(class, query) / dim
+ * Trial t always draws from stream t of the configuration's key, so the
+ * result does not depend on the number of threads.
+ */
+double run(const Experiment& e, const Options& opt, size_t threads)
+{
+    uint64_t key = utils::splitmix64(opt.seed ^ utils::splitmix64(e.dim
+        ^ utils::splitmix64(e.conflicts ^ utils::splitmix64(e.multiplicity))));
 
-    mse.push_back(run<dimensions[0]>(gen));
-    mse.push_back(run<dimensions[1]>(gen));
-    mse.push_back(run<dimensions[2]>(gen));
-    mse.push_back(run<dimensions[3]>(gen));
-    mse.push_back(run<dimensions[4]>(gen));
-    mse.push_back(run<dimensions[5]>(gen));
-    mse.push_back(run<dimensions[6]>(gen));
+    // squared noise sums, exact in 128 bits
+    vector<unsigned __int128> partial(threads);
+    vector<thread> workers;
+    size_t slice = (opt.trials + threads - 1) / threads;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]()
+        {
+            size_t words = (e.dim + 63) / 64;
+            vector<uint64_t> query(words), noise(words);
+            vector<int16_t> cls16(e.lane_bits == 16 ? e.dim : 0);
+            vector<int32_t> cls32(e.lane_bits == 32 ? e.dim : 0);
+            unsigned __int128 sum = 0;
+            for (size_t i = t * slice; i < min(opt.trials, (t + 1) * slice); ++i)
+            {
+                utils::CounterRng rng(key, i);
+                int64_t err;
+                if (e.lane_bits == 16)
+                    err = trial_noise(e, rng, query, noise, cls16);
+                else if (e.lane_bits == 32)
+                    err = trial_noise(e, rng, query, noise, cls32);
+                else
+                    err = trial_noise(e, rng, query, noise);
+                sum += (unsigned __int128)(err < 0 ? -err : err) * (uint64_t)(err < 0 ? -err : err);
+            }
+            partial[t] = sum;
+        });
+    }
+    unsigned __int128 total = 0;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers[t].join();
+        total += partial[t];
+    }
+    return (double)total / ((double)e.dim * e.dim) / opt.trials;
+}
 
-    for (int i = 0; i < mse.size(); ++i)
+int main(int argc, char** argv)
+{
+    Options opt;
+    try
+    {
+        opt = parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << "\n" << usage(argv[0]);
+        return 1;
+    }
+    if (opt.seed == 0)
     {
-        cout << mse[i] << ", ";
+        random_device rd;
+        opt.seed = ((uint64_t)rd() << 32U) | rd();
     }
-    cout << endl;
-}
\ No newline at end of file
+    size_t threads = opt.threads ? opt.threads : max(1U, thread::hardware_concurrency());
+    threads = min(threads, opt.trials);
+
+    // expected mse without wrap-around: each noise dot has variance dim, so conflicts / dim
+    cout << right << setw(8) << "dim" << setw(11) << "conflicts" << setw(14) << "multiplicity" << setw(11) << "lane_bits"
+         << setw(10) << "trials" << setw(14) << "mse" << setw(14) << "expected" << setw(12) << "rel_rmse" << "\n";
+    for (auto d : opt.dims)
+        for (auto c : opt.conflicts)
+            for (auto m : opt.multiplicities)
+                for (auto b : opt.lane_bits)
+                {
+                    Experiment e = {d, c, m, b};
+                    double mse = run(e, opt, threads);
+                    cout << setw(8) << d << setw(11) << c << setw(14) << m << setw(11) << b << setw(10) << opt.trials
+                         << setw(14) << setprecision(6) << mse << setw(14) << (double)c / d
+                         << setw(12) << (m ? sqrt(mse) / m : 0) << "\n";
+                }
+}
@@ -1,14 +1,32 @@
 #include "CountMinSketch/ModuloCountMinSketch.hh"
 #include "CountMinSketch/MurmurCountMinSketch.hh"
+#include "CountMinSketch/CountSketch.hh"
 #include "HDSketch/HDSketch.hh"
 #include "HDSketch/HDSketchAVX512.hh"
+#include "HDSketch/SnapshotHDSketchAVX512.hh"
+#include "HDSketch/TwoChoiceHDSketchAVX512.hh"
+#include "benchmarks/Evaluator.hh"
+#include "benchmarks/Options.hh"
+#include "benchmarks/PerfCounters.hh"
+#include "benchmarks/Report.hh"
+#include "benchmarks/Workload.hh"
 #include "utils/fasta.hh"
+#include "utils/FlatHashMap.hh"
+#include "utils/FrontCache.hh"
+#include "utils/SingletonFilter.hh"
+#include "utils/Syncmer.hh"
 #include <iostream>
+#include <fstream>
 #include <cstdlib>
 #include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
 #include <unordered_map>
 #include <algorithm>
 using namespace std;
+using namespace bench;
+using utils::FlatHashMap;
 
 template <typename T>
 struct MurmurHash
@@ -21,203 +39,497 @@ struct MurmurHash
     }
 };
 
-int main(int argc, char** argv)
-{
-    if (argc != 3)
-    {
-        cerr << "Usage: " << argv[0] << " <fasta-file> <load-factor>" << endl;
-        exit(1);
-    }
+using ExactMap = unordered_map<Compressed128Mer, uint32_t, MurmurHash<Compressed128Mer>>;
 
-    Fasta fa(argv[1]);
-    double load_factor = strtod(argv[2], nullptr);
-    size_t num_128mers = fa.size() - 127;
+/**
+ * @brief Exact counting with a node-based std::unordered_map, for reference
+ */
+class NodeExactCounter
+{
+    public:
+    NodeExactCounter(size_t n) { dict.reserve(2 * n); }
 
-    cerr << "unordered map 0.5x ..." << endl;
+    void insert(const Compressed128Mer& key) { dict[key] += 1; }
 
-    unordered_map<Compressed128Mer, int16_t, MurmurHash<Compressed128Mer>> dict;
-    dict.reserve(2 * num_128mers);
-    auto t0 = chrono::high_resolution_clock::now();
-    for (size_t i = 0; i < num_128mers; ++i)
+    void insert_batch(const Compressed128Mer* keys, size_t n)
     {
-        Compressed128Mer key;
-        fa.Read128Mer(i, key);
-        dict[key] += 1;
+        for (size_t i = 0; i < n; ++i)
+        {
+            dict[keys[i]] += 1;
+        }
     }
-    auto t1 = chrono::high_resolution_clock::now();
-    cout << "unordered map construction time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
 
-    vector<int16_t> out;
-    out.reserve(num_128mers);
+    double estimate(const Compressed128Mer& key) const
+    {
+        auto it = dict.find(key);
+        return it == dict.end() ? 0 : it->second;
+    }
 
+    void estimate_batch(const Compressed128Mer* keys, size_t n, double* out) const
     {
-        unordered_map<Compressed128Mer, int16_t, MurmurHash<Compressed128Mer>> dict_copy(dict);
-        t0 = chrono::high_resolution_clock::now();
-        for (const auto& it : dict_copy)
+        for (size_t i = 0; i < n; ++i)
         {
-            out.push_back(dict[it.first]);
+            out[i] = estimate(keys[i]);
         }
-        t1 = chrono::high_resolution_clock::now();
-        cout << "unordered map walk time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
-        swap(dict, dict_copy);
     }
 
-    out.clear();
+    /**
+     * @brief Bucket array plus nodes (next pointer, value, cached hash); excludes allocator overhead
+     */
+    size_t bytes() const
+    {
+        return dict.bucket_count() * sizeof(void*)
+            + dict.size() * (sizeof(void*) + sizeof(ExactMap::value_type) + sizeof(size_t));
+    }
+
+    protected:
+    ExactMap dict;
+};
 
+/**
+ * @brief Exact counting with the open-addressing FlatHashMap, the exact baseline
+ */
+class ExactCounter
+{
+    public:
+    ExactCounter(size_t) {}
 
+    void insert(const Compressed128Mer& key) { dict[key] += 1; }
 
-    cerr << "HDSketch " << load_factor << "x ..." << endl;
-    random_device rd;
-    mt19937_64 gen(rd());
-    auto hd = new HDSketch<Compressed128Mer, int16_t>(num_128mers / load_factor, gen);
+    void insert_batch(const Compressed128Mer* keys, size_t n) { dict.add_batch(keys, n); }
+
+    uint32_t estimate(const Compressed128Mer& key) const
+    {
+        auto v = dict.find(key);
+        return v ? *v : 0;
+    }
 
-    t0 = chrono::high_resolution_clock::now();
-    for (size_t i = 0; i < num_128mers; ++i)
+    void estimate_batch(const Compressed128Mer* keys, size_t n, uint32_t* out) const
     {
-        Compressed128Mer key;
-        fa.Read128Mer(i, key);
-        hd->insert(key);
+        dict.find_batch(keys, n, out);
     }
-    t1 = chrono::high_resolution_clock::now();
-    cout << "HDSketch " << load_factor << "x construct time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
 
-    out.reserve(num_128mers);
+    size_t bytes() const { return dict.bytes(); }
+
+    protected:
+    FlatHashMap<Compressed128Mer, uint32_t> dict;
+};
+
+/**
+ * @brief Type-erased sketch driven by the benchmark
+ */
+class Sketch
+{
+    public:
+    virtual ~Sketch() {}
+
+    /**
+     * @brief Inserts the first n keys of the input
+     */
+    virtual void build(const KeySource& src, size_t n, size_t batch) = 0;
+
+    /**
+     * @brief Estimates n keys into out
+     */
+    virtual void query(const Compressed128Mer* keys, size_t n, size_t batch, double* out) const = 0;
+
+    virtual size_t bytes() const = 0;
 
-    t0 = chrono::high_resolution_clock::now();
-    for (const auto& it : dict)
+    /**
+     * @brief JSON snapshot of the sketch instrumentation, empty if not instrumented
+     */
+    virtual string instrumentation() const = 0;
+};
+
+template <typename S>
+auto snapshot_json(const S& sketch, int) -> decltype(sketch.instrumentation().snapshot().to_json())
+{
+    return sketch.instrumentation().snapshot().to_json();
+}
+
+template <typename S>
+string snapshot_json(const S&, long)
+{
+    return "";
+}
+
+/**
+ * @brief Makes the inserts visible to queries, for sketches that snapshot them
+ */
+template <typename S>
+auto publish(S& sketch, int) -> decltype(sketch.publish(), void())
+{
+    sketch.publish();
+}
+
+template <typename S>
+void publish(S&, long)
+{
+}
+
+template <typename S>
+class SketchAdapter : public Sketch
+{
+    public:
+    template <typename... Args>
+    SketchAdapter(Args&&... args) : sketch(std::forward<Args>(args)...) {}
+
+    void build(const KeySource& src, size_t n, size_t batch) override
     {
-        out.push_back(hd->estimate(it.first));
+        if (batch == 1)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                Compressed128Mer key;
+                src.read(i, key);
+                sketch.insert(key);
+            }
+            publish(sketch, 0);
+            return;
+        }
+
+        vector<Compressed128Mer> buf(batch);
+        for (size_t i = 0; i < n; i += batch)
+        {
+            size_t m = min(batch, n - i);
+            for (size_t j = 0; j < m; ++j)
+            {
+                src.read(i + j, buf[j]);
+            }
+            sketch.insert_batch(buf.data(), m);
+        }
+        publish(sketch, 0);
     }
-    t1 = chrono::high_resolution_clock::now();
-    cout << "HDSketch " << load_factor << "x walk time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
-    out.clear();
 
-    size_t counter = 0;
-    double square_err_sum = 0;
-    for (const auto& it : dict)
+    void query(const Compressed128Mer* keys, size_t n, size_t batch, double* out) const override
     {
-        ++counter;
-        double err = hd->estimate(it.first) - it.second;
-        square_err_sum += err * err;
+        if (batch == 1)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                out[i] = sketch.estimate(keys[i]);
+            }
+            return;
+        }
+
+        using E = decltype(sketch.estimate(keys[0]));
+        vector<E> buf(batch);
+        for (size_t i = 0; i < n; i += batch)
+        {
+            size_t m = min(batch, n - i);
+            sketch.estimate_batch(keys + i, m, buf.data());
+            copy(buf.begin(), buf.begin() + m, out + i);
+        }
     }
-    cout << "HDSketch " << load_factor << "x MSE: " << square_err_sum / counter << endl;
 
-    delete hd;
-    hd = nullptr;
+    size_t bytes() const override { return sketch.bytes(); }
 
-    
-    cerr << "HDSketchAVX512 " << load_factor << "x ..." << endl;
-    auto hd_avx512 = new HDSketchAVX512<Compressed128Mer>(num_128mers / load_factor, gen);
+    string instrumentation() const override { return snapshot_json(sketch, 0); }
 
-    t0 = chrono::high_resolution_clock::now();
-    for (size_t i = 0; i < num_128mers; ++i)
+    protected:
+    S sketch;
+};
+
+/**
+ * @brief Puts a singleton filter in front if the configuration has one
+ */
+template <typename S, typename... Args>
+unique_ptr<Sketch> make_filtered(const Config& c, Args&&... args)
+{
+    if (c.prefilter)
+        return make_unique<SketchAdapter<utils::SingletonFilter<S, Compressed128Mer>>>(c.keys * c.prefilter,
+            std::forward<Args>(args)...);
+    return make_unique<SketchAdapter<S>>(std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Wraps the sketch in the configured front stages: filter, then exact cache
+ */
+template <typename S, typename... Args>
+unique_ptr<Sketch> make_cached(const Config& c, Args&&... args)
+{
+    if (c.cache)
+        return make_filtered<utils::FrontCache<S, Compressed128Mer>>(c, c.cache, std::forward<Args>(args)...);
+    return make_filtered<S>(c, std::forward<Args>(args)...);
+}
+
+template <size_t D, typename I>
+unique_ptr<Sketch> make_hd(const Config& c, size_t buckets, mt19937_64& gen)
+{
+    return make_cached<HDSketch<Compressed128Mer, int16_t, D, I>>(c, buckets, gen, c.lanes);
+}
+
+/**
+ * @brief Constructs the sketch of a configuration
+ * All sketches get the memory of a 32-dim HDSketch at the configured load
+ * factor, except HDSketch whose buckets grow with the dimension.
+ * @param I instrumentation policy of the sketch; exact counters have none
+ */
+template <typename I>
+unique_ptr<Sketch> make_sketch(const Config& c, mt19937_64& gen)
+{
+    size_t buckets = max<size_t>(1, c.keys / c.load_factor);
+    auto width = [&](size_t bits) { return c.keys / c.load_factor * 32 * 16 / bits / c.rows + 1; };
+
+    if (c.sketch == "exact")
+        return make_unique<SketchAdapter<ExactCounter>>(c.keys);
+    if (c.sketch == "exact-node")
+        return make_unique<SketchAdapter<NodeExactCounter>>(c.keys);
+    if (c.sketch == "hd-avx512")
+        return make_cached<HDSketchAVX512<Compressed128Mer, I>>(c, buckets, gen);
+    if (c.sketch == "hd-avx512-snapshot")
+        return make_cached<SnapshotHDSketchAVX512<Compressed128Mer, I>>(c, buckets, gen);
+    if (c.sketch == "hd-avx512-2choice")
+        return make_cached<TwoChoiceHDSketchAVX512<Compressed128Mer, I>>(c, buckets, gen);
+    if (c.sketch == "hd")
     {
-        Compressed128Mer key;
-        fa.Read128Mer(i, key);
-        hd_avx512->insert(key);
+        switch (c.dim)
+        {
+            case 32: return make_hd<32, I>(c, buckets, gen);
+            case 64: return make_hd<64, I>(c, buckets, gen);
+            case 128: return make_hd<128, I>(c, buckets, gen);
+            case 256: return make_hd<256, I>(c, buckets, gen);
+            case 512: return make_hd<512, I>(c, buckets, gen);
+            case 1024: return make_hd<1024, I>(c, buckets, gen);
+        }
     }
-    t1 = chrono::high_resolution_clock::now();
-    cout << "HDSketchAVX512 " << load_factor << "x construct time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
+    if (c.sketch == "cms")
+        return make_cached<MurmurCountMinSketch<Compressed128Mer, int16_t, LinearCounter<int16_t>, I>>(c, width(16), c.rows, gen);
+    if (c.sketch == "cms-modulo")
+        return make_cached<ModuloCountMinSketch<Compressed128Mer, int16_t, LinearCounter<int16_t>, I>>(c, width(16), c.rows, gen);
+    if (c.sketch == "cms-log8")
+        return make_cached<MurmurCountMinSketch<Compressed128Mer, int16_t, LogCounter<8>, I>>(c, width(8), c.rows, gen);
+    if (c.sketch == "cms-morris4")
+        return make_cached<MurmurCountMinSketch<Compressed128Mer, int16_t, MorrisCounter<4>, I>>(c, width(4), c.rows, gen);
+    if (c.sketch == "count-sketch")
+        return make_cached<CountSketch<Compressed128Mer, int16_t, I>>(c, width(16), c.rows, gen);
+    throw invalid_argument("cannot construct " + c.sketch);
+}
+
+/**
+ * @brief Exact counts of a stream prefix, and its distinct keys as the query set
+ */
+struct GroundTruth
+{
+    FlatHashMap<Compressed128Mer, uint32_t> dict;
+    vector<Compressed128Mer> keys;
+
+    GroundTruth(const KeySource& src, size_t n)
+    {
+        if (src.workload())
+        {
+            // synthetic streams are indices into a key pool; count those directly
+            const Workload& wl = *src.workload();
+            vector<uint32_t> by_index(wl.distinct());
+            for (size_t i = 0; i < n; ++i)
+            {
+                by_index[wl.key_index(i)] += 1;
+            }
+            for (size_t i = 0; i < by_index.size(); ++i)
+            {
+                if (by_index[i] != 0)
+                {
+                    keys.push_back(wl.keys()[i]);
+                    dict[wl.keys()[i]] = by_index[i];
+                }
+            }
+            return;
+        }
 
-    out.reserve(num_128mers);
+        vector<Compressed128Mer> buf(1024);
+        for (size_t i = 0; i < n; i += buf.size())
+        {
+            size_t m = min(buf.size(), n - i);
+            for (size_t j = 0; j < m; ++j)
+            {
+                src.read(i + j, buf[j]);
+            }
+            dict.add_batch(buf.data(), m);
+        }
+        keys.reserve(dict.size());
+        dict.for_each([&](const Compressed128Mer& key, uint32_t)
+        {
+            keys.push_back(key);
+        });
+    }
+};
 
-    t0 = chrono::high_resolution_clock::now();
-    for (const auto& it : dict)
+double seconds_since(chrono::high_resolution_clock::time_point t0)
+{
+    auto t1 = chrono::high_resolution_clock::now();
+    return chrono::duration<double>(t1 - t0).count();
+}
+
+/**
+ * @brief Estimates all keys with the configured number of threads
+ * @return wall-clock seconds
+ */
+double run_queries(const Sketch& sketch, const GroundTruth& truth, const Config& c, vector<double>& out)
+{
+    size_t n = truth.keys.size();
+    auto t0 = chrono::high_resolution_clock::now();
+    if (c.threads == 1)
     {
-        out.push_back(hd_avx512->estimate(it.first));
+        sketch.query(truth.keys.data(), n, c.batch, out.data());
+        return seconds_since(t0);
     }
-    t1 = chrono::high_resolution_clock::now();
-    cout << "HDSketchAVX512 " << load_factor << "x walk time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
-    out.clear();
 
-    counter = 0;
-    square_err_sum = 0;
-    for (const auto& it : dict)
+    vector<thread> workers;
+    size_t slice = (n + c.threads - 1) / c.threads;
+    for (size_t t = 0; t < c.threads; ++t)
     {
-        ++counter;
-        double err = hd_avx512->estimate(it.first) - it.second;
-        square_err_sum += err * err;
+        size_t begin = min(n, t * slice);
+        size_t end = min(n, begin + slice);
+        workers.emplace_back([&, begin, end]()
+        {
+            sketch.query(truth.keys.data() + begin, end - begin, c.batch, out.data() + begin);
+        });
     }
-    cout << "HDSketchAVX512 " << load_factor << "x MSE: " << square_err_sum / counter << endl;
+    for (auto& it : workers)
+    {
+        it.join();
+    }
+    return seconds_since(t0);
+}
 
-    delete hd_avx512;
-    hd_avx512 = nullptr;
+Result run_config(const Config& c, const Options& opt, const KeySource& src, const GroundTruth& truth,
+    PerfCounters& perf, mt19937_64& gen)
+{
+    Result result;
+    result.config = c;
+    result.distinct_keys = truth.keys.size();
+
+    vector<double> insert_sec, query_sec;
+    vector<PerfSample> insert_perf, query_perf;
+    vector<double> out(truth.keys.size());
+    unique_ptr<Sketch> sketch;
+    for (size_t rep = 0; rep < opt.warmup + opt.reps; ++rep)
+    {
+        sketch = opt.instrument ? make_sketch<utils::SampledInstrumentation<>>(c, gen)
+                                : make_sketch<utils::NoInstrumentation>(c, gen);
 
+        perf.start();
+        auto t0 = chrono::high_resolution_clock::now();
+        sketch->build(src, c.keys, c.batch);
+        double t_insert = seconds_since(t0);
+        PerfSample p_insert = perf.stop();
 
-    // for (size_t i = 1; i <= 16; ++i)
-    // {
-    //     cerr << "ModuloCountMin (normal) " << load_factor << "x " << i << " rows ..." << endl;
-    //     size_t height = i;
-    //     size_t width = num_128mers / load_factor * 32 / height + 1;
-    //     ModuloCountMinSketch<Compressed128Mer, int16_t> cms(width, height, gen);
+        perf.start();
+        double t_query = run_queries(*sketch, truth, c, out);
+        PerfSample p_query = perf.stop();
 
-    //     t0 = chrono::high_resolution_clock::now();
-    //     for (size_t j = 0; j < num_128mers; ++j)
-    //     {
-    //         Compressed128Mer key;
-    //         fa.Read128Mer(j, key);
-    //         cms.insert(key);
-    //     }
-    //     t1 = chrono::high_resolution_clock::now();
-    //     cout << "ModuloCountMin (normal) " << load_factor << "x " << i << " rows construct time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
+        if (rep >= opt.warmup)
+        {
+            insert_sec.push_back(t_insert);
+            query_sec.push_back(t_query);
+            insert_perf.push_back(p_insert);
+            query_perf.push_back(p_query);
+            result.bytes = sketch->bytes();
+        }
+    }
 
-    //     out.reserve(num_128mers);
-    //     t0 = chrono::high_resolution_clock::now();
-    //     for (const auto& it : dict)
-    //     {
-    //         out.push_back(cms.estimate(it.first));
-    //     }
-    //     t1 = chrono::high_resolution_clock::now();
-    //     cout << "ModuloCountMin (normal) " << load_factor << "x " << i << " rows walk time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
-    //     out.clear();
+    // snapshot before the evaluation adds its own estimates
+    result.instrumentation = sketch->instrumentation();
+    size_t eval_threads = opt.eval_threads ? opt.eval_threads : max(1U, thread::hardware_concurrency());
+    result.errors = evaluate(truth.dict, [&](const Compressed128Mer* keys, size_t n, double* est)
+    {
+        sketch->query(keys, n, n, est);
+    }, eval_threads);
+    result.insert = PhaseStats::of(c.keys, insert_sec);
+    result.query = PhaseStats::of(truth.keys.size(), query_sec);
+    result.insert_perf = PerfStats::of(c.keys, insert_perf);
+    result.query_perf = PerfStats::of(truth.keys.size(), query_perf);
+    return result;
+}
 
-    //     counter = 0;
-    //     square_err_sum = 0;
-    //     for (const auto& it : dict)
-    //     {
-    //         ++counter;
-    //         double err = cms.estimate(it.first) - it.second;
-    //         square_err_sum += err * err;
-    //     }
-    //     cout << "ModuloCountMin (normal) " << load_factor << "x " << i << " rows MSE: " << square_err_sum / counter << endl;
-    // }  
+int main(int argc, char** argv)
+{
+    Options opt;
+    try
+    {
+        opt = Options::parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << "\n" << Options::usage(argv[0]);
+        exit(1);
+    }
 
+    unique_ptr<Fasta> fa;
+    unique_ptr<Workload> wl;
+    unique_ptr<KeySource> src;
+    try
+    {
+        if (opt.workload.empty())
+        {
+            fa = make_unique<Fasta>(opt.fasta);
+            src = make_unique<KeySource>(*fa);
+            if (opt.sample)
+            {
+                auto t0 = chrono::high_resolution_clock::now();
+                utils::SyncmerSampler sampler(opt.sample);
+                size_t all = src->size();
+                src = make_unique<KeySource>(*fa, sampler.select(fa->data(), fa->size()));
+                cerr << "sampled " << src->size() << " of " << all << " 128-mers (window " << opt.sample
+                     << ") in " << seconds_since(t0) << " s" << endl;
+            }
+        }
+        else
+        {
+            cerr << "generating " << opt.workload << " ..." << endl;
+            wl = make_unique<Workload>(opt.workload);
+            src = make_unique<KeySource>(*wl);
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        exit(1);
+    }
+    if (src->size() == 0)
+    {
+        cerr << "Input has no keys" << endl;
+        exit(1);
+    }
 
-    for (size_t i = 1; i <= 16; ++i)
+    random_device rd;
+    mt19937_64 gen(opt.seed == 0 ? rd() : opt.seed);
+
+    // opened before any query thread exists, so every thread inherits the counters
+    PerfCounters perf;
+    if (!perf.error().empty())
     {
-        cerr << "ModuloCountMin (murmur) " << load_factor << "x " << i << " rows ..." << endl;
-        size_t height = i;
-        size_t width = num_128mers / load_factor * 32 / height + 1;
-        MurmurCountMinSketch<Compressed128Mer, int16_t> cms(width, height, gen);
+        cerr << "hardware counters " << (perf.available() ? "partially " : "") << "unavailable ("
+             << perf.error() << "), reporting time only for those" << endl;
+    }
 
-        t0 = chrono::high_resolution_clock::now();
-        for (size_t j = 0; j < num_128mers; ++j)
-        {
-            Compressed128Mer key;
-            fa.Read128Mer(j, key);
-            cms.insert(key);
-        }
-        t1 = chrono::high_resolution_clock::now();
-        cout << "ModuloCountMin (murmur) " << load_factor << "x " << i << " rows construct time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
+    map<size_t, unique_ptr<GroundTruth>> truths;
+    vector<Result> results;
+    for (const auto& c : opt.expand(src->size()))
+    {
+        cerr << c.sketch << " dim=" << c.dim << " lanes=" << c.lanes << " rows=" << c.rows << " lf=" << c.load_factor
+             << " keys=" << c.keys << " threads=" << c.threads << " batch=" << c.batch << " ..." << endl;
 
-        out.reserve(num_128mers);
-        t0 = chrono::high_resolution_clock::now();
-        for (const auto& it : dict)
+        auto& truth = truths[c.keys];
+        if (!truth)
         {
-            out.push_back(cms.estimate(it.first));
+            truth = make_unique<GroundTruth>(*src, c.keys);
         }
-        t1 = chrono::high_resolution_clock::now();
-        cout << "ModuloCountMin (murmur) " << load_factor << "x " << i << " rows walk time: " << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() << endl;
-        out.clear();
+        results.push_back(run_config(c, opt, *src, *truth, perf, gen));
+    }
 
-        counter = 0;
-        square_err_sum = 0;
-        for (const auto& it : dict)
+    if (opt.output.empty())
+    {
+        write_results(cout, opt.format, results);
+    }
+    else
+    {
+        ofstream f(opt.output);
+        if (!f)
         {
-            ++counter;
-            double err = cms.estimate(it.first) - it.second;
-            square_err_sum += err * err;
+            cerr << "Cannot open " << opt.output << endl;
+            exit(1);
         }
-        cout << "ModuloCountMin (murmur) " << load_factor << "x " << i << " rows MSE: " << square_err_sum / counter << endl;
-    }  
-}
\ No newline at end of file
+        write_results(f, opt.format, results);
+    }
+}
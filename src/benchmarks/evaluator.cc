@@ -0,0 +1,61 @@
+#include "benchmarks/Evaluator.hh"
+using namespace std;
+
+namespace bench
+{
+    void ErrorAccumulator::merge(ErrorAccumulator& other)
+    {
+        total.merge(other.total);
+        for (size_t i = 0; i < STRATA; ++i)
+        {
+            strata[i].merge(other.strata[i]);
+        }
+        abs_errors.insert(abs_errors.end(), other.abs_errors.begin(), other.abs_errors.end());
+        other.abs_errors.clear();
+        other.abs_errors.shrink_to_fit();
+    }
+
+    ErrorStats ErrorAccumulator::finish()
+    {
+        ErrorStats stats;
+        stats.count = total.count;
+        if (total.count == 0)
+            return stats;
+
+        stats.mse = total.square / total.count;
+        stats.mae = total.abs / total.count;
+        stats.mre = total.rel / total.count;
+        stats.bias = total.sum / total.count;
+
+        // successive nth_element calls on shrinking suffixes
+        auto rank = [&](double q) { return min(abs_errors.size() - 1, (size_t)(q * abs_errors.size())); };
+        size_t ranks[] = {rank(0.5), rank(0.9), rank(0.99), rank(0.999)};
+        double* outs[] = {&stats.p50, &stats.p90, &stats.p99, &stats.p999};
+        auto first = abs_errors.begin();
+        for (size_t i = 0; i < 4; ++i)
+        {
+            auto nth = abs_errors.begin() + ranks[i];
+            nth_element(first, nth, abs_errors.end());
+            *outs[i] = *nth;
+            first = nth;
+        }
+        stats.max_abs = *max_element(first, abs_errors.end());
+
+        for (size_t i = 0; i < STRATA; ++i)
+        {
+            const Sums& s = strata[i];
+            if (s.count == 0)
+                continue;
+            Stratum st;
+            st.lo = 1ULL << i;
+            st.hi = i == 63 ? ~0ULL : (2ULL << i) - 1;
+            st.count = s.count;
+            st.mse = s.square / s.count;
+            st.mae = s.abs / s.count;
+            st.mre = s.rel / s.count;
+            st.bias = s.sum / s.count;
+            stats.strata.push_back(st);
+        }
+        return stats;
+    }
+}
@@ -0,0 +1,260 @@
+#include "benchmarks/Options.hh"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+namespace bench
+{
+    static const vector<string> known_sketches = {
+        "exact", "exact-node", "hd", "hd-avx512", "hd-avx512-snapshot", "hd-avx512-2choice", "cms", "cms-modulo", "cms-log8", "cms-morris4", "count-sketch"
+    };
+
+    static vector<string> split(const string& s)
+    {
+        vector<string> result;
+        stringstream ss(s);
+        string item;
+        while (getline(ss, item, ','))
+        {
+            if (!item.empty())
+                result.push_back(item);
+        }
+        if (result.empty())
+            throw invalid_argument("empty list: " + s);
+        return result;
+    }
+
+    static size_t to_size(const string& s)
+    {
+        size_t pos;
+        double v = stod(s, &pos);
+        if (pos != s.size() || v < 0)
+            throw invalid_argument("not a non-negative number: " + s);
+        return (size_t)v;
+    }
+
+    static double to_double(const string& s)
+    {
+        size_t pos;
+        double v = stod(s, &pos);
+        if (pos != s.size() || v <= 0)
+            throw invalid_argument("not a positive number: " + s);
+        return v;
+    }
+
+    template <typename F>
+    static auto parse_list(const string& s, F conv)
+    {
+        vector<decltype(conv(s))> result;
+        for (const auto& it : split(s))
+        {
+            result.push_back(conv(it));
+        }
+        return result;
+    }
+
+    bool uses_dim(const string& sketch)
+    {
+        return sketch == "hd" || sketch.compare(0, 9, "hd-avx512") == 0;
+    }
+
+    bool uses_lanes(const string& sketch)
+    {
+        return sketch == "hd";
+    }
+
+    bool uses_rows(const string& sketch)
+    {
+        return sketch.compare(0, 3, "cms") == 0 || sketch == "count-sketch";
+    }
+
+    string Options::usage(const char* prog)
+    {
+        stringstream ss;
+        ss << "Usage: " << prog << " <fasta-file> [load-factor] [options]\n"
+           << "       " << prog << " --workload SPEC [options]\n"
+           << "Sweeps run the cartesian product of all list-valued options (comma separated).\n"
+           << "  --sketch LIST       exact,exact-node,hd,hd-avx512,hd-avx512-snapshot,hd-avx512-2choice,\n"
+           << "                      cms,cms-modulo,cms-log8,cms-morris4,count-sketch\n"
+           << "                      (default hd,hd-avx512,cms,count-sketch)\n"
+           << "  --dim LIST          HD dimensions: 32,64,128,256,512,1024 (default 32; hd-avx512 is 32 only)\n"
+           << "  --lanes LIST        nonzero lanes of a sparse hd projection, 0 = dense; configurations\n"
+           << "                      whose dimension it does not divide are skipped (default 0)\n"
+           << "  --rows LIST         rows of cms/count-sketch (default 1,2,4,8)\n"
+           << "  --load-factor LIST  keys per 64-byte bucket of 32-dim HD; sets every sketch's memory (default 1)\n"
+           << "  --keys LIST         stream keys to insert, 0 = whole input (default 0)\n"
+           << "  --threads LIST      query threads; inserts are single-writer (default 1)\n"
+           << "  --batch LIST        keys per insert/estimate call, 1 = per-key API (default 1)\n"
+           << "  --cache LIST        entries of an exact hot-key cache in front of the sketch, 0 = none;\n"
+           << "                      its memory is reported on top of the sketch's (default 0)\n"
+           << "  --prefilter LIST    bits per stream key of a Bloom filter that keeps first occurrences\n"
+           << "                      out of the sketch, 0 = none; reported on top (default 0)\n"
+           << "  --sample W          insert and query only closed syncmers, about 2 / W of the\n"
+           << "                      FASTA 128-mers; W in [2, 112], 0 = every k-mer (default 0)\n"
+           << "  --warmup N          unrecorded repetitions per configuration (default 1)\n"
+           << "  --reps N            recorded repetitions per configuration (default 3)\n"
+           << "  --eval-threads N    threads of the accuracy evaluation, 0 = all cores (default 0)\n"
+           << "  --instrument        sample per-op latency and counter overflow; reported in json output\n"
+           << "  --format FMT        text, csv or json (default text)\n"
+           << "  --output FILE       write results to FILE instead of stdout\n"
+           << "  --seed N            RNG seed, 0 = random (default 0)\n"
+           << "  --workload SPEC     synthetic key stream instead of a FASTA file, one of\n"
+           << "                        uniform:keys=N,ops=M\n"
+           << "                        zipf:alpha=A,keys=N,ops=M\n"
+           << "                        hotset:hot=H,frac=F,keys=N,ops=M\n"
+           << "                        collide:group=G,keys=N,ops=M\n"
+           << "                      each with optional seed=S (default 1)\n";
+        return ss.str();
+    }
+
+    Options Options::parse(int argc, char** argv)
+    {
+        Options opt;
+        vector<string> positional;
+        for (int i = 1; i < argc; ++i)
+        {
+            string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0)
+            {
+                positional.push_back(arg);
+                continue;
+            }
+            if (arg == "--instrument")
+            {
+                opt.instrument = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                throw invalid_argument("missing value for " + arg);
+            string val = argv[++i];
+
+            if (arg == "--sketch")
+                opt.sketches = split(val);
+            else if (arg == "--dim")
+                opt.dims = parse_list(val, to_size);
+            else if (arg == "--lanes")
+                opt.lanes = parse_list(val, to_size);
+            else if (arg == "--rows")
+                opt.rows = parse_list(val, to_size);
+            else if (arg == "--load-factor")
+                opt.load_factors = parse_list(val, to_double);
+            else if (arg == "--keys")
+                opt.keys = parse_list(val, to_size);
+            else if (arg == "--threads")
+                opt.threads = parse_list(val, to_size);
+            else if (arg == "--batch")
+                opt.batches = parse_list(val, to_size);
+            else if (arg == "--cache")
+                opt.caches = parse_list(val, to_size);
+            else if (arg == "--prefilter")
+                opt.prefilters = parse_list(val, to_size);
+            else if (arg == "--sample")
+                opt.sample = to_size(val);
+            else if (arg == "--warmup")
+                opt.warmup = to_size(val);
+            else if (arg == "--reps")
+                opt.reps = to_size(val);
+            else if (arg == "--eval-threads")
+                opt.eval_threads = to_size(val);
+            else if (arg == "--format")
+                opt.format = val;
+            else if (arg == "--output")
+                opt.output = val;
+            else if (arg == "--seed")
+                opt.seed = to_size(val);
+            else if (arg == "--workload")
+                opt.workload = val;
+            else
+                throw invalid_argument("unknown option " + arg);
+        }
+
+        // the historical interface: <fasta-file> <load-factor>
+        if (!opt.workload.empty())
+        {
+            if (!positional.empty())
+                throw invalid_argument("--workload replaces the fasta file");
+        }
+        else
+        {
+            if (positional.empty() || positional.size() > 2)
+                throw invalid_argument("expected <fasta-file> [load-factor]");
+            opt.fasta = positional[0];
+            if (positional.size() == 2)
+                opt.load_factors = {to_double(positional[1])};
+        }
+
+        for (const auto& it : opt.sketches)
+        {
+            if (find(known_sketches.begin(), known_sketches.end(), it) == known_sketches.end())
+                throw invalid_argument("unknown sketch " + it);
+        }
+        for (auto d : opt.dims)
+        {
+            if (d < 32 || d > 1024 || (d & (d - 1)) != 0)
+                throw invalid_argument("dimensions must be a power of two in [32, 1024]");
+        }
+        for (auto r : opt.rows)
+        {
+            if (r == 0 || r > 16)
+                throw invalid_argument("rows must be in [1, 16]");
+        }
+        for (auto t : opt.threads)
+        {
+            if (t == 0)
+                throw invalid_argument("threads must be positive");
+        }
+        for (auto b : opt.batches)
+        {
+            if (b == 0)
+                throw invalid_argument("batch must be positive");
+        }
+        if (opt.sample != 0 && (opt.sample < 2 || opt.sample > 112))
+            throw invalid_argument("sample window must be in [2, 112]");
+        if (opt.sample != 0 && !opt.workload.empty())
+            throw invalid_argument("--sample needs FASTA input");
+        if (opt.reps == 0)
+            throw invalid_argument("reps must be positive");
+        if (opt.format != "text" && opt.format != "csv" && opt.format != "json")
+            throw invalid_argument("unknown format " + opt.format);
+        return opt;
+    }
+
+    vector<Config> Options::expand(size_t total_keys) const
+    {
+        vector<Config> result;
+        for (const auto& sketch : sketches)
+        {
+            vector<size_t> sketch_dims = uses_dim(sketch) ? dims : vector<size_t>{0};
+            vector<size_t> sketch_lanes = uses_lanes(sketch) ? lanes : vector<size_t>{0};
+            vector<size_t> sketch_rows = uses_rows(sketch) ? rows : vector<size_t>{0};
+            if (sketch.compare(0, 9, "hd-avx512") == 0)
+                sketch_dims = {32};
+            // exact maps have no memory budget to sweep
+            bool exact = sketch.compare(0, 5, "exact") == 0;
+            vector<double> sketch_lfs = exact ? vector<double>{load_factors[0]} : load_factors;
+            vector<size_t> sketch_caches = exact ? vector<size_t>{0} : caches;
+            vector<size_t> sketch_prefilters = exact ? vector<size_t>{0} : prefilters;
+
+            for (auto d : sketch_dims)
+                for (auto l : sketch_lanes)
+                {
+                    // a sparse projection picks one lane in each block of d / l
+                    if (l && (l > d || d % l != 0))
+                        continue;
+                    for (auto r : sketch_rows)
+                        for (auto lf : sketch_lfs)
+                            for (auto k : keys)
+                                for (auto t : threads)
+                                    for (auto b : batches)
+                                        for (auto cache : sketch_caches)
+                                            for (auto pf : sketch_prefilters)
+                                            {
+                                                size_t n = k == 0 || k > total_keys ? total_keys : k;
+                                                result.push_back({sketch, d, l, r, lf, n, t, b, cache, pf});
+                                            }
+                }
+        }
+        return result;
+    }
+}
@@ -0,0 +1,142 @@
+#include "benchmarks/PerfCounters.hh"
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace std;
+
+namespace bench
+{
+    static const char* event_names[PERF_EVENTS] = {
+        "cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"
+    };
+
+    const char* perf_event_name(size_t e)
+    {
+        return e < PERF_EVENTS ? event_names[e] : "unknown";
+    }
+
+    static uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result)
+    {
+        return cache | (op << 8U) | (result << 16U);
+    }
+
+    static int open_event(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    PerfCounters::PerfCounters()
+    {
+        struct { uint32_t type; uint64_t config; } events[PERF_EVENTS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+
+        for (size_t e = 0; e < PERF_EVENTS; ++e)
+        {
+            fd[e] = open_event(events[e].type, events[e].config);
+            if (fd[e] < 0 && err.empty())
+            {
+                err = string(event_names[e]) + ": " + strerror(errno);
+            }
+        }
+    }
+
+    PerfCounters::~PerfCounters()
+    {
+        for (auto it : fd)
+        {
+            if (it >= 0)
+                close(it);
+        }
+    }
+
+    bool PerfCounters::available() const
+    {
+        for (auto it : fd)
+        {
+            if (it >= 0)
+                return true;
+        }
+        return false;
+    }
+
+    void PerfCounters::start()
+    {
+        for (auto it : fd)
+        {
+            if (it >= 0)
+            {
+                ioctl(it, PERF_EVENT_IOC_RESET, 0);
+                ioctl(it, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    PerfSample PerfCounters::stop()
+    {
+        PerfSample s;
+        for (auto it : fd)
+        {
+            if (it >= 0)
+                ioctl(it, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        for (size_t e = 0; e < PERF_EVENTS; ++e)
+        {
+            // value, time enabled, time running
+            uint64_t v[3];
+            if (fd[e] < 0 || read(fd[e], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+                continue;
+            s.counts[e] = (double)v[0] * ((double)v[1] / (double)v[2]);
+            s.valid[e] = true;
+        }
+        return s;
+    }
+
+    PerfStats PerfStats::of(size_t ops, const vector<PerfSample>& samples)
+    {
+        PerfStats p;
+        for (size_t e = 0; e < PERF_EVENTS; ++e)
+        {
+            double sum = 0;
+            size_t n = 0;
+            for (const auto& it : samples)
+            {
+                if (it.valid[e])
+                {
+                    sum += it.counts[e];
+                    ++n;
+                }
+            }
+            if (n != 0 && ops != 0)
+            {
+                p.per_op[e] = sum / n / ops;
+                p.valid[e] = true;
+            }
+        }
+        return p;
+    }
+
+    double PerfStats::ipc() const
+    {
+        if (!valid[CYCLES] || !valid[INSTRUCTIONS] || per_op[CYCLES] == 0)
+            return 0;
+        return per_op[INSTRUCTIONS] / per_op[CYCLES];
+    }
+}
@@ -0,0 +1,242 @@
+#include "benchmarks/Report.hh"
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+using namespace std;
+
+namespace bench
+{
+    /**
+     * @brief Two-sided 95% quantile of Student's t distribution
+     */
+    static double t95(size_t dof)
+    {
+        static const double table[] = {
+            0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+        };
+        return dof < sizeof(table) / sizeof(table[0]) ? table[dof] : 1.96;
+    }
+
+    Summary Summary::of(const vector<double>& samples)
+    {
+        Summary s;
+        size_t n = samples.size();
+        if (n == 0)
+            return s;
+
+        for (auto it : samples)
+        {
+            s.mean += it;
+        }
+        s.mean /= n;
+
+        if (n > 1)
+        {
+            double var = 0;
+            for (auto it : samples)
+            {
+                var += (it - s.mean) * (it - s.mean);
+            }
+            s.stddev = sqrt(var / (n - 1));
+            s.ci95 = t95(n - 1) * s.stddev / sqrt((double)n);
+        }
+        return s;
+    }
+
+    PhaseStats PhaseStats::of(size_t ops, const vector<double>& seconds)
+    {
+        PhaseStats p;
+        p.ops = ops;
+        vector<double> ns, rate;
+        for (auto it : seconds)
+        {
+            ns.push_back(ops == 0 ? 0 : it * 1e9 / ops);
+            rate.push_back(it == 0 ? 0 : ops / it);
+        }
+        p.ns_per_op = Summary::of(ns);
+        p.ops_per_sec = Summary::of(rate);
+        return p;
+    }
+
+    static const char* csv_header =
+        "sketch,dim,lanes,rows,load_factor,keys,distinct_keys,threads,batch,cache,prefilter,bytes,bytes_per_key,"
+        "mse,mae,mre,bias,err_p50,err_p90,err_p99,err_p999,err_max,"
+        "insert_ns_per_op,insert_ns_per_op_ci95,insert_ops_per_sec,insert_ops_per_sec_ci95,"
+        "query_ns_per_op,query_ns_per_op_ci95,query_ops_per_sec,query_ops_per_sec_ci95";
+
+    static void write_perf_csv_header(ostream& os, const char* phase)
+    {
+        for (size_t e = 0; e < PERF_EVENTS; ++e)
+        {
+            os << "," << phase << "_" << perf_event_name(e) << "_per_op";
+        }
+        os << "," << phase << "_ipc";
+    }
+
+    /**
+     * @brief Unavailable counters are left empty
+     */
+    static void write_perf_csv(ostream& os, const PerfStats& p)
+    {
+        for (size_t e = 0; e < PERF_EVENTS; ++e)
+        {
+            os << ",";
+            if (p.valid[e])
+                os << p.per_op[e];
+        }
+        os << ",";
+        if (p.ipc() != 0)
+            os << p.ipc();
+    }
+
+    static void write_csv(ostream& os, const vector<Result>& results)
+    {
+        os << csv_header;
+        write_perf_csv_header(os, "insert");
+        write_perf_csv_header(os, "query");
+        os << "\n";
+        for (const auto& r : results)
+        {
+            const auto& c = r.config;
+            os << c.sketch << "," << c.dim << "," << c.lanes << "," << c.rows << "," << c.load_factor << ","
+               << c.keys << "," << r.distinct_keys << "," << c.threads << "," << c.batch << "," << c.cache << "," << c.prefilter << ","
+               << r.bytes << "," << r.bytes_per_key() << ","
+               << r.errors.mse << "," << r.errors.mae << "," << r.errors.mre << "," << r.errors.bias << ","
+               << r.errors.p50 << "," << r.errors.p90 << "," << r.errors.p99 << "," << r.errors.p999 << ","
+               << r.errors.max_abs << ","
+               << r.insert.ns_per_op.mean << "," << r.insert.ns_per_op.ci95 << ","
+               << r.insert.ops_per_sec.mean << "," << r.insert.ops_per_sec.ci95 << ","
+               << r.query.ns_per_op.mean << "," << r.query.ns_per_op.ci95 << ","
+               << r.query.ops_per_sec.mean << "," << r.query.ops_per_sec.ci95;
+            write_perf_csv(os, r.insert_perf);
+            write_perf_csv(os, r.query_perf);
+            os << "\n";
+        }
+    }
+
+    static void write_summary_json(ostream& os, const Summary& s)
+    {
+        os << "{\"mean\": " << s.mean << ", \"stddev\": " << s.stddev << ", \"ci95\": " << s.ci95 << "}";
+    }
+
+    static void write_phase_json(ostream& os, const PhaseStats& p)
+    {
+        os << "{\"ops\": " << p.ops << ", \"ns_per_op\": ";
+        write_summary_json(os, p.ns_per_op);
+        os << ", \"ops_per_sec\": ";
+        write_summary_json(os, p.ops_per_sec);
+        os << "}";
+    }
+
+    /**
+     * @brief Per-op counts of the available counters only
+     */
+    static void write_perf_json(ostream& os, const PerfStats& p)
+    {
+        os << "{";
+        const char* sep = "";
+        for (size_t e = 0; e < PERF_EVENTS; ++e)
+        {
+            if (p.valid[e])
+            {
+                os << sep << "\"" << perf_event_name(e) << "_per_op\": " << p.per_op[e];
+                sep = ", ";
+            }
+        }
+        if (p.ipc() != 0)
+            os << sep << "\"ipc\": " << p.ipc();
+        os << "}";
+    }
+
+    static void write_errors_json(ostream& os, const ErrorStats& e)
+    {
+        os << "{\"mse\": " << e.mse << ", \"mae\": " << e.mae << ", \"mre\": " << e.mre
+           << ", \"bias\": " << e.bias << ", \"p50\": " << e.p50 << ", \"p90\": " << e.p90
+           << ", \"p99\": " << e.p99 << ", \"p999\": " << e.p999 << ", \"max\": " << e.max_abs
+           << ",\n     \"strata\": [";
+        for (size_t i = 0; i < e.strata.size(); ++i)
+        {
+            const auto& s = e.strata[i];
+            os << (i ? ",\n       " : "\n       ") << "{\"lo\": " << s.lo << ", \"hi\": " << s.hi
+               << ", \"count\": " << s.count << ", \"mse\": " << s.mse << ", \"mae\": " << s.mae
+               << ", \"mre\": " << s.mre << ", \"bias\": " << s.bias << "}";
+        }
+        os << "]}";
+    }
+
+    static void write_json(ostream& os, const vector<Result>& results)
+    {
+        os << "[\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto& r = results[i];
+            const auto& c = r.config;
+            os << "  {\"sketch\": \"" << c.sketch << "\", \"dim\": " << c.dim << ", \"lanes\": " << c.lanes << ", \"rows\": " << c.rows
+               << ", \"load_factor\": " << c.load_factor << ", \"keys\": " << c.keys
+               << ", \"distinct_keys\": " << r.distinct_keys << ", \"threads\": " << c.threads
+               << ", \"batch\": " << c.batch << ", \"cache\": " << c.cache << ", \"prefilter\": " << c.prefilter << ", \"bytes\": " << r.bytes
+               << ", \"bytes_per_key\": " << r.bytes_per_key()
+               << ",\n   \"errors\": ";
+            write_errors_json(os, r.errors);
+            os << ",\n   \"insert\": ";
+            write_phase_json(os, r.insert);
+            os << ",\n   \"query\": ";
+            write_phase_json(os, r.query);
+            os << ",\n   \"perf\": {\"insert\": ";
+            write_perf_json(os, r.insert_perf);
+            os << ", \"query\": ";
+            write_perf_json(os, r.query_perf);
+            os << "}";
+            if (!r.instrumentation.empty())
+            {
+                os << ",\n   \"instrumentation\": " << r.instrumentation;
+            }
+            os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        os << "]\n";
+    }
+
+    static void write_text(ostream& os, const vector<Result>& results)
+    {
+        os << left << setw(20) << "sketch" << right << setw(6) << "dim" << setw(6) << "lanes" << setw(6) << "rows"
+           << setw(8) << "lf" << setw(11) << "keys" << setw(4) << "thr" << setw(7) << "batch" << setw(8) << "cache" << setw(4) << "pf"
+           << setw(11) << "B/key" << setw(12) << "MSE" << setw(11) << "MAE" << setw(11) << "p99"
+           << setw(20) << "insert ns/op" << setw(20) << "query ns/op"
+           << setw(11) << "q cyc/op" << setw(7) << "q IPC" << setw(10) << "q LLC/op" << "\n";
+        for (const auto& r : results)
+        {
+            const auto& c = r.config;
+            stringstream ins, qry;
+            ins << fixed << setprecision(1) << r.insert.ns_per_op.mean << " +- " << r.insert.ns_per_op.ci95;
+            qry << fixed << setprecision(1) << r.query.ns_per_op.mean << " +- " << r.query.ns_per_op.ci95;
+            os << left << setw(20) << c.sketch << right << setw(6) << c.dim << setw(6) << c.lanes << setw(6) << c.rows
+               << setw(8) << c.load_factor << setw(11) << c.keys << setw(4) << c.threads
+               << setw(7) << c.batch << setw(8) << c.cache << setw(4) << c.prefilter << setw(11) << setprecision(4) << r.bytes_per_key()
+               << setw(12) << setprecision(4) << r.errors.mse << setw(11) << r.errors.mae
+               << setw(11) << r.errors.p99
+               << setw(20) << ins.str() << setw(20) << qry.str();
+            const PerfStats& p = r.query_perf;
+            stringstream cyc, ipc, llc;
+            cyc << fixed << setprecision(1);
+            ipc << fixed << setprecision(2);
+            llc << fixed << setprecision(3);
+            if (p.valid[CYCLES]) cyc << p.per_op[CYCLES]; else cyc << "-";
+            if (p.ipc() != 0) ipc << p.ipc(); else ipc << "-";
+            if (p.valid[LLC_MISSES]) llc << p.per_op[LLC_MISSES]; else llc << "-";
+            os << setw(11) << cyc.str() << setw(7) << ipc.str() << setw(10) << llc.str() << "\n";
+        }
+    }
+
+    void write_results(ostream& os, const string& format, const vector<Result>& results)
+    {
+        os << setprecision(6);
+        if (format == "csv")
+            write_csv(os, results);
+        else if (format == "json")
+            write_json(os, results);
+        else
+            write_text(os, results);
+    }
+}
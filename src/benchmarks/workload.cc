@@ -0,0 +1,209 @@
+#include "benchmarks/Workload.hh"
+#include "utils/random.hh"
+#include <cmath>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+namespace bench
+{
+    AliasTable::AliasTable(const vector<double>& weights)
+        : prob(weights.size()), alias(weights.size())
+    {
+        size_t n = weights.size();
+        double sum = 0;
+        for (auto w : weights)
+        {
+            sum += w;
+        }
+        if (n == 0 || !(sum > 0))
+            throw invalid_argument("alias table needs a positive weight");
+
+        vector<double> scaled(n);
+        vector<uint32_t> small, large;
+        for (size_t i = 0; i < n; ++i)
+        {
+            scaled[i] = weights[i] * n / sum;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty())
+        {
+            uint32_t s = small.back();
+            uint32_t l = large.back();
+            small.pop_back();
+            prob[s] = (uint32_t)(scaled[s] * 4294967296.0);
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // leftovers are 1 up to rounding
+        for (auto i : small)
+        {
+            prob[i] = numeric_limits<uint32_t>::max();
+            alias[i] = i;
+        }
+        for (auto i : large)
+        {
+            prob[i] = numeric_limits<uint32_t>::max();
+            alias[i] = i;
+        }
+    }
+
+    static map<string, double> parse_params(const string& s, string& kind)
+    {
+        map<string, double> params;
+        size_t colon = s.find(':');
+        kind = s.substr(0, colon);
+        if (colon == string::npos)
+            return params;
+
+        stringstream ss(s.substr(colon + 1));
+        string item;
+        while (getline(ss, item, ','))
+        {
+            size_t eq = item.find('=');
+            if (eq == string::npos)
+                throw invalid_argument("expected name=value in workload spec: " + item);
+            size_t pos;
+            string val = item.substr(eq + 1);
+            // decimal only: nan and inf would slip through the range checks of -Ofast builds
+            if (val.find_first_not_of("0123456789.eE+-") != string::npos)
+                throw invalid_argument("bad number in workload spec: " + item);
+            params[item.substr(0, eq)] = stod(val, &pos);
+            if (pos != val.size())
+                throw invalid_argument("bad number in workload spec: " + item);
+        }
+        return params;
+    }
+
+    Workload::Workload(const string& s) : spec(s)
+    {
+        string kind;
+        auto params = parse_params(s, kind);
+        auto get = [&](const string& name, double def)
+        {
+            auto it = params.find(name);
+            return it == params.end() ? def : it->second;
+        };
+        // a negative or out-of-range double does not convert to an integer
+        auto get_count = [&](const string& name, uint64_t def)
+        {
+            double v = get(name, def);
+            if (!(v >= 0 && v < ldexp(1.0, 64) && v == floor(v)))
+            {
+                stringstream ss;
+                ss << name << "=" << v;
+                throw invalid_argument("bad number in workload spec: " + ss.str());
+            }
+            return (uint64_t)v;
+        };
+
+        size_t n = get_count("keys", 1000000);
+        size_t ops = get_count("ops", 10000000);
+        uint64_t seed = get_count("seed", 1);
+        if (n == 0 || n > numeric_limits<uint32_t>::max())
+            throw invalid_argument("workload keys must be in [1, 2^32)");
+
+        utils::WyRand rng(utils::splitmix64(seed));
+        stream.resize(ops);
+
+        if (kind == "uniform" || kind == "collide")
+        {
+            if (kind == "uniform")
+                make_random_pool(n, seed);
+            else
+                make_colliding_pool(n, get_count("group", 16), seed);
+            for (auto& it : stream)
+            {
+                it = ((rng() >> 32U) * n) >> 32U;
+            }
+        }
+        else if (kind == "zipf")
+        {
+            double alpha = get("alpha", 1.0);
+            make_random_pool(n, seed);
+            vector<double> weights(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                weights[i] = pow((double)(i + 1), -alpha);
+            }
+            AliasTable table(weights);
+            for (auto& it : stream)
+            {
+                it = table.sample(rng());
+            }
+        }
+        else if (kind == "hotset")
+        {
+            size_t hot = get_count("hot", 1000);
+            double frac = get("frac", 0.9);
+            if (hot == 0 || hot >= n || frac < 0 || frac > 1)
+                throw invalid_argument("hotset needs 0 < hot < keys and 0 <= frac <= 1");
+            make_random_pool(n, seed);
+            uint64_t threshold = frac >= 1.0 ? numeric_limits<uint64_t>::max() : (uint64_t)ldexp(frac, 64);
+            for (auto& it : stream)
+            {
+                uint64_t r = rng();
+                uint64_t pick = rng() >> 32U;
+                it = r < threshold ? (pick * hot) >> 32U : hot + ((pick * (n - hot)) >> 32U);
+            }
+        }
+        else
+        {
+            throw invalid_argument("unknown workload " + kind);
+        }
+    }
+
+    void Workload::make_random_pool(size_t n, uint64_t seed)
+    {
+        pool.resize(n);
+        uint64_t base = utils::splitmix64(seed ^ 0x5EEDULL);
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint64_t x = base + i * 4;
+            for (size_t w = 0; w < 4; ++w)
+            {
+                uint64_t r = utils::splitmix64(x + w);
+                pool[i].u32[2 * w] = (uint32_t)r;
+                pool[i].u32[2 * w + 1] = (uint32_t)(r >> 32U);
+            }
+        }
+    }
+
+    void Workload::make_colliding_pool(size_t n, size_t group, uint64_t seed)
+    {
+        // Bytes 4..31 form 14 pairs (c[p], c[p + 1]) = (d, 100 - 33d), d in 0..3.
+        // Every choice keeps sig = 33 * sig + c unchanged and leaves u32[0] alone,
+        // so members of a group differ only in d's.
+        constexpr size_t PAIRS = 14;
+        if (group == 0 || group > (1ULL << (2 * PAIRS)))
+            throw invalid_argument("collide group must be in [1, 4^14]");
+
+        pool.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            size_t g = i / group;
+            size_t member = i % group;
+            uint64_t r = utils::splitmix64(seed ^ (g * 0x9E3779B97F4A7C15ULL));
+
+            Compressed128Mer& key = pool[i];
+            key.u32[0] = (uint32_t)r;
+            // distinguish groups through the base values of the pairs too
+            uint64_t base = r >> 32U;
+            for (size_t p = 0; p < PAIRS; ++p)
+            {
+                int d = (member >> (2 * p)) & 3U;
+                int shift = (base >> (2 * p)) & 3U;
+                key.c[4 + 2 * p] = (char)(d + 4 * shift);
+                key.c[5 + 2 * p] = (char)(100 - 33 * d);
+            }
+        }
+    }
+}
@@ -0,0 +1,277 @@
+#include "CountMinSketch/MurmurCountMinSketch.hh"
+#include "HDSketch/HDSketchAVX512.hh"
+#include "benchmarks/Workload.hh"
+#include "utils/CapacityPlanner.hh"
+#include "utils/Checkpoint.hh"
+#include "utils/Syncmer.hh"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+using namespace std;
+using namespace bench;
+
+struct Options
+{
+    string sketch = "hd-avx512";
+    string fasta;
+    string workload;
+    string output;
+    string checkpoint;
+    size_t checkpoint_every = 1 << 24;
+    bool resume = false;
+    double load_factor = 1.0;
+    size_t rows = 4;
+    size_t keys = 0;
+    double target_error = 0;
+    double distinct = 0;
+    size_t headroom = 4;
+    size_t sample = 0;
+    bool compress = false;
+    unsigned long seed = 0;
+};
+
+string usage(const char* prog)
+{
+    stringstream ss;
+    ss << "Usage: " << prog << " (--fasta FILE | --workload SPEC) --output FILE [options]\n"
+       << "Builds a sketch from a key stream and persists it for sketch-server.\n"
+       << "  --sketch NAME         hd-avx512 or cms (default hd-avx512)\n"
+       << "  --load-factor F       keys per 64-byte bucket of the HD baseline (default 1);\n"
+       << "                        cms gets the same memory\n"
+       << "  --rows N              rows of cms (default 4)\n"
+       << "  --keys N              stream keys inserted, 0 = all (default 0)\n"
+       << "  --target-error E      size the sketch for estimates within E counts with 99%\n"
+       << "                        probability instead of by load factor\n"
+       << "  --distinct N          expected distinct keys for --target-error (default: keys)\n"
+       << "  --headroom H          hd-avx512 with --target-error starts H times larger, rounded\n"
+       << "                        to a power of two, and folds down to what the data needs (default 4)\n"
+       << "  --sample W            insert only the closed syncmers of window W, about 2 / W of\n"
+       << "                        the 128-mers of --fasta; query with sketch-client --sample W\n"
+       << "  --compress            write the compressed format (zigzag bit planes)\n"
+       << "  --checkpoint DIR      hd-avx512 only: checkpoint the buckets written to DIR\n"
+       << "  --checkpoint-every N  keys between checkpoints (default 16777216)\n"
+       << "  --resume              rebuild the sketch from --checkpoint and insert the rest\n"
+       << "                        of the stream; the sizing options are ignored\n"
+       << "  --seed N              RNG seed, 0 = random (default 0)\n";
+    return ss.str();
+}
+
+Options parse(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--compress")
+        {
+            opt.compress = true;
+            continue;
+        }
+        if (arg == "--resume")
+        {
+            opt.resume = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw invalid_argument("missing value for " + arg);
+        string val = argv[++i];
+
+        if (arg == "--sketch")
+            opt.sketch = val;
+        else if (arg == "--fasta")
+            opt.fasta = val;
+        else if (arg == "--workload")
+            opt.workload = val;
+        else if (arg == "--output")
+            opt.output = val;
+        else if (arg == "--load-factor")
+            opt.load_factor = stod(val);
+        else if (arg == "--rows")
+            opt.rows = stoul(val);
+        else if (arg == "--keys")
+            opt.keys = stoul(val);
+        else if (arg == "--target-error")
+            opt.target_error = stod(val);
+        else if (arg == "--distinct")
+            opt.distinct = stod(val);
+        else if (arg == "--headroom")
+            opt.headroom = stoul(val);
+        else if (arg == "--sample")
+            opt.sample = stoul(val);
+        else if (arg == "--seed")
+            opt.seed = stoul(val);
+        else if (arg == "--checkpoint")
+            opt.checkpoint = val;
+        else if (arg == "--checkpoint-every")
+            opt.checkpoint_every = stoul(val);
+        else
+            throw invalid_argument("unknown option " + arg);
+    }
+    if (opt.fasta.empty() == opt.workload.empty())
+        throw invalid_argument("exactly one of --fasta and --workload is required");
+    if (opt.output.empty())
+        throw invalid_argument("--output is required");
+    if (opt.sketch != "hd-avx512" && opt.sketch != "cms")
+        throw invalid_argument("unknown sketch " + opt.sketch);
+    if (opt.load_factor <= 0 || opt.rows == 0 || opt.headroom == 0 || opt.target_error < 0)
+        throw invalid_argument("load factor, rows and headroom must be positive");
+    if (!opt.checkpoint.empty() && opt.sketch != "hd-avx512")
+        throw invalid_argument("--checkpoint needs hd-avx512");
+    if (opt.resume && opt.checkpoint.empty())
+        throw invalid_argument("--resume needs --checkpoint");
+    if (opt.checkpoint_every == 0)
+        throw invalid_argument("--checkpoint-every must be positive");
+    if (opt.sample != 0 && (opt.sample < 2 || opt.sample > utils::SyncmerSampler::MAX_WINDOW))
+        throw invalid_argument("sample window must be in [2, 112]");
+    if (opt.sample != 0 && opt.fasta.empty())
+        throw invalid_argument("--sample needs --fasta");
+    return opt;
+}
+
+/**
+ * @brief Inserts keys begin to n of the source in batches
+ * @param checkpoint called with the position every `every` keys, if set
+ */
+template <typename S>
+void build(S& sketch, const KeySource& src, size_t begin, size_t n,
+    const function<void(size_t)>& checkpoint = nullptr, size_t every = 0)
+{
+    static constexpr size_t BATCH = 256;
+    vector<Compressed128Mer> buf(BATCH);
+    size_t next = checkpoint ? begin + every : n;
+    for (size_t i = begin; i < n;)
+    {
+        size_t m = min({BATCH, n - i, next - i});
+        for (size_t j = 0; j < m; ++j)
+        {
+            src.read(i + j, buf[j]);
+        }
+        sketch.insert_batch(buf.data(), m);
+        i += m;
+        if (i == next && i < n)
+        {
+            checkpoint(i);
+            next += every;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    try
+    {
+        opt = parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << "\n" << usage(argv[0]);
+        return 1;
+    }
+    if (opt.seed == 0)
+        opt.seed = random_device()();
+    mt19937_64 gen(opt.seed);
+
+    try
+    {
+        unique_ptr<Fasta> fa;
+        unique_ptr<Workload> wl;
+        unique_ptr<KeySource> src;
+        if (!opt.fasta.empty())
+        {
+            fa = make_unique<Fasta>(opt.fasta);
+            src = make_unique<KeySource>(*fa);
+            if (opt.sample)
+            {
+                utils::SyncmerSampler sampler(opt.sample);
+                size_t all = src->size();
+                src = make_unique<KeySource>(*fa, sampler.select(fa->data(), fa->size()));
+                cerr << "sampled " << src->size() << " of " << all << " 128-mers (window " << opt.sample << ")" << endl;
+            }
+        }
+        else
+        {
+            wl = make_unique<Workload>(opt.workload);
+            src = make_unique<KeySource>(*wl);
+        }
+        size_t n = opt.keys ? min(opt.keys, src->size()) : src->size();
+
+        size_t buckets = max<size_t>(1, n / opt.load_factor);
+        size_t width = n / opt.load_factor * 32 / opt.rows + 1;
+        size_t rows = opt.rows;
+        utils::CapacityPlan plan;
+        if (opt.target_error > 0)
+        {
+            utils::CapacityTarget t;
+            t.distinct = opt.distinct > 0 ? opt.distinct : n;
+            t.total = n;
+            t.error = opt.target_error;
+            plan = utils::plan(opt.sketch, t);
+            buckets = utils::next_pow2(plan.width * opt.headroom);
+            width = plan.width;
+            rows = plan.rows;
+            cerr << "planned " << plan.sketch << " width " << plan.width << (plan.rows ? " rows " + to_string(plan.rows) : "")
+                 << " (" << plan.bytes << " bytes) for error " << plan.error
+                 << (plan.overflow_risk ? ", counters may overflow" : "") << endl;
+        }
+
+        size_t bytes;
+        if (opt.sketch == "hd-avx512")
+        {
+            using S = HDSketchAVX512<Compressed128Mer>;
+            unique_ptr<S> owned;
+            size_t begin = 0;
+            if (opt.resume)
+            {
+                uint64_t position;
+                owned = utils::recover<S>(opt.checkpoint, position);
+                begin = min<size_t>(position, n);
+                cerr << "resumed " << owned->size() << " buckets at key " << begin << " from " << opt.checkpoint << endl;
+            }
+            else
+            {
+                owned = make_unique<S>(buckets, gen);
+            }
+            S& sketch = *owned;
+            if (opt.checkpoint.empty())
+            {
+                build(sketch, *src, begin, n);
+            }
+            else
+            {
+                // the writer stops tracking when destroyed, before the sketch is folded
+                utils::CheckpointWriter<S> writer(sketch, opt.checkpoint, begin);
+                build(sketch, *src, begin, n, [&](size_t i) { writer.checkpoint(i); }, opt.checkpoint_every);
+                writer.checkpoint(n);
+                writer.wait();
+                cerr << "wrote " << writer.checkpoints() << " checkpoints of " << writer.bytes_written() << " bytes" << endl;
+            }
+            if (opt.target_error > 0)
+            {
+                size_t folds = utils::fold_to_fit(sketch, 32, opt.target_error);
+                cerr << "measured second moment " << sketch.second_moment() << ", folded " << folds
+                     << " times to " << sketch.size() << " buckets" << endl;
+            }
+            sketch.save(opt.output, opt.compress);
+            bytes = sketch.bytes();
+        }
+        else
+        {
+            MurmurCountMinSketch<Compressed128Mer, int16_t> sketch(width, rows, gen);
+            build(sketch, *src, 0, n);
+            sketch.save(opt.output, opt.compress);
+            bytes = sketch.bytes();
+        }
+        cerr << "wrote " << opt.sketch << " of " << n << " keys (" << bytes << " bytes) to " << opt.output << endl;
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
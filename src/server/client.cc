@@ -0,0 +1,264 @@
+#include "CountMinSketch/MurmurCountMinSketch.hh"
+#include "HDSketch/HDSketchAVX512.hh"
+#include "benchmarks/Workload.hh"
+#include "server/Protocol.hh"
+#include "utils/SketchFile.hh"
+#include "utils/Syncmer.hh"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using namespace std;
+using namespace bench;
+
+struct Options
+{
+    string socket;
+    string fasta;
+    string workload;
+    string verify;
+    size_t keys = 0;
+    size_t batch = 64;
+    size_t clients = 1;
+    size_t sample = 0;
+};
+
+string usage(const char* prog)
+{
+    stringstream ss;
+    ss << "Usage: " << prog << " --socket PATH (--fasta FILE | --workload SPEC) [options]\n"
+       << "Queries every key of the stream against sketch-server and reports throughput.\n"
+       << "  --keys N              stream keys queried, 0 = all (default 0)\n"
+       << "  --batch N             keys per request (default 64)\n"
+       << "  --clients N           concurrent connections (default 1)\n"
+       << "  --sample W            query only the closed syncmers of window W, for sketches\n"
+       << "                        built with sketch-build --sample W; the other keys are\n"
+       << "                        reported as unsampled\n"
+       << "  --verify FILE         compare the answers with the sketch file loaded in-process\n";
+    return ss.str();
+}
+
+Options parse(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+            throw invalid_argument("missing value for " + arg);
+        string val = argv[++i];
+
+        if (arg == "--socket")
+            opt.socket = val;
+        else if (arg == "--fasta")
+            opt.fasta = val;
+        else if (arg == "--workload")
+            opt.workload = val;
+        else if (arg == "--verify")
+            opt.verify = val;
+        else if (arg == "--keys")
+            opt.keys = stoul(val);
+        else if (arg == "--batch")
+            opt.batch = stoul(val);
+        else if (arg == "--clients")
+            opt.clients = stoul(val);
+        else if (arg == "--sample")
+            opt.sample = stoul(val);
+        else
+            throw invalid_argument("unknown option " + arg);
+    }
+    if (opt.socket.empty())
+        throw invalid_argument("--socket is required");
+    if (opt.fasta.empty() == opt.workload.empty())
+        throw invalid_argument("exactly one of --fasta and --workload is required");
+    if (opt.batch == 0 || opt.batch > server::MAX_KEYS_PER_REQUEST || opt.clients == 0)
+        throw invalid_argument("batch and clients must be positive and batch at most "
+            + to_string(server::MAX_KEYS_PER_REQUEST));
+    if (opt.sample != 0 && (opt.sample < 2 || opt.sample > utils::SyncmerSampler::MAX_WINDOW))
+        throw invalid_argument("sample window must be in [2, 112]");
+    return opt;
+}
+
+/**
+ * @brief The sketch behind a server connection, one request per estimate_batch
+ */
+struct RemoteSketch
+{
+    int fd;
+    mutable bool failed = false;
+
+    double estimate(const Compressed128Mer& key) const
+    {
+        double result = 0;
+        estimate_batch(&key, 1, &result);
+        return result;
+    }
+
+    void estimate_batch(const Compressed128Mer* keys, size_t n, double* out) const
+    {
+        failed = failed || !server::estimate(fd, keys, n, out);
+    }
+};
+
+/**
+ * @brief Estimates the keys through sketch, or only the sampled ones if sampler is set
+ */
+template <typename S>
+void estimate_keys(const S& sketch, const utils::SyncmerSampler* sampler, const Compressed128Mer* keys, size_t n,
+    double* out)
+{
+    if (sampler)
+        utils::SampledSketch<S>(sketch, *sampler).estimate_batch(keys, n, out);
+    else
+        sketch.estimate_batch(keys, n, out);
+}
+
+/**
+ * @brief Estimates of the sketch file computed in-process
+ */
+template <typename S>
+vector<double> local_estimates(const string& path, const utils::SyncmerSampler* sampler,
+    const vector<Compressed128Mer>& keys)
+{
+    S sketch(path);
+    vector<double> out(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        out[i] = sampler ? utils::SampledSketch<S>(sketch, *sampler).estimate(keys[i]) : sketch.estimate(keys[i]);
+    }
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    try
+    {
+        opt = parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << "\n" << usage(argv[0]);
+        return 1;
+    }
+
+    vector<Compressed128Mer> keys;
+    vector<int> fds;
+    unique_ptr<utils::SyncmerSampler> sampler;
+    if (opt.sample)
+        sampler = make_unique<utils::SyncmerSampler>(opt.sample);
+    try
+    {
+        unique_ptr<Fasta> fa;
+        unique_ptr<Workload> wl;
+        unique_ptr<KeySource> src;
+        if (!opt.fasta.empty())
+        {
+            fa = make_unique<Fasta>(opt.fasta);
+            src = make_unique<KeySource>(*fa);
+        }
+        else
+        {
+            wl = make_unique<Workload>(opt.workload);
+            src = make_unique<KeySource>(*wl);
+        }
+        keys.resize(opt.keys ? min(opt.keys, src->size()) : src->size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            src->read(i, keys[i]);
+        }
+        for (size_t c = 0; c < opt.clients; ++c)
+        {
+            fds.push_back(server::connect_unix(opt.socket));
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // each client queries a contiguous slice of the keys, one request at a time
+    vector<double> estimates(keys.size());
+    vector<char> failed(opt.clients, 0);
+    vector<thread> workers;
+    size_t slice = (keys.size() + opt.clients - 1) / opt.clients;
+    auto begin = chrono::steady_clock::now();
+    for (size_t c = 0; c < opt.clients; ++c)
+    {
+        workers.emplace_back([&, c]()
+        {
+            RemoteSketch remote{fds[c]};
+            size_t end = min(keys.size(), (c + 1) * slice);
+            for (size_t i = c * slice; i < end; i += opt.batch)
+            {
+                estimate_keys(remote, sampler.get(), keys.data() + i, min(opt.batch, end - i), estimates.data() + i);
+                if (remote.failed)
+                {
+                    failed[c] = 1;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto& it : workers)
+    {
+        it.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    for (auto fd : fds)
+    {
+        close(fd);
+    }
+    if (count(failed.begin(), failed.end(), 1))
+    {
+        cerr << "lost the connection to " << opt.socket << endl;
+        return 1;
+    }
+
+    double checksum = 0;
+    size_t unsampled = 0;
+    for (auto e : estimates)
+    {
+        if (e == utils::UNSAMPLED)
+            ++unsampled;
+        else
+            checksum += e;
+    }
+    size_t requests = opt.clients * ((slice + opt.batch - 1) / opt.batch);
+    cout << fixed << setprecision(3)
+         << "keys " << keys.size() << ", clients " << opt.clients << ", batch " << opt.batch << "\n"
+         << (sampler ? "unsampled " + to_string(unsampled) + "\n" : "")
+         << "throughput " << keys.size() / seconds / 1e6 << " Mkeys/s, "
+         << requests / seconds / 1e3 << " krequests/s\n"
+         << "checksum " << checksum << "\n";
+
+    if (!opt.verify.empty())
+    {
+        vector<double> expected;
+        try
+        {
+            if (utils::sketch_kind(opt.verify) == utils::SketchKind::HDSketchAVX512)
+                expected = local_estimates<HDSketchAVX512<Compressed128Mer>>(opt.verify, sampler.get(), keys);
+            else
+                expected = local_estimates<MurmurCountMinSketch<Compressed128Mer, int16_t>>(opt.verify, sampler.get(), keys);
+        }
+        catch (const exception& e)
+        {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        size_t mismatches = 0;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            mismatches += estimates[i] != expected[i];
+        }
+        cout << "verify " << (mismatches ? "FAILED" : "ok") << " (" << mismatches << " mismatches)\n";
+        return mismatches ? 1 : 0;
+    }
+}
@@ -0,0 +1,459 @@
+#include "CountMinSketch/MurmurCountMinSketch.hh"
+#include "HDSketch/HDSketchAVX512.hh"
+#include "server/Protocol.hh"
+#include "utils/SketchFile.hh"
+#include <algorithm>
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+using namespace std;
+using utils::Compressed128Mer;
+
+/**
+ * @brief Type-erased read-only sketch behind the server
+ */
+class Backend
+{
+    public:
+    virtual ~Backend() {}
+
+    virtual void estimate_batch(const Compressed128Mer* keys, size_t n, double* out) const = 0;
+
+    virtual size_t bytes() const = 0;
+};
+
+template <typename S>
+class SketchBackend : public Backend
+{
+    public:
+    SketchBackend(const string& path) : sketch(path) {}
+
+    void estimate_batch(const Compressed128Mer* keys, size_t n, double* out) const override
+    {
+        using E = decltype(sketch.estimate(keys[0]));
+        if constexpr (is_same<E, double>::value)
+        {
+            sketch.estimate_batch(keys, n, out);
+        }
+        else
+        {
+            buf.resize(n);
+            sketch.estimate_batch(keys, n, buf.data());
+            copy(buf.begin(), buf.end(), out);
+        }
+    }
+
+    size_t bytes() const override { return sketch.bytes(); }
+
+    protected:
+    S sketch;
+    mutable vector<decltype(declval<S>().estimate(declval<Compressed128Mer>()))> buf;
+};
+
+unique_ptr<Backend> load(const string& path)
+{
+    switch (utils::sketch_kind(path))
+    {
+        case utils::SketchKind::HDSketchAVX512:
+            return make_unique<SketchBackend<HDSketchAVX512<Compressed128Mer>>>(path);
+        case utils::SketchKind::MurmurCountMinSketch:
+            return make_unique<SketchBackend<MurmurCountMinSketch<Compressed128Mer, int16_t>>>(path);
+    }
+    throw runtime_error(path + " holds an unsupported kind of sketch");
+}
+
+/**
+ * @brief Connection state; requests are parsed from in, responses queued in out
+ */
+struct Client
+{
+    int fd;
+    vector<char> in;
+    size_t in_pos = 0;
+    vector<char> out;
+    size_t out_pos = 0;
+    bool reading = true;    // registered for EPOLLIN
+    bool writing = false;   // registered for EPOLLOUT
+    bool eof = false;       // the client sends no more requests
+    bool broken = false;    // read or write error
+};
+
+// a client with more responses queued gets no more requests taken until it reads them
+static constexpr size_t MAX_QUEUED_OUT = 1 << 20;
+// input buffered per client, room for the largest request
+static constexpr size_t MAX_BUFFERED_IN
+    = 2 * (sizeof(server::RequestHeader) + server::MAX_KEYS_PER_REQUEST * sizeof(Compressed128Mer));
+
+/**
+ * @brief Requests of one client taken into the current batch
+ */
+struct Pending
+{
+    Client* client;
+    size_t keys;
+};
+
+struct Stats
+{
+    size_t requests = 0;
+    size_t keys = 0;
+    size_t batches = 0;
+    size_t max_batch = 0;
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int)
+{
+    stop = 1;
+}
+
+static size_t queued(const Client& c)
+{
+    return c.out.size() - c.out_pos;
+}
+
+/**
+ * @brief Whether the client has a complete, or malformed, request buffered
+ */
+static bool has_request(const Client& c)
+{
+    if (c.in.size() - c.in_pos < sizeof(server::RequestHeader))
+        return false;
+    server::RequestHeader h;
+    memcpy(&h, c.in.data() + c.in_pos, sizeof(h));
+    if (h.magic != server::REQUEST_MAGIC || h.count > server::MAX_KEYS_PER_REQUEST)
+        return true;
+    return c.in.size() - c.in_pos >= sizeof(h) + h.count * sizeof(Compressed128Mer);
+}
+
+/**
+ * @brief Registers for input unless the client hit EOF, has too many responses
+ * queued or a full input buffer, and for output while responses are queued
+ */
+static void watch(int ep, Client& c)
+{
+    bool read = !c.eof && queued(c) <= MAX_QUEUED_OUT && c.in.size() - c.in_pos < MAX_BUFFERED_IN;
+    bool write = queued(c) > 0;
+    if (read != c.reading || write != c.writing)
+    {
+        epoll_event ev;
+        ev.events = (read ? (uint32_t)EPOLLIN : 0U) | (write ? (uint32_t)EPOLLOUT : 0U);
+        ev.data.fd = c.fd;
+        epoll_ctl(ep, EPOLL_CTL_MOD, c.fd, &ev);
+        c.reading = read;
+        c.writing = write;
+    }
+}
+
+/**
+ * @brief Reads what is available, up to MAX_BUFFERED_IN; notes EOF, marks the
+ * client broken on errors
+ */
+static void fill(Client& c)
+{
+    char buf[1 << 16];
+    while (c.in.size() - c.in_pos < MAX_BUFFERED_IN)
+    {
+        ssize_t r = read(c.fd, buf, sizeof(buf));
+        if (r > 0)
+        {
+            c.in.insert(c.in.end(), buf, buf + r);
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r == 0)
+            c.eof = true;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            c.broken = true;
+        return;
+    }
+}
+
+/**
+ * @brief Writes queued responses; registers for EPOLLOUT if the socket is full
+ */
+static void flush(int ep, Client& c)
+{
+    while (c.out_pos < c.out.size())
+    {
+        ssize_t r = write(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos);
+        if (r > 0)
+        {
+            c.out_pos += r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        c.broken = true;
+        return;
+    }
+    if (c.out_pos == c.out.size())
+    {
+        c.out.clear();
+        c.out_pos = 0;
+    }
+    watch(ep, c);
+}
+
+/**
+ * @brief Takes complete requests of a client into the batch, up to max_keys in total
+ * @return whether the client still has complete requests left
+ */
+static bool take(Client& c, vector<Compressed128Mer>& keys, vector<Pending>& pending, size_t max_keys, Stats& stats)
+{
+    while (c.in.size() - c.in_pos >= sizeof(server::RequestHeader))
+    {
+        server::RequestHeader h;
+        memcpy(&h, c.in.data() + c.in_pos, sizeof(h));
+        if (h.magic != server::REQUEST_MAGIC || h.count > server::MAX_KEYS_PER_REQUEST)
+        {
+            c.broken = true;
+            return false;
+        }
+        size_t bytes = sizeof(h) + h.count * sizeof(Compressed128Mer);
+        if (c.in.size() - c.in_pos < bytes)
+            break;
+        if (!keys.empty() && keys.size() + h.count > max_keys)
+            return true;
+
+        size_t base = keys.size();
+        keys.resize(base + h.count);
+        memcpy(keys.data() + base, c.in.data() + c.in_pos + sizeof(h), h.count * sizeof(Compressed128Mer));
+        pending.push_back({&c, h.count});
+        c.in_pos += bytes;
+        stats.requests += 1;
+    }
+    // compact the consumed prefix
+    c.in.erase(c.in.begin(), c.in.begin() + c.in_pos);
+    c.in_pos = 0;
+    return false;
+}
+
+struct Options
+{
+    string sketch;
+    string socket;
+    size_t max_batch = 4096;
+};
+
+string usage(const char* prog)
+{
+    stringstream ss;
+    ss << "Usage: " << prog << " --sketch FILE --socket PATH [--max-batch N]\n"
+       << "Serves estimate requests against a sketch persisted with sketch-build.\n"
+       << "Requests that arrive together from any number of clients are answered\n"
+       << "from one prefetched batch of at most N keys (default 4096).\n";
+    return ss.str();
+}
+
+Options parse(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+            throw invalid_argument("missing value for " + arg);
+        string val = argv[++i];
+
+        if (arg == "--sketch")
+            opt.sketch = val;
+        else if (arg == "--socket")
+            opt.socket = val;
+        else if (arg == "--max-batch")
+            opt.max_batch = stoul(val);
+        else
+            throw invalid_argument("unknown option " + arg);
+    }
+    if (opt.sketch.empty() || opt.socket.empty())
+        throw invalid_argument("--sketch and --socket are required");
+    if (opt.max_batch == 0)
+        throw invalid_argument("max batch must be positive");
+    return opt;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    try
+    {
+        opt = parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << "\n" << usage(argv[0]);
+        return 1;
+    }
+    const string& sketch_path = opt.sketch;
+    const string& socket_path = opt.socket;
+    size_t max_batch = opt.max_batch;
+
+    unique_ptr<Backend> sketch;
+    int listener;
+    try
+    {
+        sketch = load(sketch_path);
+        sockaddr_un addr = server::unix_address(socket_path);
+        // only a stale socket is replaced, never a file that --socket names by mistake
+        struct stat st;
+        if (lstat(socket_path.c_str(), &st) == 0)
+        {
+            if (!S_ISSOCK(st.st_mode))
+                throw runtime_error(socket_path + " exists and is not a socket");
+            unlink(socket_path.c_str());
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (listener < 0 || ::bind(listener, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 128) != 0)
+            throw runtime_error("cannot listen on " + socket_path + ": " + strerror(errno));
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    cerr << "serving " << sketch_path << " (" << sketch->bytes() << " bytes) on " << socket_path << endl;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int ep = epoll_create1(0);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listener;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listener, &ev);
+
+    unordered_map<int, unique_ptr<Client>> clients;
+    vector<Client*> backlog;     // clients with complete requests left over from a full batch
+    vector<Compressed128Mer> keys;
+    vector<double> estimates;
+    vector<Pending> pending;
+    Stats stats;
+    epoll_event events[256];
+
+    while (!stop)
+    {
+        int n = epoll_wait(ep, events, 256, backlog.empty() ? -1 : 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        vector<Client*> ready;
+        ready.swap(backlog);
+        for (int i = 0; i < n; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listener)
+            {
+                int c;
+                while ((c = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0)
+                {
+                    auto client = make_unique<Client>();
+                    client->fd = c;
+                    epoll_event cev;
+                    cev.events = EPOLLIN;
+                    cev.data.fd = c;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, c, &cev);
+                    clients[c] = move(client);
+                }
+                continue;
+            }
+
+            auto it = clients.find(fd);
+            if (it == clients.end())
+                continue;
+            Client& c = *it->second;
+            if (events[i].events & EPOLLOUT)
+            {
+                // requests held back while the responses were queued can go now
+                flush(ep, c);
+                ready.push_back(&c);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                fill(c);
+                ready.push_back(&c);
+            }
+        }
+
+        // coalesce the requests of every ready client into one batch
+        sort(ready.begin(), ready.end());
+        ready.erase(unique(ready.begin(), ready.end()), ready.end());
+        keys.clear();
+        pending.clear();
+        for (auto c : ready)
+        {
+            if (!c->broken && queued(*c) <= MAX_QUEUED_OUT && take(*c, keys, pending, max_batch, stats))
+                backlog.push_back(c);
+        }
+
+        if (!keys.empty())
+        {
+            estimates.resize(keys.size());
+            sketch->estimate_batch(keys.data(), keys.size(), estimates.data());
+            stats.batches += 1;
+            stats.keys += keys.size();
+            stats.max_batch = max(stats.max_batch, keys.size());
+
+            const double* p = estimates.data();
+            for (const auto& it : pending)
+            {
+                const char* bytes = (const char*)p;
+                it.client->out.insert(it.client->out.end(), bytes, bytes + it.keys * sizeof(double));
+                p += it.keys;
+            }
+        }
+        for (auto c : ready)
+        {
+            if (c->broken)
+                continue;
+            if (queued(*c) > 0 && !c->writing)
+                flush(ep, *c);
+            else
+                watch(ep, *c);
+        }
+
+        // close broken connections, and finished ones once their answers are out,
+        // now that no batch refers to them
+        for (auto it = clients.begin(); it != clients.end();)
+        {
+            Client& c = *it->second;
+            if (c.broken || (c.eof && queued(c) == 0 && !has_request(c)))
+            {
+                backlog.erase(remove(backlog.begin(), backlog.end(), &c), backlog.end());
+                epoll_ctl(ep, EPOLL_CTL_DEL, c.fd, nullptr);
+                close(c.fd);
+                it = clients.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    cerr << "served " << stats.requests << " requests, " << stats.keys << " keys in " << stats.batches
+         << " batches (mean " << (stats.batches ? (double)stats.keys / stats.batches : 0)
+         << " keys, max " << stats.max_batch << ")" << endl;
+    for (auto& it : clients)
+    {
+        close(it.first);
+    }
+    close(listener);
+    unlink(socket_path.c_str());
+}
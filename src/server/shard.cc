@@ -0,0 +1,251 @@
+#include "CountMinSketch/MurmurCountMinSketch.hh"
+#include "HDSketch/HDSketchAVX512.hh"
+#include "benchmarks/Workload.hh"
+#include "server/Shard.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+using namespace std;
+using namespace bench;
+
+struct Options
+{
+    string sketch = "hd-avx512";
+    string fasta;
+    string workload;
+    string output;
+    size_t shards = 2;
+    double load_factor = 1.0;
+    size_t rows = 4;
+    size_t keys = 0;
+    size_t batch = 4096;
+    bool pin = false;
+    bool compare = false;
+    unsigned long seed = 0;
+};
+
+string usage(const char* prog)
+{
+    stringstream ss;
+    ss << "Usage: " << prog << " (--fasta FILE | --workload SPEC) [options]\n"
+       << "Launches local shard processes, each owning the keys of one hash range,\n"
+       << "streams the keys into them through shared-memory rings, queries every key\n"
+       << "back and reports the throughput of both.\n"
+       << "  --shards N            shard processes (default 2)\n"
+       << "  --sketch NAME         hd-avx512 or cms (default hd-avx512)\n"
+       << "  --load-factor F       keys per 64-byte bucket of the HD baseline over all\n"
+       << "                        shards (default 1); cms gets the same memory\n"
+       << "  --rows N              rows of cms (default 4)\n"
+       << "  --keys N              stream keys inserted, 0 = all (default 0)\n"
+       << "  --batch N             keys the front end routes per call (default 4096)\n"
+       << "  --pin                 pin shard i to the i-th available CPU, so its sketch is\n"
+       << "                        allocated on that CPU's memory node\n"
+       << "  --compare             also run one in-process sketch of the same memory\n"
+       << "  --output PREFIX       shard i saves its sketch to PREFIX.i\n"
+       << "  --seed N              RNG seed, 0 = random (default 0)\n";
+    return ss.str();
+}
+
+Options parse(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--pin")
+        {
+            opt.pin = true;
+            continue;
+        }
+        if (arg == "--compare")
+        {
+            opt.compare = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw invalid_argument("missing value for " + arg);
+        string val = argv[++i];
+
+        if (arg == "--sketch")
+            opt.sketch = val;
+        else if (arg == "--fasta")
+            opt.fasta = val;
+        else if (arg == "--workload")
+            opt.workload = val;
+        else if (arg == "--output")
+            opt.output = val;
+        else if (arg == "--shards")
+            opt.shards = stoul(val);
+        else if (arg == "--load-factor")
+            opt.load_factor = stod(val);
+        else if (arg == "--rows")
+            opt.rows = stoul(val);
+        else if (arg == "--keys")
+            opt.keys = stoul(val);
+        else if (arg == "--batch")
+            opt.batch = stoul(val);
+        else if (arg == "--seed")
+            opt.seed = stoul(val);
+        else
+            throw invalid_argument("unknown option " + arg);
+    }
+    if (opt.fasta.empty() == opt.workload.empty())
+        throw invalid_argument("exactly one of --fasta and --workload is required");
+    if (opt.sketch != "hd-avx512" && opt.sketch != "cms")
+        throw invalid_argument("unknown sketch " + opt.sketch);
+    if (opt.shards == 0 || opt.batch == 0 || opt.load_factor <= 0 || opt.rows == 0)
+        throw invalid_argument("shards, batch, load factor and rows must be positive");
+    return opt;
+}
+
+struct Timing
+{
+    double insert_ns;
+    double estimate_ns;
+    double mean;
+};
+
+/**
+ * @brief Inserts all keys, then estimates them, batch keys per call
+ */
+template <typename F, typename G>
+Timing run(const vector<Compressed128Mer>& keys, size_t batch, F insert, G estimate)
+{
+    size_t n = keys.size();
+    vector<double> est(n);
+    auto t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i += batch)
+    {
+        insert(keys.data() + i, min(batch, n - i));
+    }
+    auto t1 = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i += batch)
+    {
+        estimate(keys.data() + i, min(batch, n - i), est.data() + i);
+    }
+    auto t2 = chrono::steady_clock::now();
+    double sum = 0;
+    for (double e : est)
+    {
+        sum += e;
+    }
+    return {chrono::duration<double, nano>(t1 - t0).count() / max<size_t>(1, n),
+        chrono::duration<double, nano>(t2 - t1).count() / max<size_t>(1, n), sum / max<size_t>(1, n)};
+}
+
+template <typename S, typename Make>
+Timing run_sharded(const Options& opt, const vector<Compressed128Mer>& keys, Make make)
+{
+    mt19937_64 gen(opt.seed);
+    uint32_t route_seed = gen();
+    server::ShardedSketch sharded(opt.shards, route_seed, [&](size_t i, server::ShardChannel& channel)
+    {
+        // a different generator per shard, so shards do not share hash functions
+        mt19937_64 shard_gen(opt.seed + i + 1);
+        unique_ptr<S> sketch = make(shard_gen, opt.shards);
+        server::serve_shard(*sketch, channel);
+        if (!opt.output.empty())
+            sketch->save(opt.output + "." + to_string(i));
+    }, opt.pin);
+
+    Timing t = run(keys, opt.batch,
+        [&](const Compressed128Mer* k, size_t m) { sharded.insert_batch(k, m); },
+        [&](const Compressed128Mer* k, size_t m, double* out) { sharded.estimate_batch(k, m, out); });
+    sharded.finish();
+    return t;
+}
+
+template <typename S, typename Make>
+void run_all(const Options& opt, const vector<Compressed128Mer>& keys, Make make)
+{
+    Timing t = run_sharded<S>(opt, keys, make);
+    cout << opt.shards << " shards: insert " << t.insert_ns << " ns/key (" << 1e3 / t.insert_ns << " Mkeys/s), estimate "
+         << t.estimate_ns << " ns/key, mean estimate " << t.mean << endl;
+    if (opt.compare)
+    {
+        mt19937_64 gen(opt.seed);
+        unique_ptr<S> sketch = make(gen, 1);
+        Timing b = run(keys, opt.batch,
+            [&](const Compressed128Mer* k, size_t m) { sketch->insert_batch(k, m); },
+            [&](const Compressed128Mer* k, size_t m, double* out)
+            {
+                using E = decltype(sketch->estimate(k[0]));
+                vector<E> buf(m);
+                sketch->estimate_batch(k, m, buf.data());
+                copy(buf.begin(), buf.end(), out);
+            });
+        cout << "in-process: insert " << b.insert_ns << " ns/key (" << 1e3 / b.insert_ns << " Mkeys/s), estimate "
+             << b.estimate_ns << " ns/key, mean estimate " << b.mean << endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    try
+    {
+        opt = parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << "\n" << usage(argv[0]);
+        return 1;
+    }
+    if (opt.seed == 0)
+        opt.seed = random_device()();
+
+    try
+    {
+        unique_ptr<Fasta> fa;
+        unique_ptr<Workload> wl;
+        unique_ptr<KeySource> src;
+        if (!opt.fasta.empty())
+        {
+            fa = make_unique<Fasta>(opt.fasta);
+            src = make_unique<KeySource>(*fa);
+        }
+        else
+        {
+            wl = make_unique<Workload>(opt.workload);
+            src = make_unique<KeySource>(*wl);
+        }
+        size_t n = opt.keys ? min(opt.keys, src->size()) : src->size();
+        vector<Compressed128Mer> keys(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            src->read(i, keys[i]);
+        }
+
+        // the memory of one sketch at this load factor, split evenly over the shards
+        size_t buckets = max<size_t>(1, n / opt.load_factor);
+        size_t width = n / opt.load_factor * 32 / opt.rows + 1;
+        cerr << "streaming " << n << " keys into " << opt.shards << " " << opt.sketch << " shards" << endl;
+        if (opt.sketch == "hd-avx512")
+        {
+            using S = HDSketchAVX512<Compressed128Mer>;
+            run_all<S>(opt, keys, [&](mt19937_64& gen, size_t parts)
+            {
+                return make_unique<S>(max<size_t>(1, buckets / parts), gen);
+            });
+        }
+        else
+        {
+            using S = MurmurCountMinSketch<Compressed128Mer, int16_t>;
+            run_all<S>(opt, keys, [&](mt19937_64& gen, size_t parts)
+            {
+                return make_unique<S>(max<size_t>(1, width / parts), opt.rows, gen);
+            });
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
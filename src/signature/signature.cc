@@ -0,0 +1,245 @@
+#include "HDSketch/GenomeSignature.hh"
+#include "utils/fasta.hh"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct Options
+{
+    vector<string> fasta;
+    vector<string> load;
+    string save;
+    string output;
+    size_t dim = 4096;
+    uint32_t seed = 1;
+};
+
+string usage(const char* prog)
+{
+    stringstream ss;
+    ss << "Usage: " << prog << " [options] [FASTA...]\n"
+       << "Builds an HD signature of the 128-mers of each FASTA file, over all of its\n"
+       << "records, and writes the all-vs-all similarity matrix as CSV.\n"
+       << "  --dim N               dimensions, 1024, 4096 or 16384 (default 4096)\n"
+       << "  --seed N              projection seed; only signatures of the same seed\n"
+       << "                        and dimensions compare (default 1)\n"
+       << "  --load FILE           adds the signatures saved in FILE; repeatable\n"
+       << "  --save FILE           saves all signatures to FILE\n"
+       << "  --output FILE         the matrix, default stdout\n";
+    return ss.str();
+}
+
+Options parse(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg.rfind("--", 0) != 0)
+        {
+            opt.fasta.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw invalid_argument("missing value for " + arg);
+        string val = argv[++i];
+
+        if (arg == "--dim")
+            opt.dim = stoul(val);
+        else if (arg == "--seed")
+            opt.seed = stoul(val);
+        else if (arg == "--load")
+            opt.load.push_back(val);
+        else if (arg == "--save")
+            opt.save = val;
+        else if (arg == "--output")
+            opt.output = val;
+        else
+            throw invalid_argument("unknown option " + arg);
+    }
+    if (opt.fasta.empty() && opt.load.empty())
+        throw invalid_argument("no FASTA files or signatures given");
+    if (opt.dim != 1024 && opt.dim != 4096 && opt.dim != 16384)
+        throw invalid_argument("dimensions must be 1024, 4096 or 16384");
+    return opt;
+}
+
+/**
+ * @brief On-disk header of a signature file
+ * The header is followed by count records: the k-mer count, the name
+ * length, the name, then dim / 64 words of signature bits.
+ */
+struct SignatureHeader
+{
+    static constexpr char MAGIC[8] = {'H', 'D', 'S', 'I', 'G', 'N', 'A', 'T'};
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t seed;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct Sample
+{
+    string name;
+    uint64_t kmers;
+};
+
+template <size_t D>
+void load(const string& path, const Options& opt, vector<Sample>& samples, vector<BinaryHV<D>>& sigs)
+{
+    ifstream f(path, ios::binary);
+    SignatureHeader h;
+    if (!f.read((char*)&h, sizeof(h)) || memcmp(h.magic, SignatureHeader::MAGIC, 8) != 0)
+        throw runtime_error(path + " is not a signature file");
+    if (h.version != SignatureHeader::VERSION)
+        throw runtime_error(path + " has an unsupported version");
+    if (h.dim != D || h.seed != opt.seed)
+        throw runtime_error(path + " was built with dimensions " + to_string(h.dim) + " and seed " +
+            to_string(h.seed) + ", not comparable");
+    for (uint64_t i = 0; i < h.count; ++i)
+    {
+        Sample s;
+        uint32_t len;
+        f.read((char*)&s.kmers, sizeof(s.kmers));
+        f.read((char*)&len, sizeof(len));
+        s.name.resize(len);
+        f.read(&s.name[0], len);
+        uint64_t bits[BinaryHV<D>::WORDS];
+        if (!f.read((char*)bits, sizeof(bits)))
+            throw runtime_error(path + " is truncated");
+        samples.push_back(s);
+        sigs.push_back(BinaryHV<D>(bits));
+    }
+}
+
+template <size_t D>
+void save(const string& path, const Options& opt, const vector<Sample>& samples, const vector<BinaryHV<D>>& sigs)
+{
+    ofstream f(path, ios::binary);
+    SignatureHeader h = {};
+    memcpy(h.magic, SignatureHeader::MAGIC, 8);
+    h.version = SignatureHeader::VERSION;
+    h.dim = D;
+    h.seed = opt.seed;
+    h.count = samples.size();
+    f.write((const char*)&h, sizeof(h));
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        uint32_t len = samples[i].name.size();
+        f.write((const char*)&samples[i].kmers, sizeof(samples[i].kmers));
+        f.write((const char*)&len, sizeof(len));
+        f.write(samples[i].name.data(), len);
+        f.write((const char*)sigs[i].data(), BinaryHV<D>::WORDS * 8);
+    }
+    if (!f)
+        throw runtime_error("cannot write " + path);
+}
+
+template <size_t D>
+void run(const Options& opt)
+{
+    vector<Sample> samples;
+    vector<BinaryHV<D>> sigs;
+    for (const auto& path : opt.load)
+    {
+        load(path, opt, samples, sigs);
+    }
+
+    auto t0 = chrono::steady_clock::now();
+    size_t kmers = 0;
+    for (const auto& path : opt.fasta)
+    {
+        Fasta fa(path, true);
+        GenomeSignature<D> sig(opt.seed);
+        for (const Fasta::Record& r : fa.records())
+        {
+            sig.add_sequence(fa.data() + r.offset / 16, r.length);
+        }
+        samples.push_back({path, sig.size()});
+        sigs.push_back(sig.binary());
+        kmers += sig.size();
+    }
+    auto t1 = chrono::steady_clock::now();
+    if (!opt.fasta.empty())
+    {
+        double sec = chrono::duration<double>(t1 - t0).count();
+        cerr << "built " << opt.fasta.size() << " signatures of " << kmers << " k-mers in " << sec << " s ("
+             << sec * 1e9 / max<size_t>(1, kmers) << " ns/k-mer)" << endl;
+    }
+    if (!opt.save.empty())
+    {
+        save(opt.save, opt, samples, sigs);
+    }
+
+    size_t n = sigs.size();
+    vector<float> sim(n * n);
+    GenomeSignature<D>::all_vs_all(sigs.data(), n, sim.data());
+    auto t2 = chrono::steady_clock::now();
+    cerr << "compared " << n * (n + 1) / 2 << " pairs in " << chrono::duration<double>(t2 - t1).count() << " s" << endl;
+
+    ofstream file;
+    if (!opt.output.empty())
+    {
+        file.open(opt.output);
+        if (!file)
+            throw runtime_error("cannot write " + opt.output);
+    }
+    ostream& out = opt.output.empty() ? cout : file;
+    out << "sample";
+    for (const auto& s : samples)
+    {
+        out << "," << s.name;
+    }
+    out << "\n" << fixed << setprecision(4);
+    for (size_t i = 0; i < n; ++i)
+    {
+        out << samples[i].name;
+        for (size_t j = 0; j < n; ++j)
+        {
+            out << "," << sim[i * n + j];
+        }
+        out << "\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    try
+    {
+        opt = parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << "\n" << usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        if (opt.dim == 1024)
+            run<1024>(opt);
+        else if (opt.dim == 4096)
+            run<4096>(opt);
+        else
+            run<16384>(opt);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -36,7 +36,7 @@ void compressKernel(uint32_t* dst, const char* src, uint32_t num_outs)
     }
 }
 
-Fasta::Fasta(string path)
+Fasta::Fasta(string path, bool all_records)
 {
     string buffer;
     ifstream f(path);
@@ -45,18 +45,27 @@ Fasta::Fasta(string path)
     
     string line;
     getline(f, line);
-    while (true)
+    recs.push_back({0, 0});
+    while (getline(f, line))
     {
-        getline(f, line);
-        if (line.size() != 0 && line[0] != '>' && line[0] != ';')
+        if (line.size() != 0 && line[0] == '>')
+        {
+            if (!all_records)
+                break;
+            recs.back().length = buffer.size() - recs.back().offset;
+            // pad with 'A' so that the next record starts at a word
+            buffer += string((16 - buffer.size() % 16) % 16, 'A');
+            recs.push_back({buffer.size(), 0});
+            continue;
+        }
+        if (line.size() != 0 && line[0] != ';')
         {   
             buffer += line;
         }
-        if (f.eof() || (line.size() != 0 && line[0] == '>'))
-            break;
     }
     f.close();
 
+    recs.back().length = buffer.size() - recs.back().offset;
     this->sz = buffer.size();
 
     int remainder = buffer.size() % 16;
@@ -65,18 +74,12 @@ Fasta::Fasta(string path)
     // pad with 'A' for compressing
     buffer += string(pad, 'A');
 
-    compressed = new uint32_t[buffer.size() / 4];
-    compressKernel(compressed, &buffer[0], buffer.size() / 16);
+    compressed.assign(buffer.size() / 16, 0);
+    compressKernel(compressed.data(), &buffer[0], buffer.size() / 16);
 }
 
 void Fasta::Read128Mer(uint32_t offset, Compressed128Mer& out) const
 {
-    for (int i = 0; i < 8; ++i)
-    {
-        uint32_t index = offset / 16 + i;
-        uint32_t shift_1 = offset % 16 * 2;
-        uint32_t shift_2 = (16 - shift_1) * 2;
-        out.u32[i] = (compressed[index] >> shift_1) | (compressed[index + 1] << shift_2);
-    }
+    utils::Read128Mer(compressed.data(), offset, out);
 }
 
@@ -11,5 +11,16 @@ namespace utils
         }
         return true;
     }
+
+    void Read128Mer(const uint32_t* data, uint32_t offset, Compressed128Mer& out)
+    {
+        uint32_t shift = offset % 16 * 2;
+        for (int i = 0; i < 8; ++i)
+        {
+            uint32_t index = offset / 16 + i;
+            // the next word is only needed, and only guaranteed to exist, for unaligned offsets
+            out.u32[i] = shift == 0 ? data[index] : (data[index] >> shift) | (data[index + 1] << (32 - shift));
+        }
+    }
 }
 